@@ -0,0 +1,543 @@
+/* jwsatlas.c - the file of previews kept for each config
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "jwsatlas.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#define JWS_ATLAS_MAGIC "JWSATLAS"
+
+/* Bump this whenever the layout changes.  Files are in native byte order,
+ * and one written with the other order won't have a matching version.  */
+#define JWS_ATLAS_VERSION 1
+
+/* Pixels for each preview start on a multiple of this.  */
+#define JWS_ATLAS_ALIGNMENT 16
+
+/* No preview is anywhere near this wide or tall, so an entry that is has
+ * been damaged.  */
+#define JWS_ATLAS_MAX_DIMENSION 65536
+
+/* The file is a header, then n_entries entries, then the paths one after
+ * another without terminators, then the pixels.  Everything is sized
+ * explicitly so the layout doesn't depend on the compiler.  */
+typedef struct _JwsAtlasHeader JwsAtlasHeader;
+
+struct _JwsAtlasHeader
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 preview_height;
+  guint32 n_entries;
+  guint32 padding;
+  guint64 strings_offset;
+  guint64 strings_size;
+};
+
+typedef struct _JwsAtlasEntry JwsAtlasEntry;
+
+struct _JwsAtlasEntry
+{
+  gint64 mtime;
+  guint64 path_offset;
+  guint64 pixels_offset;
+  guint32 path_length;
+  guint32 width;
+  guint32 height;
+  guint32 rowstride;
+  guint32 n_channels;
+  guint32 padding;
+};
+
+struct _JwsAtlas
+{
+  GMappedFile *mapped_file;
+  /* Maps paths to the JwsAtlasEntry in the mapped file.  The keys are
+   * copies, the entries belong to the file.  */
+  GHashTable *entries;
+};
+
+typedef struct _JwsAtlasItem JwsAtlasItem;
+
+struct _JwsAtlasItem
+{
+  gchar *path;
+  gint64 mtime;
+  GdkPixbuf *preview;
+};
+
+struct _JwsAtlasWriter
+{
+  int preview_height;
+  /* JwsAtlasItems in the order they were added.  */
+  GPtrArray *items;
+  /* Paths already in items, to skip duplicates.  */
+  GHashTable *paths;
+};
+
+static void
+jws_atlas_item_free (JwsAtlasItem *item);
+
+static void
+on_atlas_pixbuf_destroyed (guchar *pixels, GMappedFile *mapped_file);
+
+static guint32
+jws_atlas_get_rowstride (int width, int n_channels);
+
+static guint64
+jws_atlas_align (guint64 offset);
+
+/* Writes size bytes of zeros.  */
+static gboolean
+jws_atlas_write_padding (GOutputStream *stream,
+                         gsize size,
+                         GError **err);
+
+gchar *
+jws_atlas_get_file_for_config (const gchar *config_path)
+{
+  g_return_val_if_fail (config_path != NULL, NULL);
+
+  /* Use the absolute path so the same config opened from different
+   * directories gets the same atlas.  */
+  GFile *config_file;
+  config_file = g_file_new_for_path (config_path);
+
+  gchar *absolute_path;
+  absolute_path = g_file_get_path (config_file);
+  g_object_unref (config_file);
+
+  gchar *checksum;
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5,
+                                            (absolute_path != NULL)
+                                            ? absolute_path
+                                            : config_path,
+                                            -1);
+  g_free (absolute_path);
+
+  gchar *basename;
+  basename = g_strconcat (checksum, ".atlas", NULL);
+
+  gchar *file;
+  file = g_build_filename (g_get_user_cache_dir (),
+                           "jws-config",
+                           "atlas",
+                           basename,
+                           NULL);
+
+  g_free (basename);
+  g_free (checksum);
+
+  return file;
+}
+
+static guint32
+jws_atlas_get_rowstride (int width, int n_channels)
+{
+  return ((guint32) width * n_channels + 3) & ~(guint32) 3;
+}
+
+static guint64
+jws_atlas_align (guint64 offset)
+{
+  return (offset + JWS_ATLAS_ALIGNMENT - 1)
+    & ~(guint64) (JWS_ATLAS_ALIGNMENT - 1);
+}
+
+JwsAtlas *
+jws_atlas_open (const gchar *file, int preview_height, GError **err)
+{
+  g_return_val_if_fail (file != NULL, NULL);
+
+  GMappedFile *mapped_file;
+  /* Writable maps privately, so nothing can change the file, but lets the
+   * pixbufs be created without casting away const.  */
+  mapped_file = g_mapped_file_new (file, TRUE, err);
+  if (!mapped_file)
+    return NULL;
+
+  gsize length = g_mapped_file_get_length (mapped_file);
+  gchar *contents = g_mapped_file_get_contents (mapped_file);
+
+  JwsAtlasHeader header;
+  if (length < sizeof (header))
+    goto invalid;
+
+  memcpy (&header, contents, sizeof (header));
+  if (memcmp (header.magic, JWS_ATLAS_MAGIC, sizeof (header.magic)) != 0
+      || header.version != JWS_ATLAS_VERSION
+      || header.preview_height != (guint32) preview_height)
+    goto invalid;
+
+  guint64 entries_end = sizeof (header)
+    + (guint64) header.n_entries * sizeof (JwsAtlasEntry);
+  if (entries_end > length
+      || header.strings_offset < entries_end
+      || header.strings_offset > length
+      || header.strings_size > length - header.strings_offset)
+    goto invalid;
+
+  JwsAtlas *atlas;
+  atlas = g_new (JwsAtlas, 1);
+  atlas->mapped_file = mapped_file;
+  atlas->entries = g_hash_table_new_full (g_str_hash,
+                                          g_str_equal,
+                                          g_free,
+                                          NULL);
+
+  /* The entries start 40 bytes in, which keeps them 8 byte aligned since
+   * mmap () gives page aligned memory.  */
+  JwsAtlasEntry *entries = (JwsAtlasEntry *) (contents + sizeof (header));
+  for (guint32 i = 0; i < header.n_entries; i++)
+    {
+      JwsAtlasEntry *entry = &entries[i];
+
+      /* Skip entries that point outside the file rather than throwing the
+       * whole atlas away.  */
+      if (entry->path_offset > header.strings_size
+          || entry->path_length > header.strings_size - entry->path_offset
+          || (entry->n_channels != 3 && entry->n_channels != 4)
+          || entry->width == 0
+          || entry->width > JWS_ATLAS_MAX_DIMENSION
+          || entry->width > G_MAXINT / entry->n_channels
+          || entry->height != header.preview_height
+          || entry->height > JWS_ATLAS_MAX_DIMENSION
+          || entry->rowstride > G_MAXINT
+          || (guint64) entry->rowstride
+          < (guint64) entry->width * entry->n_channels
+          || entry->pixels_offset > length
+          || (guint64) entry->rowstride * entry->height
+          > length - entry->pixels_offset)
+        continue;
+
+      gchar *path;
+      path = g_strndup (contents + header.strings_offset + entry->path_offset,
+                        entry->path_length);
+      g_hash_table_replace (atlas->entries, path, entry);
+    }
+
+  return atlas;
+
+ invalid:
+  g_set_error (err,
+               G_IO_ERROR,
+               G_IO_ERROR_INVALID_DATA,
+               "Preview atlas %s is not valid.",
+               file);
+  g_mapped_file_unref (mapped_file);
+  return NULL;
+}
+
+void
+jws_atlas_free (JwsAtlas *atlas)
+{
+  if (!atlas)
+    return;
+
+  g_hash_table_unref (atlas->entries);
+  /* Pixbufs handed out keep their own references.  */
+  g_mapped_file_unref (atlas->mapped_file);
+  g_free (atlas);
+}
+
+static void
+on_atlas_pixbuf_destroyed (guchar *pixels, GMappedFile *mapped_file)
+{
+  g_mapped_file_unref (mapped_file);
+}
+
+GdkPixbuf *
+jws_atlas_lookup (JwsAtlas *atlas, const gchar *path, gint64 mtime)
+{
+  g_return_val_if_fail (atlas != NULL, NULL);
+  g_return_val_if_fail (path != NULL, NULL);
+
+  JwsAtlasEntry *entry;
+  entry = g_hash_table_lookup (atlas->entries, path);
+  if (!entry || entry->mtime != mtime)
+    return NULL;
+
+  guchar *pixels;
+  pixels = (guchar *) g_mapped_file_get_contents (atlas->mapped_file)
+    + entry->pixels_offset;
+
+  return gdk_pixbuf_new_from_data (pixels,
+                                   GDK_COLORSPACE_RGB,
+                                   entry->n_channels == 4,
+                                   8,
+                                   entry->width,
+                                   entry->height,
+                                   entry->rowstride,
+                                   (GdkPixbufDestroyNotify)
+                                   on_atlas_pixbuf_destroyed,
+                                   g_mapped_file_ref (atlas->mapped_file));
+}
+
+static void
+jws_atlas_item_free (JwsAtlasItem *item)
+{
+  g_free (item->path);
+  g_object_unref (item->preview);
+  g_free (item);
+}
+
+JwsAtlasWriter *
+jws_atlas_writer_new (int preview_height)
+{
+  JwsAtlasWriter *writer;
+  writer = g_new (JwsAtlasWriter, 1);
+
+  writer->preview_height = preview_height;
+  writer->items = g_ptr_array_new_with_free_func ((GDestroyNotify)
+                                                  jws_atlas_item_free);
+  writer->paths = g_hash_table_new (g_str_hash, g_str_equal);
+
+  return writer;
+}
+
+void
+jws_atlas_writer_free (JwsAtlasWriter *writer)
+{
+  if (!writer)
+    return;
+
+  /* The keys belong to the items.  */
+  g_hash_table_unref (writer->paths);
+  g_ptr_array_unref (writer->items);
+  g_free (writer);
+}
+
+void
+jws_atlas_writer_add (JwsAtlasWriter *writer,
+                      const gchar *path,
+                      gint64 mtime,
+                      GdkPixbuf *preview)
+{
+  g_return_if_fail (writer != NULL);
+  g_return_if_fail (path != NULL);
+  g_return_if_fail (GDK_IS_PIXBUF (preview));
+
+  if (g_hash_table_contains (writer->paths, path))
+    return;
+
+  if (gdk_pixbuf_get_colorspace (preview) != GDK_COLORSPACE_RGB
+      || gdk_pixbuf_get_bits_per_sample (preview) != 8
+      || gdk_pixbuf_get_height (preview) != writer->preview_height)
+    return;
+
+  JwsAtlasItem *item;
+  item = g_new (JwsAtlasItem, 1);
+  item->path = g_strdup (path);
+  item->mtime = mtime;
+  item->preview = g_object_ref (preview);
+
+  g_ptr_array_add (writer->items, item);
+  g_hash_table_add (writer->paths, item->path);
+}
+
+static gboolean
+jws_atlas_write_padding (GOutputStream *stream,
+                         gsize size,
+                         GError **err)
+{
+  static const guchar zeros[JWS_ATLAS_ALIGNMENT] = {0};
+
+  while (size > 0)
+    {
+      gsize part = MIN (size, sizeof (zeros));
+      if (!g_output_stream_write_all (stream, zeros, part, NULL, NULL, err))
+        return FALSE;
+      size -= part;
+    }
+
+  return TRUE;
+}
+
+gboolean
+jws_atlas_writer_save (JwsAtlasWriter *writer,
+                       const gchar *file,
+                       GError **err)
+{
+  g_return_val_if_fail (writer != NULL, FALSE);
+  g_return_val_if_fail (file != NULL, FALSE);
+
+  gchar *directory;
+  directory = g_path_get_dirname (file);
+  g_mkdir_with_parents (directory, 0700);
+  g_free (directory);
+
+  guint n_items = writer->items->len;
+
+  /* Lay out the whole file first so the index can be written in one go at
+   * the front.  */
+  JwsAtlasEntry *entries;
+  entries = g_new0 (JwsAtlasEntry, MAX (n_items, 1));
+
+  guint64 strings_size = 0;
+  for (guint i = 0; i < n_items; i++)
+    {
+      JwsAtlasItem *item = g_ptr_array_index (writer->items, i);
+      entries[i].path_offset = strings_size;
+      entries[i].path_length = strlen (item->path);
+      strings_size += entries[i].path_length;
+    }
+
+  JwsAtlasHeader header;
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, JWS_ATLAS_MAGIC, sizeof (header.magic));
+  header.version = JWS_ATLAS_VERSION;
+  header.preview_height = writer->preview_height;
+  header.n_entries = n_items;
+  header.strings_offset = sizeof (header)
+    + (guint64) n_items * sizeof (JwsAtlasEntry);
+  header.strings_size = strings_size;
+
+  guint64 offset = jws_atlas_align (header.strings_offset + strings_size);
+  guint64 pixels_offset = offset;
+  for (guint i = 0; i < n_items; i++)
+    {
+      JwsAtlasItem *item = g_ptr_array_index (writer->items, i);
+      int n_channels = gdk_pixbuf_get_n_channels (item->preview);
+
+      entries[i].mtime = item->mtime;
+      entries[i].pixels_offset = offset;
+      entries[i].width = gdk_pixbuf_get_width (item->preview);
+      entries[i].height = gdk_pixbuf_get_height (item->preview);
+      entries[i].rowstride = jws_atlas_get_rowstride (entries[i].width,
+                                                      n_channels);
+      entries[i].n_channels = n_channels;
+
+      offset = jws_atlas_align (offset
+                                + (guint64) entries[i].rowstride
+                                * entries[i].height);
+    }
+
+  GFile *atlas_file;
+  atlas_file = g_file_new_for_path (file);
+
+  /* This writes to a temporary file and renames it at the end, so a map of
+   * the old atlas stays valid and a crash never leaves half a file.  */
+  GFileOutputStream *file_stream;
+  file_stream = g_file_replace (atlas_file,
+                                NULL,
+                                FALSE,
+                                G_FILE_CREATE_PRIVATE
+                                | G_FILE_CREATE_REPLACE_DESTINATION,
+                                NULL,
+                                err);
+  g_object_unref (atlas_file);
+
+  if (!file_stream)
+    {
+      g_free (entries);
+      return FALSE;
+    }
+
+  GOutputStream *stream;
+  stream = g_buffered_output_stream_new_sized (G_OUTPUT_STREAM (file_stream),
+                                               1 << 16);
+
+  gboolean success = TRUE;
+
+  success = g_output_stream_write_all (stream,
+                                       &header,
+                                       sizeof (header),
+                                       NULL,
+                                       NULL,
+                                       err)
+    && g_output_stream_write_all (stream,
+                                  entries,
+                                  (gsize) n_items * sizeof (JwsAtlasEntry),
+                                  NULL,
+                                  NULL,
+                                  err);
+
+  for (guint i = 0; success && i < n_items; i++)
+    {
+      JwsAtlasItem *item = g_ptr_array_index (writer->items, i);
+      success = g_output_stream_write_all (stream,
+                                           item->path,
+                                           entries[i].path_length,
+                                           NULL,
+                                           NULL,
+                                           err);
+    }
+
+  if (success)
+    success = jws_atlas_write_padding (stream,
+                                       pixels_offset
+                                       - header.strings_offset
+                                       - strings_size,
+                                       err);
+
+  for (guint i = 0; success && i < n_items; i++)
+    {
+      JwsAtlasItem *item = g_ptr_array_index (writer->items, i);
+      JwsAtlasEntry *entry = &entries[i];
+
+      const guchar *pixels = gdk_pixbuf_read_pixels (item->preview);
+      int src_rowstride = gdk_pixbuf_get_rowstride (item->preview);
+      gsize row_length = (gsize) entry->width * entry->n_channels;
+
+      /* Write row by row, the pixbuf's own rowstride may differ and its
+       * last row can be shorter than the rowstride.  */
+      for (guint32 y = 0; success && y < entry->height; y++)
+        {
+          success = g_output_stream_write_all (stream,
+                                               pixels + y * src_rowstride,
+                                               row_length,
+                                               NULL,
+                                               NULL,
+                                               err)
+            && jws_atlas_write_padding (stream,
+                                        entry->rowstride - row_length,
+                                        err);
+        }
+
+      guint64 end = entry->pixels_offset
+        + (guint64) entry->rowstride * entry->height;
+      guint64 next = (i + 1 < n_items) ? entries[i + 1].pixels_offset : end;
+      if (success)
+        success = jws_atlas_write_padding (stream, next - end, err);
+    }
+
+  g_free (entries);
+
+  /* Only close on success, closing is what moves the new file into place.
+   * Otherwise cancel it by dropping the stream unclosed with an error.  */
+  if (success)
+    {
+      success = g_output_stream_close (stream, NULL, err);
+    }
+  else
+    {
+      GCancellable *cancellable;
+      cancellable = g_cancellable_new ();
+      g_cancellable_cancel (cancellable);
+      g_output_stream_close (stream, cancellable, NULL);
+      g_object_unref (cancellable);
+    }
+
+  g_object_unref (stream);
+  g_object_unref (file_stream);
+
+  return success;
+}
@@ -0,0 +1,76 @@
+/* jwsatlas.h - header for the file of previews kept for each config
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef JWSATLAS_H
+#define JWSATLAS_H
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/* An atlas is a single file holding the raw pixels of every preview for a
+ * config, with an index by path and modification time.  Opening one maps
+ * the file into memory and the previews are GdkPixbufs pointing straight
+ * into it, so reopening a config with thousands of images takes one mmap ()
+ * instead of thousands of opens and decodes.  Atlases live in
+ * ~/.cache/jws-config/atlas and are rewritten as a whole.  */
+typedef struct _JwsAtlas JwsAtlas;
+
+/* Collects previews to write a new atlas.  */
+typedef struct _JwsAtlasWriter JwsAtlasWriter;
+
+/* Where the atlas for the config file at config_path goes.  Free with
+ * g_free ().  */
+gchar *
+jws_atlas_get_file_for_config (const gchar *config_path);
+
+/* Maps the atlas at file.  Returns NULL and sets err if it doesn't exist,
+ * isn't valid or was made for a different preview height.  */
+JwsAtlas *
+jws_atlas_open (const gchar *file, int preview_height, GError **err);
+
+/* Previews that were looked up stay valid after this.  */
+void
+jws_atlas_free (JwsAtlas *atlas);
+
+/* Returns a new reference to the preview for path if there is one for the
+ * same modification time, otherwise NULL.  */
+GdkPixbuf *
+jws_atlas_lookup (JwsAtlas *atlas, const gchar *path, gint64 mtime);
+
+JwsAtlasWriter *
+jws_atlas_writer_new (int preview_height);
+
+void
+jws_atlas_writer_free (JwsAtlasWriter *writer);
+
+/* Adds the preview for path, unless path was already added.  Previews that
+ * aren't 8 bit RGB or RGBA at the preview height are skipped.  */
+void
+jws_atlas_writer_add (JwsAtlasWriter *writer,
+                      const gchar *path,
+                      gint64 mtime,
+                      GdkPixbuf *preview);
+
+/* Replaces file with an atlas of everything added, creating the directory if
+ * needed.  */
+gboolean
+jws_atlas_writer_save (JwsAtlasWriter *writer,
+                       const gchar *file,
+                       GError **err);
+
+#endif /* JWSATLAS_H */
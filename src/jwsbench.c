@@ -0,0 +1,723 @@
+/* jwsbench.c - benchmarks for the preview code, not installed
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Run with "make bench" or as jws-config-bench COMMAND [OPTION...].  Each
+ * command prints its results and exits with a non-zero status if something
+ * came out wrong, so it can double as a sanity check after changing the
+ * preview code.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glib/gstdio.h>
+
+#include "jwspreviewpool.h"
+#include "jwspreviewstats.h"
+#include "jwsscale.h"
+
+/* Same as the window, so the numbers match what people see.  */
+#define JWS_BENCH_PREVIEW_HEIGHT 100
+
+/* The box filter and GdkPixbuf don't round the same way and HYPER sharpens a
+ * little, so some difference is expected.  Anything past this means the box
+ * filter is broken.  */
+#define JWS_BENCH_MAX_MEAN_DIFFERENCE 4.0
+
+static int
+jws_bench_scale (int argc, char **argv);
+
+static int
+jws_bench_pipeline (int argc, char **argv);
+
+typedef struct _JwsBenchPipeline JwsBenchPipeline;
+
+/* State for one run of the preview pool over the generated images.  */
+struct _JwsBenchPipeline
+{
+  GMainLoop *loop;
+  int n_images;
+  int n_done;
+  int n_failed;
+  gint64 start_time;
+  gint64 first_time;
+  gint64 last_fast_time;
+  gint64 last_time;
+  /* Jobs the pool hasn't freed yet.  Each holds a reference to the pool, so
+   * the pool is gone once this is 0.  */
+  int n_jobs;
+};
+
+/* Writes count images to directory, cycling through the sizes and formats.
+ * Only one image of each size and format is encoded, the rest are copies
+ * with different names.  Returns FALSE and prints why on failure.  */
+static gboolean
+jws_bench_generate_images (const gchar *directory,
+                           int count,
+                           gchar **sizes,
+                           gchar **formats,
+                           GPtrArray *paths);
+
+static void
+on_bench_preview_ready (const gchar *path,
+                        GdkPixbuf *preview,
+                        gint64 mtime,
+                        gboolean is_final,
+                        gpointer job_data,
+                        gpointer pipeline);
+
+static void
+on_bench_job_freed (gpointer pipeline);
+
+/* Runs the pool over paths once and prints the timings.  */
+static void
+jws_bench_run_pipeline (GPtrArray *paths, int n_threads, const gchar *label);
+
+static void
+jws_bench_remove_recursive (const gchar *path);
+
+/* Makes an image with gradients and noise, so that averaging actually has to
+ * do something.  */
+static GdkPixbuf *
+jws_bench_create_image (int width, int height, gboolean has_alpha);
+
+/* Shrinks src to height the way previews are, with the box filter first if
+ * impl isn't JWS_SCALE_IMPL_NONE.  */
+static GdkPixbuf *
+jws_bench_scale_once (GdkPixbuf *src, int height, JwsScaleImpl impl);
+
+/* Mean absolute difference per channel, or a negative number if the sizes
+ * don't match.  */
+static double
+jws_bench_compare (GdkPixbuf *a, GdkPixbuf *b, int *max_difference);
+
+int
+main (int argc, char **argv)
+{
+  if (argc < 2)
+    {
+      g_printerr ("Usage: %s scale|pipeline [OPTION...]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  if (g_strcmp0 (argv[1], "scale") == 0)
+    return jws_bench_scale (argc - 1, argv + 1);
+
+  if (g_strcmp0 (argv[1], "pipeline") == 0)
+    return jws_bench_pipeline (argc - 1, argv + 1);
+
+  g_printerr ("Unknown command \"%s\"\n", argv[1]);
+  return EXIT_FAILURE;
+}
+
+static GdkPixbuf *
+jws_bench_create_image (int width, int height, gboolean has_alpha)
+{
+  GdkPixbuf *image;
+  image = gdk_pixbuf_new (GDK_COLORSPACE_RGB, has_alpha, 8, width, height);
+
+  int n_channels = gdk_pixbuf_get_n_channels (image);
+  int stride = gdk_pixbuf_get_rowstride (image);
+  guchar *pixels = gdk_pixbuf_get_pixels (image);
+
+  /* Fixed seed so every run works on the same image.  */
+  GRand *rand;
+  rand = g_rand_new_with_seed (42);
+
+  for (int y = 0; y < height; y++)
+    {
+      guchar *row = pixels + (gsize) y * stride;
+      for (int x = 0; x < width; x++)
+        {
+          guchar *pixel = row + x * n_channels;
+          pixel[0] = x * 255 / width;
+          pixel[1] = y * 255 / height;
+          pixel[2] = g_rand_int_range (rand, 0, 256);
+          if (has_alpha)
+            pixel[3] = 255;
+        }
+    }
+
+  g_rand_free (rand);
+
+  return image;
+}
+
+static GdkPixbuf *
+jws_bench_scale_once (GdkPixbuf *src, int height, JwsScaleImpl impl)
+{
+  int width;
+  width = MAX (1, height * gdk_pixbuf_get_width (src)
+               / gdk_pixbuf_get_height (src));
+
+  GdkPixbuf *reduced = NULL;
+  if (impl != JWS_SCALE_IMPL_NONE)
+    reduced = jws_scale_box_reduce_with_impl (src, width, height, impl);
+
+  GdkPixbuf *scaled;
+  scaled = gdk_pixbuf_scale_simple (reduced ? reduced : src,
+                                    width, height,
+                                    GDK_INTERP_BILINEAR);
+
+  g_clear_object (&reduced);
+
+  return scaled;
+}
+
+static double
+jws_bench_compare (GdkPixbuf *a, GdkPixbuf *b, int *max_difference)
+{
+  int width = gdk_pixbuf_get_width (a);
+  int height = gdk_pixbuf_get_height (a);
+  int n_channels = gdk_pixbuf_get_n_channels (a);
+
+  if (width != gdk_pixbuf_get_width (b)
+      || height != gdk_pixbuf_get_height (b)
+      || n_channels != gdk_pixbuf_get_n_channels (b))
+    return -1.0;
+
+  const guchar *a_pixels = gdk_pixbuf_read_pixels (a);
+  const guchar *b_pixels = gdk_pixbuf_read_pixels (b);
+  int a_stride = gdk_pixbuf_get_rowstride (a);
+  int b_stride = gdk_pixbuf_get_rowstride (b);
+
+  guint64 total = 0;
+  *max_difference = 0;
+
+  for (int y = 0; y < height; y++)
+    {
+      for (int i = 0; i < width * n_channels; i++)
+        {
+          int difference = ABS (a_pixels[y * a_stride + i]
+                                - b_pixels[y * b_stride + i]);
+          total += difference;
+          *max_difference = MAX (*max_difference, difference);
+        }
+    }
+
+  return (double) total / ((double) width * height * n_channels);
+}
+
+static int
+jws_bench_scale (int argc, char **argv)
+{
+  int width = 3840;
+  int height = 2160;
+  int preview_height = 100;
+  int iterations = 20;
+  gboolean has_alpha = FALSE;
+
+  /* No short options for the size, since -h is GOption's help.  */
+  GOptionEntry entries[] =
+    {
+      {"width", 0, 0, G_OPTION_ARG_INT, &width,
+        "Width of the source image", "PIXELS"},
+      {"height", 0, 0, G_OPTION_ARG_INT, &height,
+        "Height of the source image", "PIXELS"},
+      {"preview-height", 'p', 0, G_OPTION_ARG_INT, &preview_height,
+        "Height to shrink to", "PIXELS"},
+      {"iterations", 'n', 0, G_OPTION_ARG_INT, &iterations,
+        "How many times to shrink the image with each version", "N"},
+      {"alpha", 'a', 0, G_OPTION_ARG_NONE, &has_alpha,
+        "Use an RGBA image instead of RGB", NULL},
+      {NULL}
+    };
+
+  GOptionContext *context;
+  context = g_option_context_new ("- compare the box filter to GdkPixbuf");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  GError *err = NULL;
+  if (!g_option_context_parse (context, &argc, &argv, &err))
+    {
+      g_printerr ("%s\n", err->message);
+      g_error_free (err);
+      g_option_context_free (context);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (context);
+
+  if (width <= 0 || height <= 0 || preview_height <= 0 || iterations <= 0)
+    {
+      g_printerr ("Sizes and iterations must be positive\n");
+      return EXIT_FAILURE;
+    }
+
+  GdkPixbuf *image;
+  image = jws_bench_create_image (width, height, has_alpha);
+
+  /* What previews looked like before the box filter, shrinking the whole way
+   * with HYPER.  Only the quality matters here, not the time.  */
+  GdkPixbuf *reference;
+  reference = gdk_pixbuf_scale_simple
+    (image, MAX (1, preview_height * width / height), preview_height,
+     GDK_INTERP_HYPER);
+
+  g_print ("Shrinking %dx%d %s to %d pixels high, %d times each\n",
+           width, height, has_alpha ? "RGBA" : "RGB", preview_height,
+           iterations);
+  g_print ("%-8s %12s %12s %10s %8s\n",
+           "version", "ms/image", "Mpixels/s", "mean diff", "max diff");
+
+  gboolean all_passed = TRUE;
+  double baseline_time = 0.0;
+
+  JwsScaleImpl impls[] =
+    {
+      JWS_SCALE_IMPL_NONE,
+      JWS_SCALE_IMPL_SCALAR,
+      JWS_SCALE_IMPL_SSE2,
+      JWS_SCALE_IMPL_AVX2
+    };
+
+  for (gsize i = 0; i < G_N_ELEMENTS (impls); i++)
+    {
+      JwsScaleImpl impl = impls[i];
+
+      /* jws_scale_set_impl () falls back for unsupported versions, which is
+       * a way of finding out without exposing another function.  */
+      jws_scale_set_impl (impl);
+      if (jws_scale_get_impl () != impl)
+        {
+          g_print ("%-8s %12s\n", jws_scale_impl_to_string (impl),
+                   "unsupported");
+          continue;
+        }
+
+      GdkPixbuf *scaled = NULL;
+
+      gint64 start_time = g_get_monotonic_time ();
+      for (int j = 0; j < iterations; j++)
+        {
+          g_clear_object (&scaled);
+          scaled = jws_bench_scale_once (image, preview_height, impl);
+        }
+      gint64 end_time = g_get_monotonic_time ();
+
+      double seconds = (end_time - start_time) / (double) G_USEC_PER_SEC;
+      double per_image = seconds / iterations;
+      if (impl == JWS_SCALE_IMPL_NONE)
+        baseline_time = per_image;
+
+      int max_difference = 0;
+      double mean_difference;
+      mean_difference = jws_bench_compare (scaled, reference,
+                                           &max_difference);
+
+      gboolean passed = (mean_difference >= 0.0
+                         && mean_difference <= JWS_BENCH_MAX_MEAN_DIFFERENCE);
+      all_passed = all_passed && passed;
+
+      g_print ("%-8s %12.3f %12.1f %10.3f %8d",
+               jws_scale_impl_to_string (impl),
+               per_image * 1000.0,
+               (double) width * height / per_image / 1e6,
+               mean_difference,
+               max_difference);
+      if (baseline_time > 0.0 && impl != JWS_SCALE_IMPL_NONE)
+        g_print ("  %.1fx", baseline_time / per_image);
+      g_print ("%s\n", passed ? "" : "  FAILED");
+
+      g_object_unref (scaled);
+    }
+
+  g_object_unref (reference);
+  g_object_unref (image);
+
+  return all_passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static gboolean
+jws_bench_generate_images (const gchar *directory,
+                           int count,
+                           gchar **sizes,
+                           gchar **formats,
+                           GPtrArray *paths)
+{
+  int n_sizes = g_strv_length (sizes);
+  int n_formats = g_strv_length (formats);
+
+  /* The encoded file for each size and format pair, read back to make the
+   * copies.  */
+  int n_originals = n_sizes * n_formats;
+  gchar **contents = g_new0 (gchar *, n_originals);
+  gsize *lengths = g_new0 (gsize, n_originals);
+
+  gboolean is_valid = TRUE;
+
+  for (int i = 0; is_valid && i < count; i++)
+    {
+      int size_index = i % n_sizes;
+      int format_index = (i / n_sizes) % n_formats;
+      int original = size_index * n_formats + format_index;
+
+      const gchar *format = formats[format_index];
+      const gchar *extension = g_strcmp0 (format, "jpeg") == 0 ? "jpg" : format;
+
+      gchar *name;
+      name = g_strdup_printf ("image-%06d.%s", i, extension);
+      gchar *path;
+      path = g_build_filename (directory, name, NULL);
+      g_free (name);
+
+      GError *err = NULL;
+
+      if (!contents[original])
+        {
+          int width = 0;
+          int height = 0;
+          if (sscanf (sizes[size_index], "%dx%d", &width, &height) != 2
+              || width <= 0 || height <= 0)
+            {
+              g_printerr ("Invalid size \"%s\", use WIDTHxHEIGHT\n",
+                          sizes[size_index]);
+              is_valid = FALSE;
+            }
+
+          GdkPixbuf *image = NULL;
+          if (is_valid)
+            image = jws_bench_create_image (width, height, FALSE);
+
+          if (is_valid && !gdk_pixbuf_save (image, path, format, &err, NULL))
+            {
+              g_printerr ("Couldn't write %s: %s\n", path, err->message);
+              g_clear_error (&err);
+              is_valid = FALSE;
+            }
+          g_clear_object (&image);
+
+          if (is_valid && !g_file_get_contents (path, &contents[original],
+                                                &lengths[original], &err))
+            {
+              g_printerr ("%s\n", err->message);
+              g_clear_error (&err);
+              is_valid = FALSE;
+            }
+        }
+      else if (!g_file_set_contents (path, contents[original],
+                                     lengths[original], &err))
+        {
+          g_printerr ("%s\n", err->message);
+          g_clear_error (&err);
+          is_valid = FALSE;
+        }
+
+      if (is_valid)
+        g_ptr_array_add (paths, path);
+      else
+        g_free (path);
+    }
+
+  for (int i = 0; i < n_originals; i++)
+    g_free (contents[i]);
+  g_free (contents);
+  g_free (lengths);
+
+  return is_valid;
+}
+
+static void
+on_bench_preview_ready (const gchar *path,
+                        GdkPixbuf *preview,
+                        gint64 mtime,
+                        gboolean is_final,
+                        gpointer job_data,
+                        gpointer pipeline_ptr)
+{
+  JwsBenchPipeline *pipeline = pipeline_ptr;
+
+  gint64 now = g_get_monotonic_time ();
+
+  if (pipeline->first_time == 0)
+    pipeline->first_time = now;
+
+  if (!is_final)
+    {
+      pipeline->last_fast_time = now;
+      return;
+    }
+
+  if (!preview)
+    pipeline->n_failed++;
+
+  pipeline->last_time = now;
+  pipeline->n_done++;
+
+  if (pipeline->n_done == pipeline->n_images)
+    g_main_loop_quit (pipeline->loop);
+}
+
+static void
+on_bench_job_freed (gpointer pipeline_ptr)
+{
+  JwsBenchPipeline *pipeline = pipeline_ptr;
+  pipeline->n_jobs--;
+}
+
+static void
+jws_bench_run_pipeline (GPtrArray *paths, int n_threads, const gchar *label)
+{
+  JwsBenchPipeline pipeline = {0};
+  pipeline.loop = g_main_loop_new (NULL, FALSE);
+  pipeline.n_images = paths->len;
+
+  struct rusage usage_before;
+  getrusage (RUSAGE_SELF, &usage_before);
+
+  JwsPreviewPool *pool;
+  pool = jws_preview_pool_new (n_threads, JWS_BENCH_PREVIEW_HEIGHT,
+                               on_bench_preview_ready, &pipeline);
+
+  pipeline.start_time = g_get_monotonic_time ();
+
+  for (guint i = 0; i < paths->len; i++)
+    {
+      JwsPreviewJob *job;
+      job = jws_preview_pool_push (pool, g_ptr_array_index (paths, i), NULL,
+                                   &pipeline, on_bench_job_freed);
+      jws_preview_job_unref (job);
+      pipeline.n_jobs++;
+    }
+
+  if (paths->len > 0)
+    g_main_loop_run (pipeline.loop);
+
+  struct rusage usage_after;
+  getrusage (RUSAGE_SELF, &usage_after);
+
+  double cpu_seconds
+    = (usage_after.ru_utime.tv_sec - usage_before.ru_utime.tv_sec)
+    + (usage_after.ru_stime.tv_sec - usage_before.ru_stime.tv_sec)
+    + ((usage_after.ru_utime.tv_usec - usage_before.ru_utime.tv_usec)
+       + (usage_after.ru_stime.tv_usec - usage_before.ru_stime.tv_usec))
+    / 1e6;
+
+  double to_first = (pipeline.first_time - pipeline.start_time) / 1e6;
+  double to_last = (pipeline.last_time - pipeline.start_time) / 1e6;
+
+  g_print ("%s run, %d images on %d threads\n",
+           label, pipeline.n_images, jws_preview_pool_get_n_threads (pool));
+  g_print ("  time to first preview:  %.3f s\n", to_first);
+  if (pipeline.last_fast_time)
+    g_print ("  time to last fast one:  %.3f s\n",
+             (pipeline.last_fast_time - pipeline.start_time) / 1e6);
+  g_print ("  time to last preview:   %.3f s\n", to_last);
+  g_print ("  per image:              %.3f ms wall, %.3f ms CPU\n",
+           to_last * 1e3 / MAX (pipeline.n_images, 1),
+           cpu_seconds * 1e3 / MAX (pipeline.n_images, 1));
+  g_print ("  throughput:             %.1f images/s\n",
+           pipeline.n_images / MAX (to_last, 1e-6));
+  /* ru_maxrss is in kilobytes on Linux.  */
+  g_print ("  peak RSS so far:        %.1f MB\n",
+           usage_after.ru_maxrss / 1024.0);
+  if (pipeline.n_failed > 0)
+    g_print ("  failed:                 %d\n", pipeline.n_failed);
+
+  jws_preview_pool_free (pool);
+
+  /* The last jobs are delivered from a timeout, which drops the pool's
+   * last reference when it's done, so block until it has run.  Otherwise
+   * the next run would start with this pool still around.  */
+  while (pipeline.n_jobs > 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_main_loop_unref (pipeline.loop);
+}
+
+static void
+jws_bench_remove_recursive (const gchar *path)
+{
+  if (g_file_test (path, G_FILE_TEST_IS_DIR)
+      && !g_file_test (path, G_FILE_TEST_IS_SYMLINK))
+    {
+      GDir *dir;
+      dir = g_dir_open (path, 0, NULL);
+      if (dir)
+        {
+          const gchar *name;
+          while ((name = g_dir_read_name (dir)))
+            {
+              gchar *child;
+              child = g_build_filename (path, name, NULL);
+              jws_bench_remove_recursive (child);
+              g_free (child);
+            }
+          g_dir_close (dir);
+        }
+      g_rmdir (path);
+    }
+  else
+    {
+      g_unlink (path);
+    }
+}
+
+static int
+jws_bench_pipeline (int argc, char **argv)
+{
+  int count = 200;
+  int n_threads = 0;
+  gchar *sizes_string = NULL;
+  gchar *formats_string = NULL;
+  gchar *directory = NULL;
+  gboolean keep = FALSE;
+  gboolean warm = FALSE;
+  gboolean print_stats = FALSE;
+
+  GOptionEntry entries[] =
+    {
+      {"count", 'n', 0, G_OPTION_ARG_INT, &count,
+        "How many images to generate", "N"},
+      {"sizes", 's', 0, G_OPTION_ARG_STRING, &sizes_string,
+        "Comma separated image sizes, 3840x2160,1920x1080 by default",
+        "SIZES"},
+      {"formats", 'f', 0, G_OPTION_ARG_STRING, &formats_string,
+        "Comma separated formats, jpeg,png by default", "FORMATS"},
+      {"threads", 't', 0, G_OPTION_ARG_INT, &n_threads,
+        "Worker threads, one per processor by default", "N"},
+      {"directory", 'd', 0, G_OPTION_ARG_FILENAME, &directory,
+        "Where to put the images instead of a temporary directory.  Only the "
+        "images, config and cache directories made in it are deleted", "DIR"},
+      {"keep", 'k', 0, G_OPTION_ARG_NONE, &keep,
+        "Don't delete the images afterwards", NULL},
+      {"warm", 'w', 0, G_OPTION_ARG_NONE, &warm,
+        "Run a second time with the thumbnail cache filled", NULL},
+      {"stats", 0, 0, G_OPTION_ARG_NONE, &print_stats,
+        "Print the per stage statistics for all runs at the end", NULL},
+      {NULL}
+    };
+
+  GOptionContext *context;
+  context = g_option_context_new ("- time loading previews for many images");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  GError *err = NULL;
+  if (!g_option_context_parse (context, &argc, &argv, &err))
+    {
+      g_printerr ("%s\n", err->message);
+      g_error_free (err);
+      g_option_context_free (context);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (context);
+
+  if (count <= 0)
+    {
+      g_printerr ("The count must be positive\n");
+      return EXIT_FAILURE;
+    }
+
+  /* A directory given on the command line can have the user's own files in
+   * it, so only what this run makes in it is deleted.  */
+  gchar *root;
+  if (directory)
+    {
+      root = g_strdup (directory);
+      g_mkdir_with_parents (root, 0700);
+    }
+  else
+    {
+      root = g_dir_make_tmp ("jws-config-bench-XXXXXX", &err);
+      if (!root)
+        {
+          g_printerr ("%s\n", err->message);
+          g_error_free (err);
+          return EXIT_FAILURE;
+        }
+    }
+
+  /* Keep the user's preferences and thumbnail cache out of it, so every run
+   * starts the same way.  This has to happen before anything asks GLib for
+   * those directories.  */
+  gchar *config_dir = g_build_filename (root, "config", NULL);
+  gchar *cache_dir = g_build_filename (root, "cache", NULL);
+  gchar *image_dir = g_build_filename (root, "images", NULL);
+  gboolean has_config_dir = g_file_test (config_dir, G_FILE_TEST_EXISTS);
+  gboolean has_cache_dir = g_file_test (cache_dir, G_FILE_TEST_EXISTS);
+  gboolean has_image_dir = g_file_test (image_dir, G_FILE_TEST_EXISTS);
+  g_setenv ("XDG_CONFIG_HOME", config_dir, TRUE);
+  g_setenv ("XDG_CACHE_HOME", cache_dir, TRUE);
+  g_mkdir_with_parents (image_dir, 0700);
+
+  gchar **sizes = g_strsplit (sizes_string ? sizes_string
+                              : "3840x2160,1920x1080", ",", -1);
+  gchar **formats = g_strsplit (formats_string ? formats_string
+                                : "jpeg,png", ",", -1);
+
+  GPtrArray *paths = g_ptr_array_new_with_free_func (g_free);
+
+  g_print ("Generating %d images in %s\n", count, image_dir);
+
+  gboolean is_valid = (g_strv_length (sizes) > 0
+                       && g_strv_length (formats) > 0
+                       && jws_bench_generate_images (image_dir, count, sizes,
+                                                     formats, paths));
+
+  if (is_valid)
+    {
+      jws_preview_stats_set_enabled (print_stats);
+
+      jws_bench_run_pipeline (paths, n_threads, "Cold");
+
+      if (warm)
+        jws_bench_run_pipeline (paths, n_threads, "Warm");
+
+      if (print_stats)
+        {
+          gchar *stats = jws_preview_stats_to_string ();
+          g_print ("%s", stats);
+          g_free (stats);
+        }
+    }
+
+  if (!keep && !directory)
+    {
+      jws_bench_remove_recursive (root);
+    }
+  else if (!keep)
+    {
+      if (!has_config_dir)
+        jws_bench_remove_recursive (config_dir);
+      if (!has_cache_dir)
+        jws_bench_remove_recursive (cache_dir);
+      if (!has_image_dir)
+        {
+          jws_bench_remove_recursive (image_dir);
+        }
+      else
+        {
+          for (guint i = 0; i < paths->len; i++)
+            g_unlink (g_ptr_array_index (paths, i));
+        }
+    }
+
+  g_ptr_array_unref (paths);
+  g_strfreev (sizes);
+  g_strfreev (formats);
+  g_free (config_dir);
+  g_free (cache_dir);
+  g_free (image_dir);
+  g_free (root);
+  g_free (sizes_string);
+  g_free (formats_string);
+  g_free (directory);
+
+  return is_valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -20,6 +20,8 @@ along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
 #include <gtk/gtk.h>
 #include <glib/gi18n.h>
 
+#include "jwspreviewstats.h"
+
 struct _JwsConfigApplication
 {
   GtkApplication parent;
@@ -35,6 +37,9 @@ typedef struct _JwsConfigApplicationPrivate JwsConfigApplicationPrivate;
 struct _JwsConfigApplicationPrivate
 {
   JwsConfigWindow *win;
+
+  /* Set by --stats.  */
+  gboolean print_stats;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (JwsConfigApplication, jws_config_application,
@@ -86,6 +91,42 @@ jws_config_application_open (GApplication *app,
   g_free (config_path);
 }
 
+static gint
+jws_config_application_handle_local_options (GApplication *app,
+                                             GVariantDict *options)
+{
+  JwsConfigApplicationPrivate *priv;
+  priv = jws_config_application_get_instance_private
+    (JWS_CONFIG_APPLICATION (app));
+
+  if (g_variant_dict_contains (options, "stats"))
+    {
+      priv->print_stats = TRUE;
+      jws_preview_stats_set_enabled (TRUE);
+    }
+
+  /* Keep going as usual.  */
+  return -1;
+}
+
+static void
+jws_config_application_shutdown (GApplication *app)
+{
+  JwsConfigApplicationPrivate *priv;
+  priv = jws_config_application_get_instance_private
+    (JWS_CONFIG_APPLICATION (app));
+
+  if (priv->print_stats)
+    {
+      gchar *stats;
+      stats = jws_preview_stats_to_string ();
+      g_print ("%s", stats);
+      g_free (stats);
+    }
+
+  G_APPLICATION_CLASS (jws_config_application_parent_class)->shutdown (app);
+}
+
 static void
 jws_config_application_init (JwsConfigApplication *app)
 {
@@ -93,6 +134,15 @@ jws_config_application_init (JwsConfigApplication *app)
   priv = jws_config_application_get_instance_private (app);
   
   priv->win = NULL;
+  priv->print_stats = FALSE;
+
+  g_application_add_main_option (G_APPLICATION (app),
+                                 "stats",
+                                 0,
+                                 G_OPTION_FLAG_NONE,
+                                 G_OPTION_ARG_NONE,
+                                 _("Print preview loading statistics on exit"),
+                                 NULL);
 }
 
 static void
@@ -100,6 +150,9 @@ jws_config_application_class_init (JwsConfigApplicationClass *kclass)
 {
   G_APPLICATION_CLASS (kclass)->activate = jws_config_application_activate;
   G_APPLICATION_CLASS (kclass)->open = jws_config_application_open;
+  G_APPLICATION_CLASS (kclass)->handle_local_options
+    = jws_config_application_handle_local_options;
+  G_APPLICATION_CLASS (kclass)->shutdown = jws_config_application_shutdown;
 }
 
 JwsConfigApplication *
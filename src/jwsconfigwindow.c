@@ -20,9 +20,17 @@ along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
 #include "jwsconfigwindow.h"
 
 #include <glib/gi18n.h>
+#include <string.h>
 
+#include "jwsatlas.h"
 #include "jwsconfigimageviewer.h"
+#include "jwsindex.h"
 #include "jwsinfo.h"
+#include "jwspreferences.h"
+#include "jwspreviewcache.h"
+#include "jwspreviewpool.h"
+#include "jwsscan.h"
+#include "jwsscanrules.h"
 #include "jwssetter.h"
 
 struct _JwsConfigWindow
@@ -56,15 +64,52 @@ struct _JwsConfigWindowPrivate
 
   GtkWidget *rotate_items_box;
 
+  GtkWidget *scan_box;
+  GtkWidget *scan_progress_bar;
+  GtkWidget *scan_cancel_button;
+
   GtkTreeStore *tree_store;
   GtkTreeSelection *tree_selection;
 
-  /* Always use and accessors for this which use the mutex.  */
-  gboolean should_exit_thread;
-  GMutex should_exit_thread_mutex;
-
-  GThread *preview_thread;
-  GAsyncQueue *preview_queue;
+  JwsPreviewPool *preview_pool;
+  JwsPreviewCache *preview_cache;
+
+  /* Jobs for the rows around the visible range, which have been moved ahead
+   * of the others.  Updated in an idle callback whenever the view scrolls or
+   * changes.  */
+  GPtrArray *visible_preview_jobs;
+  guint preview_priority_source;
+
+  /* How many bytes of previews the tree holds, kept up to date whenever a
+   * preview is set, cleared or removed along with its row.  */
+  gsize preview_bytes;
+  gsize preview_budget;
+  guint preview_evict_source;
+
+  /* The previews saved for the config in the tree, and where they go when
+   * it's replaced.  Dirty once a new final preview has come in.  */
+  JwsAtlas *atlas;
+  gchar *atlas_file;
+  gboolean atlas_dirty;
+
+  /* While above 0 the tree view has no model.  */
+  gint bulk_load_depth;
+
+  /* Whether directories are only listed when they're expanded.  */
+  gboolean lazy_expansion;
+  /* Whether listed directories are watched for changes.  */
+  gboolean watch_directories;
+  /* How many levels of directories are listed under a top level row, or 0
+   * or less for all of them.  */
+  gint max_depth;
+
+  /* The listings of directories from earlier runs, or NULL if they aren't
+   * kept.  Scans hold their own references.  */
+  JwsIndex *index;
+
+  /* The DirectoryScans still running, including cancelled ones that haven't
+   * finished yet.  */
+  GList *directory_scans;
 
   JwsInfo *current_info;
   gchar *current_file;
@@ -93,16 +138,357 @@ type_column_data_func (GtkTreeViewColumn *tree_column,
                        GtkTreeIter *iter,
                        gpointer data);
 
+/* Shows the row's preview, and asks for it if the row doesn't have one.  */
+static void
+preview_column_data_func (GtkTreeViewColumn *tree_column,
+                          GtkCellRenderer *cell,
+                          GtkTreeModel *tree_model,
+                          GtkTreeIter *iter,
+                          gpointer win);
+
+/* Adds a row for the file at path under parent_iter.  The contents of a
+ * directory are filled in later by a DirectoryScan.  */
+static void
+jws_config_window_add_file_for_iter (JwsConfigWindow *win,
+                                     const char *path,
+                                     GtkTreeIter *parent_iter,
+                                     GCancellable *cancellable);
+
+typedef struct _DirectoryScan DirectoryScan;
+
+/* A directory whose contents are being scanned in the background.  */
+struct _DirectoryScan
+{
+  /* Holds a reference, because the scan only ends once its thread notices
+   * it was cancelled.  */
+  JwsConfigWindow *win;
+  /* The directory's row, then the row made for each entry so far, by the
+   * entry's number.  */
+  GtkTreeIter root;
+  GArray *iters;
+  /* The numbers of the entries that are directories the scan went into.  */
+  GArray *directories;
+  /* Stops the scan but not the previews of the rows already found, which
+   * use the cancellable of the top level row.  */
+  GCancellable *cancellable;
+  GCancellable *preview_cancellable;
+  guint n_files;
+  /* For a directory that was expanded, the placeholder under it.  It's
+   * removed once the listing is done.  The scan only lists the directory
+   * itself, and every directory it finds gets a placeholder of its own.  */
+  GtkTreeRowReference *placeholder;
+};
+
+/* Starts scanning the directory at iter.  If placeholder is given the scan
+ * only lists the directory itself, see DirectoryScan.  */
+static void
+jws_config_window_start_scan (JwsConfigWindow *win,
+                              GtkTreeIter *iter,
+                              const gchar *path,
+                              GCancellable *preview_cancellable,
+                              GtkTreeIter *placeholder);
+
+/* Adds a row for entry under parent_iter at position, or at the end if
+ * position is -1, and sets iter to it.  A directory gets a placeholder if
+ * with_placeholder is TRUE.  */
+static void
+jws_config_window_insert_entry (JwsConfigWindow *win,
+                                GtkTreeIter *parent_iter,
+                                gint position,
+                                JwsScanEntry *entry,
+                                GCancellable *preview_cancellable,
+                                gboolean with_placeholder,
+                                GtkTreeIter *iter);
+
+static void
+jws_config_window_add_placeholder (JwsConfigWindow *win,
+                                   GtkTreeIter *parent_iter);
+
+/* Whether the directory at iter is the same as one of the rows above it,
+ * through a symbolic link, so listing it would go on forever.  */
+static gboolean
+jws_config_window_is_inside_itself (JwsConfigWindow *win, GtkTreeIter *iter);
+
+/* Whether the directory at iter is shallow enough to be listed, see
+ * JWS_PREFERENCES_KEY_MAX_DEPTH.  */
+static gboolean
+jws_config_window_can_list (JwsConfigWindow *win, GtkTreeIter *iter);
+
+static gboolean
+jws_config_window_is_placeholder (JwsConfigWindow *win, GtkTreeIter *iter);
+
+/* Whether the directory at iter still has its placeholder.  Sets placeholder
+ * to it if it does.  */
+static gboolean
+jws_config_window_get_placeholder (JwsConfigWindow *win,
+                                   GtkTreeIter *iter,
+                                   GtkTreeIter *placeholder);
+
+/* Lists the directory at iter right away if it hasn't been listed yet.  This
+ * blocks, so it's only for when the rows are needed immediately.  */
+static void
+jws_config_window_list_directory_now (JwsConfigWindow *win,
+                                      GtkTreeIter *iter);
+
+/* Removes every row under iter except its placeholder, stopping their scans
+ * and previews first.  */
+static void
+jws_config_window_clear_directory (JwsConfigWindow *win, GtkTreeIter *iter);
+
+static gboolean
+on_test_expand_row (GtkTreeView *view,
+                    GtkTreeIter *iter,
+                    GtkTreePath *path,
+                    gpointer win);
+
+static gboolean
+select_row_func (GtkTreeSelection *selection,
+                 GtkTreeModel *model,
+                 GtkTreePath *path,
+                 gboolean path_currently_selected,
+                 gpointer data);
+
+static void
+directory_scan_free (DirectoryScan *scan);
+
+typedef struct _DirectoryWatch DirectoryWatch;
+
+/* What a directory's GFileMonitor needs to find its row.  Freed when the
+ * monitor goes away with the row.  */
+struct _DirectoryWatch
+{
+  JwsConfigWindow *win;
+  GtkTreeRowReference *row;
+};
+
+/* Starts following changes to the contents of the directory at iter, once
+ * they're all in the tree.  Does nothing if it's already watched or watching
+ * is turned off.  */
+static void
+jws_config_window_watch_directory (JwsConfigWindow *win, GtkTreeIter *iter);
+
+static void
+directory_watch_free (DirectoryWatch *watch, GClosure *closure);
+
+static void
+on_directory_changed (GFileMonitor *monitor,
+                      GFile *file,
+                      GFile *other_file,
+                      GFileMonitorEvent event_type,
+                      gpointer watch);
+
+/* Finds the row for path among the children of parent_iter.  */
+static gboolean
+jws_config_window_find_child (JwsConfigWindow *win,
+                              GtkTreeIter *parent_iter,
+                              const gchar *path,
+                              GtkTreeIter *child);
+
+/* Finds where a row named name goes among the children of parent_iter,
+ * leaving out skip if it's given.  Sets sibling to the row it goes before and
+ * position to its index, or returns FALSE if it goes at the end.  */
+static gboolean
+jws_config_window_find_sorted_position (JwsConfigWindow *win,
+                                        GtkTreeIter *parent_iter,
+                                        const gchar *name,
+                                        GtkTreeIter *skip,
+                                        GtkTreeIter *sibling,
+                                        gint *position);
+
+/* Adds a row for a file that showed up in the watched directory at
+ * parent_iter.  */
+static void
+jws_config_window_add_watched_file (JwsConfigWindow *win,
+                                    GtkTreeIter *parent_iter,
+                                    GFile *file);
+
+static void
+jws_config_window_remove_watched_file (JwsConfigWindow *win,
+                                       GtkTreeIter *parent_iter,
+                                       GFile *file);
+
+static void
+jws_config_window_rename_watched_file (JwsConfigWindow *win,
+                                       GtkTreeIter *parent_iter,
+                                       GFile *file,
+                                       GFile *new_file);
+
+/* Loads the preview again for a file that was written to.  */
+static void
+jws_config_window_update_watched_file (JwsConfigWindow *win,
+                                       GtkTreeIter *parent_iter,
+                                       GFile *file);
+
+static void
+on_scan_batch (GPtrArray *entries, gpointer scan);
+
+static void
+on_scan_done (gboolean completed, gpointer scan);
+
+/* Shows how many files the running scans found, or hides the progress bar if
+ * there aren't any.  */
+static void
+jws_config_window_update_scan_progress (JwsConfigWindow *win);
+
+/* Stops the scans that iter is above or is the root of, and those adding
+ * rows under iter if it's a directory.  Call before removing the row.  */
+static void
+jws_config_window_cancel_scans_for_iter (JwsConfigWindow *win,
+                                         GtkTreeIter *iter);
+
+static void
+jws_config_window_cancel_all_scans (JwsConfigWindow *win);
+
+/* Takes the model away from the tree view until the matching call to
+ * jws_config_window_end_bulk_load (), so the view doesn't follow every row
+ * that is added or removed in between.  The view forgets which rows were
+ * expanded and selected, so this is only for replacing the whole tree.  Calls
+ * can be nested.  */
 static void
-jws_config_window_add_file_for_iter_recurse (JwsConfigWindow *win,
-                                             const char *path,
-                                             GtkTreeIter *parent_iter);
+jws_config_window_begin_bulk_load (JwsConfigWindow *win);
 
 static void
-destroy_row_reference (gpointer row_ref);
+jws_config_window_end_bulk_load (JwsConfigWindow *win);
 
-static void *
-preview_thread_run (gpointer win);
+/* Stops loading previews for the row at iter and everything below it.  Call
+ * before removing the row.  */
+static void
+jws_config_window_cancel_previews_for_iter (JwsConfigWindow *win,
+                                            GtkTreeIter *iter);
+
+/* Takes the previews of the row at iter and everything below it out of the
+ * count of preview bytes.  Call before removing the row.  */
+static void
+jws_config_window_release_previews_for_iter (JwsConfigWindow *win,
+                                             GtkTreeIter *iter);
+
+/* Clears the preview of the row at iter, keeping count of the memory.  */
+static void
+jws_config_window_clear_row_preview (JwsConfigWindow *win,
+                                     GtkTreeIter *iter);
+
+/* Stops loading every preview in the tree.  Call before clearing it.  */
+static void
+jws_config_window_cancel_all_previews (JwsConfigWindow *win);
+
+typedef struct _PreviewRequest PreviewRequest;
+
+/* The data for each job in the preview pool.  A GtkTreeStore iter stays valid
+ * until its row is removed and rows are only removed after their jobs are
+ * cancelled, so the iter can be used directly when the preview is ready.  */
+struct _PreviewRequest
+{
+  GtkTreeIter iter;
+};
+
+static void
+preview_request_free (PreviewRequest *request);
+
+static void
+on_preview_ready (const gchar *path,
+                  GdkPixbuf *preview,
+                  gint64 mtime,
+                  gboolean is_final,
+                  gpointer request,
+                  gpointer win);
+
+static void
+jws_config_window_queue_preview_priority_update (JwsConfigWindow *win);
+
+static gboolean
+update_preview_priorities (gpointer win);
+
+static gboolean
+get_next_visible_iter (GtkTreeView *view,
+                       GtkTreeModel *model,
+                       GtkTreeIter *iter);
+
+static gboolean
+get_previous_visible_iter (GtkTreeView *view,
+                           GtkTreeModel *model,
+                           GtkTreeIter *iter);
+
+static void
+promote_preview_for_iter (JwsConfigWindow *win, GtkTreeIter *iter);
+
+/* Sets the preview for the row at iter and keeps track of the memory it
+ * uses.  Doesn't touch the row's job.  */
+static void
+jws_config_window_set_row_preview (JwsConfigWindow *win,
+                                   GtkTreeIter *iter,
+                                   GdkPixbuf *preview);
+
+/* Gets the preview for the file row at iter from the memory cache or the
+ * atlas and has the file checked, or starts loading it.  Returns the new job
+ * with a reference.  */
+static JwsPreviewJob *
+jws_config_window_request_preview (JwsConfigWindow *win, GtkTreeIter *iter);
+
+static gboolean
+evict_offscreen_previews (gpointer win);
+
+/* GtkTreeStore iters point at the row itself, so two iters for the same row
+ * always hold the same node.  */
+static gboolean
+is_same_row (GtkTreeIter *a, GtkTreeIter *b);
+
+/* Replaces the atlas for the config in the tree with its current previews, if
+ * any new ones came in.  */
+static void
+jws_config_window_save_atlas (JwsConfigWindow *win);
+
+static void
+add_previews_to_atlas (JwsConfigWindow *win,
+                       JwsAtlasWriter *writer,
+                       GtkTreeIter *parent);
+
+/* Closes the current atlas and maps the one for config_path, which may be
+ * NULL.  */
+static void
+jws_config_window_open_atlas (JwsConfigWindow *win,
+                              const gchar *config_path);
+
+/* Writes out the listings of the directories scanned so far, if any new ones
+ * were made.  */
+static void
+jws_config_window_save_index (JwsConfigWindow *win);
+
+typedef struct _EvictCandidate EvictCandidate;
+
+/* A row holding a preview, found while looking for ones to evict.  */
+struct _EvictCandidate
+{
+  GtkTreeIter iter;
+  gsize bytes;
+  /* First the row's position among the visible rows or -1 if it's inside a
+   * collapsed directory, then how far it is from the screen.  */
+  gint distance;
+};
+
+typedef struct _EvictScan EvictScan;
+
+struct _EvictScan
+{
+  GtkTreeView *view;
+  GtkTreeModel *model;
+  GArray *candidates;
+  gsize total_bytes;
+  gint n_visible;
+
+  /* The first and last rows on screen and their positions once found.  */
+  GtkTreeIter start_iter;
+  GtkTreeIter end_iter;
+  gint start_index;
+  gint end_index;
+};
+
+static void
+collect_preview_rows (EvictScan *scan,
+                      GtkTreeIter *parent,
+                      gboolean parent_expanded);
+
+static gint
+compare_evict_candidates (gconstpointer a, gconstpointer b);
 
 /* Free with g_free when done.  */
 static gchar *
@@ -204,6 +590,28 @@ enum tree_store_columns
   NAME_COLUMN,
   IS_DIRECTORY_COLUMN,
   PREVIEW_COLUMN,
+  /* The pending JwsPreviewJob for the row, if any.  It stays set for files
+   * that couldn't be loaded.  */
+  PREVIEW_JOB_COLUMN,
+  /* The GCancellable shared by every row added with the same top level row.
+   * Cancelling it drops all of their previews at once.  */
+  CANCELLABLE_COLUMN,
+  /* The modification time of files, to load their preview again after it was
+   * evicted.  */
+  MTIME_COLUMN,
+  /* Set for the row that stands in for the contents of a directory that
+   * hasn't been listed yet, so the directory can be expanded.  */
+  IS_PLACEHOLDER_COLUMN,
+  /* The GFileMonitor of a directory whose contents are all in the tree, so
+   * they're kept in step with the disk.  Dropped along with the row.  */
+  MONITOR_COLUMN,
+  /* The device and inode of directories, to tell whether one is inside
+   * itself.  Both are 0 if they aren't known.  */
+  DEVICE_COLUMN,
+  INODE_COLUMN,
+  /* The key from jws_scan_get_sort_key () for the row's name, worked out
+   * the first time it's needed if the scan didn't give one.  */
+  SORT_KEY_COLUMN,
   N_COLUMNS
 };
 
@@ -223,18 +631,90 @@ jws_config_window_init (JwsConfigWindow *self)
                                          G_TYPE_STRING, /* 0, path */
                                          G_TYPE_STRING, /* 1, name */
                                          G_TYPE_BOOLEAN,/* 2, is directory */
-                                         GDK_TYPE_PIXBUF);/* 3, preview */
+                                         GDK_TYPE_PIXBUF,/* 3, preview */
+                                         JWS_TYPE_PREVIEW_JOB,/* 4, job */
+                                         G_TYPE_CANCELLABLE,/* 5, cancel */
+                                         G_TYPE_INT64,/* 6, mtime */
+                                         G_TYPE_BOOLEAN,/* 7, placeholder */
+                                         G_TYPE_FILE_MONITOR,/* 8, monitor */
+                                         G_TYPE_UINT64,/* 9, device */
+                                         G_TYPE_UINT64,/* 10, inode */
+                                         G_TYPE_STRING);/* 11, sort key */
 
   jws_config_window_set_up_tree_view (self);
 
-  priv->preview_queue = g_async_queue_new_full (destroy_row_reference);
+  int preview_threads;
+  preview_threads = jws_preferences_get_integer
+    (JWS_PREFERENCES_GROUP_PREVIEWS,
+     JWS_PREFERENCES_KEY_PREVIEW_THREADS,
+     0);
+  priv->preview_pool = jws_preview_pool_new (preview_threads,
+                                             JWS_CONFIG_WINDOW_PREVIEW_HEIGHT,
+                                             on_preview_ready,
+                                             self);
+
+  int cache_size;
+  cache_size = jws_preferences_get_integer
+    (JWS_PREFERENCES_GROUP_PREVIEWS,
+     JWS_PREFERENCES_KEY_MEMORY_CACHE_SIZE,
+     JWS_CONFIG_WINDOW_DEFAULT_MEMORY_CACHE_SIZE);
+  priv->preview_cache = jws_preview_cache_new ((gsize) MAX (cache_size, 0)
+                                              * 1024 * 1024);
+
+  priv->visible_preview_jobs = g_ptr_array_new_with_free_func
+    ((GDestroyNotify) jws_preview_job_unref);
+  priv->preview_priority_source = 0;
+
+  int tree_memory;
+  tree_memory = jws_preferences_get_integer
+    (JWS_PREFERENCES_GROUP_PREVIEWS,
+     JWS_PREFERENCES_KEY_TREE_MEMORY,
+     JWS_CONFIG_WINDOW_DEFAULT_TREE_MEMORY);
+  priv->preview_bytes = 0;
+  priv->preview_budget = (gsize) MAX (tree_memory, 0) * 1024 * 1024;
+  priv->preview_evict_source = 0;
+
+  priv->atlas = NULL;
+  priv->atlas_file = NULL;
+  priv->atlas_dirty = FALSE;
+
+  priv->bulk_load_depth = 0;
+  priv->lazy_expansion = jws_preferences_get_boolean
+    (JWS_PREFERENCES_GROUP_SCANNING,
+     JWS_PREFERENCES_KEY_LAZY_EXPANSION,
+     TRUE);
+  priv->watch_directories = jws_preferences_get_boolean
+    (JWS_PREFERENCES_GROUP_SCANNING,
+     JWS_PREFERENCES_KEY_WATCH_DIRECTORIES,
+     TRUE);
+  priv->max_depth = jws_preferences_get_integer
+    (JWS_PREFERENCES_GROUP_SCANNING,
+     JWS_PREFERENCES_KEY_MAX_DEPTH,
+     0);
+
+  priv->index = NULL;
+  if (jws_preferences_get_boolean (JWS_PREFERENCES_GROUP_SCANNING,
+                                   JWS_PREFERENCES_KEY_DIRECTORY_INDEX,
+                                   TRUE))
+    {
+      gchar *index_file;
+      index_file = jws_index_get_default_file ();
+
+      /* Not having one yet is normal, the first scan makes it.  */
+      GError *err = NULL;
+      priv->index = jws_index_load (index_file, &err);
+      if (!priv->index)
+        {
+          if (!g_error_matches (err, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_warning ("%s", err->message);
+          g_error_free (err);
+          priv->index = jws_index_new ();
+        }
 
-  g_mutex_init (&priv->should_exit_thread_mutex);
-  jws_config_window_set_should_exit_thread (self, FALSE);
+      g_free (index_file);
+    }
 
-  priv->preview_thread = g_thread_new ("Preview Thread",
-                                       preview_thread_run,
-                                       self);
+  priv->directory_scans = NULL;
 
   priv->current_info = jws_info_new ();
   priv->current_file = NULL;
@@ -261,6 +741,9 @@ jws_config_window_init (JwsConfigWindow *self)
   g_signal_connect_swapped (priv->cancel_button, "clicked",
                             G_CALLBACK (gtk_tree_selection_unselect_all),
                             priv->tree_selection);
+  g_signal_connect_swapped (priv->scan_cancel_button, "clicked",
+                            G_CALLBACK (jws_config_window_cancel_all_scans),
+                            self);
   g_signal_connect_swapped
     (priv->apply_button, "clicked",
      G_CALLBACK (jws_config_window_write_to_default_config_file), self);
@@ -319,6 +802,15 @@ jws_config_window_class_init (JwsConfigWindowClass *kclass)
   gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (kclass),
                                                 JwsConfigWindow,
                                                 rotate_items_box);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (kclass),
+                                                JwsConfigWindow,
+                                                scan_box);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (kclass),
+                                                JwsConfigWindow,
+                                                scan_progress_bar);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (kclass),
+                                                JwsConfigWindow,
+                                                scan_cancel_button);
   gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (kclass),
                                                 JwsConfigWindow,
                                                 tree_view);
@@ -339,16 +831,40 @@ jws_config_window_dispose (GObject *obj)
   JwsConfigWindowPrivate *priv;
   priv = jws_config_window_get_instance_private (JWS_CONFIG_WINDOW (obj));
 
-  /* Stopping the thread should happen first because operations inside inside
-   * it might cause errors if objects don't exist.  */
-  jws_config_window_set_should_exit_thread (JWS_CONFIG_WINDOW (obj), TRUE);
-  g_thread_join (priv->preview_thread);
+  if (priv->preview_priority_source)
+    g_source_remove (priv->preview_priority_source);
+  priv->preview_priority_source = 0;
+
+  if (priv->preview_evict_source)
+    g_source_remove (priv->preview_evict_source);
+  priv->preview_evict_source = 0;
+
+  g_clear_pointer (&priv->visible_preview_jobs, g_ptr_array_unref);
+
+  /* The scans hold references to the window, so they're already over by
+   * the time it's finalized.  */
+  jws_config_window_cancel_all_scans (JWS_CONFIG_WINDOW (obj));
+
+  /* The tree is still intact here.  */
+  if (priv->tree_store)
+    jws_config_window_save_atlas (JWS_CONFIG_WINDOW (obj));
+  g_clear_pointer (&priv->atlas, jws_atlas_free);
 
-  g_mutex_clear (&priv->should_exit_thread_mutex);
+  /* Scans that were cancelled don't add anything to it, and the last
+   * reference goes in finalize ().  */
+  if (priv->tree_store)
+    jws_config_window_save_index (JWS_CONFIG_WINDOW (obj));
 
-  if (priv->preview_queue)
-    g_async_queue_unref (priv->preview_queue);
-  priv->preview_queue = NULL;
+  /* Stopping the preview threads should happen first because their results
+   * are delivered to the tree store.  Cancelling first means they don't have
+   * to finish the loads they're in the middle of.  */
+  if (priv->preview_pool)
+    jws_config_window_cancel_all_previews (JWS_CONFIG_WINDOW (obj));
+  jws_preview_pool_free (priv->preview_pool);
+  priv->preview_pool = NULL;
+
+  jws_preview_cache_free (priv->preview_cache);
+  priv->preview_cache = NULL;
 
   g_clear_object (&priv->tree_store);
 
@@ -362,6 +878,8 @@ jws_config_window_finalize (GObject *obj)
   priv = jws_config_window_get_instance_private (JWS_CONFIG_WINDOW (obj));
 
   g_free (priv->current_file);
+  g_free (priv->atlas_file);
+  jws_index_unref (priv->index);
   
   G_OBJECT_CLASS (jws_config_window_parent_class)->finalize (obj);
 }
@@ -426,15 +944,56 @@ type_column_data_func (GtkTreeViewColumn *tree_column,
                        gpointer data)
 {
   gboolean is_directory;
-  gtk_tree_model_get (tree_model, iter, IS_DIRECTORY_COLUMN, &is_directory,
+  gboolean is_placeholder;
+  gtk_tree_model_get (tree_model, iter,
+                      IS_DIRECTORY_COLUMN, &is_directory,
+                      IS_PLACEHOLDER_COLUMN, &is_placeholder,
                       -1);
 
+  if (is_placeholder)
+    {
+      g_object_set (cell, "text", NULL, NULL);
+      return;
+    }
+
   gchar *type_string;
   type_string = jws_get_type_string (is_directory);
   g_object_set (cell, "text", type_string, NULL);
   g_free (type_string);
 }
 
+static void
+preview_column_data_func (GtkTreeViewColumn *tree_column,
+                          GtkCellRenderer *cell,
+                          GtkTreeModel *tree_model,
+                          GtkTreeIter *iter,
+                          gpointer win)
+{
+  GdkPixbuf *preview = NULL;
+  JwsPreviewJob *job = NULL;
+  gboolean is_directory = FALSE;
+  gboolean is_placeholder = FALSE;
+  gtk_tree_model_get (tree_model, iter,
+                      PREVIEW_COLUMN, &preview,
+                      PREVIEW_JOB_COLUMN, &job,
+                      IS_DIRECTORY_COLUMN, &is_directory,
+                      IS_PLACEHOLDER_COLUMN, &is_placeholder,
+                      -1);
+
+  g_object_set (cell, "pixbuf", preview, NULL);
+
+  /* Changing the model while it's being drawn isn't safe, so leave the
+   * request to the idle callback.  It loads every row on screen that's
+   * missing a preview, along with the ones around them.  This is also called
+   * to measure rows that are off screen, which the callback leaves alone.  */
+  if (!preview && !job && !is_directory && !is_placeholder)
+    jws_config_window_queue_preview_priority_update (JWS_CONFIG_WINDOW (win));
+
+  g_clear_object (&preview);
+  if (job)
+    jws_preview_job_unref (job);
+}
+
 static void
 jws_config_window_set_up_tree_view (JwsConfigWindow *win)
 {
@@ -460,392 +1019,2093 @@ jws_config_window_set_up_tree_view (JwsConfigWindow *win)
                                                           NULL);
   gtk_tree_view_insert_column (as_view, name_column, NAME_COLUMN);
 
-  type_column = gtk_tree_view_column_new ();
-  gtk_tree_view_column_set_title (type_column, _("Type"));
-  gtk_tree_view_column_pack_start (type_column, text_renderer, TRUE);
-  gtk_tree_view_column_set_cell_data_func (type_column, text_renderer,
-                                           type_column_data_func, NULL, NULL);
-  gtk_tree_view_append_column (as_view, type_column);
+  type_column = gtk_tree_view_column_new ();
+  gtk_tree_view_column_set_title (type_column, _("Type"));
+  gtk_tree_view_column_pack_start (type_column, text_renderer, TRUE);
+  gtk_tree_view_column_set_cell_data_func (type_column, text_renderer,
+                                           type_column_data_func, NULL, NULL);
+  gtk_tree_view_append_column (as_view, type_column);
+
+  /* Previews are only loaded for rows that get drawn, so nothing is loaded
+   * for files inside collapsed directories.  */
+  preview_column = gtk_tree_view_column_new ();
+  gtk_tree_view_column_set_title (preview_column, _("Preview"));
+  gtk_tree_view_column_pack_start (preview_column, pixbuf_renderer, TRUE);
+  gtk_tree_view_column_set_cell_data_func (preview_column, pixbuf_renderer,
+                                           preview_column_data_func, win,
+                                           NULL);
+  gtk_tree_view_insert_column (as_view, preview_column, PREVIEW_COLUMN);
+
+  priv->tree_selection = gtk_tree_view_get_selection
+    (GTK_TREE_VIEW (priv->tree_view));
+  gtk_tree_selection_set_mode (priv->tree_selection, GTK_SELECTION_MULTIPLE);
+  gtk_tree_selection_set_select_function (priv->tree_selection,
+                                          select_row_func, win, NULL);
+
+  g_signal_connect (as_view, "test-expand-row",
+                    G_CALLBACK (on_test_expand_row), win);
+
+  /* Anything that changes which rows are on screen changes which previews
+   * should be loaded first.  */
+  GtkAdjustment *vadjustment;
+  vadjustment = gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (as_view));
+  g_signal_connect_swapped (vadjustment, "value-changed",
+                            G_CALLBACK
+                            (jws_config_window_queue_preview_priority_update),
+                            win);
+  g_signal_connect_swapped (as_view, "size-allocate",
+                            G_CALLBACK
+                            (jws_config_window_queue_preview_priority_update),
+                            win);
+  g_signal_connect_swapped (as_view, "row-expanded",
+                            G_CALLBACK
+                            (jws_config_window_queue_preview_priority_update),
+                            win);
+  g_signal_connect_swapped (as_view, "row-collapsed",
+                            G_CALLBACK
+                            (jws_config_window_queue_preview_priority_update),
+                            win);
+}
+
+static gchar *
+get_home_directory ()
+{
+  return g_strdup (g_get_home_dir ());
+}
+
+void
+jws_config_window_add_file_selection (JwsConfigWindow *win)
+{
+  GtkWidget *dialog;
+  dialog = gtk_file_chooser_dialog_new (_("Choose File"),
+                                        GTK_WINDOW (win),
+                                        GTK_FILE_CHOOSER_ACTION_OPEN,
+                                        _("Add"), GTK_RESPONSE_ACCEPT,
+                                        _("Cancel"), GTK_RESPONSE_CANCEL,
+                                        NULL);
+  gchar *home_dir;
+  home_dir = get_home_directory ();
+  gtk_file_chooser_set_current_folder (GTK_FILE_CHOOSER (dialog), home_dir);
+  g_free (home_dir);
+
+  gtk_file_chooser_set_select_multiple (GTK_FILE_CHOOSER (dialog), TRUE);
+
+  GtkFileFilter *filter;
+  filter = gtk_file_filter_new ();
+
+  gtk_file_filter_add_pixbuf_formats (filter);
+
+  /* I don't think I have to free this because it's a floating reference.  */
+  gtk_file_chooser_set_filter (GTK_FILE_CHOOSER (dialog), filter);
+
+  int response;
+  response = gtk_dialog_run (GTK_DIALOG (dialog));
+
+  GSList *file_list = NULL;
+
+  if (response == GTK_RESPONSE_ACCEPT)
+    {
+      file_list = gtk_file_chooser_get_filenames (GTK_FILE_CHOOSER (dialog));
+    }
+
+  gtk_widget_destroy (dialog);
+
+  GSList *iter;
+  for (iter = file_list; iter != NULL; iter = g_slist_next (iter))
+    {
+      jws_config_window_add_file (win, iter->data);
+      g_free (iter->data);
+    }
+  g_slist_free (file_list);
+}
+
+void
+jws_config_window_add_directory_selection (JwsConfigWindow *win)
+{
+  GtkWidget *dialog;
+  dialog = gtk_file_chooser_dialog_new (_("Choose Directory"),
+                                        GTK_WINDOW (win),
+                                        GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
+                                        _("Add"), GTK_RESPONSE_ACCEPT,
+                                        _("Cancel"), GTK_RESPONSE_CANCEL,
+                                        NULL);
+  gchar *home_dir;
+  home_dir = get_home_directory ();
+  gtk_file_chooser_set_current_folder (GTK_FILE_CHOOSER (dialog), home_dir);
+  g_free (home_dir);
+
+  gtk_file_chooser_set_select_multiple (GTK_FILE_CHOOSER (dialog), TRUE);
+
+  int response;
+  response = gtk_dialog_run (GTK_DIALOG (dialog));
+
+  GSList *file_list = NULL;
+
+  if (response == GTK_RESPONSE_ACCEPT)
+    {
+      file_list = gtk_file_chooser_get_filenames (GTK_FILE_CHOOSER (dialog));
+    }
+
+  gtk_widget_destroy (dialog);
+
+  GSList *iter;
+  for (iter = file_list; iter != NULL; iter = g_slist_next (iter))
+    {
+      jws_config_window_add_file (win, iter->data);
+      g_free (iter->data);
+    }
+  g_slist_free (file_list);
+}
+
+static void
+jws_config_window_add_file_for_iter (JwsConfigWindow *win,
+                                     const char *path,
+                                     GtkTreeIter *parent_iter,
+                                     GCancellable *cancellable)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  GFile *file;
+  file = g_file_new_for_path (path);
+
+  GFileInfo *file_info;
+  file_info = g_file_query_info (file,
+                                 G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                                 G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                                 G_FILE_ATTRIBUTE_UNIX_DEVICE ","
+                                 G_FILE_ATTRIBUTE_UNIX_INODE,
+                                 G_FILE_QUERY_INFO_NONE,
+                                 NULL,
+                                 NULL);
+
+  GFileType file_type = G_FILE_TYPE_UNKNOWN;
+  gint64 mtime = 0;
+  guint64 device = 0;
+  guint64 inode = 0;
+
+  if (file_info)
+    {
+      file_type = g_file_info_get_file_type (file_info);
+      mtime = g_file_info_get_attribute_uint64
+        (file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+      device = g_file_info_get_attribute_uint32
+        (file_info, G_FILE_ATTRIBUTE_UNIX_DEVICE);
+      inode = g_file_info_get_attribute_uint64
+        (file_info, G_FILE_ATTRIBUTE_UNIX_INODE);
+      g_object_unref (file_info);
+    }
+
+  gchar *basename;
+  basename = g_file_get_basename (file);
+
+  /* This variable is redundant becuase I could just use path from the
+   * arguments list but I felt like doing it this way just in case path is
+   * formatted weirdly or something.  */
+  gchar *file_path;
+  file_path = g_file_get_path (file);
+
+  GtkTreeIter iter;
+
+  if (file_type == G_FILE_TYPE_REGULAR)
+    {
+      /* The preview is requested when the row is first drawn.  */
+      gtk_tree_store_insert_with_values (priv->tree_store, &iter,
+                                         parent_iter, -1,
+                                         PATH_COLUMN, file_path,
+                                         NAME_COLUMN, basename,
+                                         IS_DIRECTORY_COLUMN, FALSE,
+                                         PREVIEW_COLUMN, NULL,
+                                         CANCELLABLE_COLUMN, cancellable,
+                                         MTIME_COLUMN, mtime,
+                                         -1);
+    }
+  else if (file_type == G_FILE_TYPE_DIRECTORY)
+    {
+      gtk_tree_store_insert_with_values (priv->tree_store, &iter,
+                                         parent_iter, -1,
+                                         PATH_COLUMN, file_path,
+                                         NAME_COLUMN, basename,
+                                         IS_DIRECTORY_COLUMN, TRUE,
+                                         PREVIEW_COLUMN, NULL,
+                                         CANCELLABLE_COLUMN, cancellable,
+                                         DEVICE_COLUMN, device,
+                                         INODE_COLUMN, inode,
+                                         -1);
+
+      /* Walking the directory could take a long time, so the rows under it
+       * show up as they're found, or only once it's expanded.  */
+      if (priv->lazy_expansion)
+        jws_config_window_add_placeholder (win, &iter);
+      else
+        jws_config_window_start_scan (win, &iter, file_path, cancellable,
+                                      NULL);
+    }
+  else
+    {
+      gtk_tree_store_append (priv->tree_store, &iter, parent_iter);
+    }
+
+  g_object_unref (file);
+  g_free (basename);
+  g_free (file_path);
+}
+
+void
+jws_config_window_add_file (JwsConfigWindow *win, const char *path)
+{
+  GCancellable *cancellable;
+  cancellable = g_cancellable_new ();
+
+  jws_config_window_add_file_for_iter (win, path, NULL, cancellable);
+
+  g_object_unref (cancellable);
+
+  /* The new rows may be on screen.  */
+  jws_config_window_queue_preview_priority_update (win);
+}
+
+static void
+jws_config_window_start_scan (JwsConfigWindow *win,
+                              GtkTreeIter *iter,
+                              const gchar *path,
+                              GCancellable *preview_cancellable,
+                              GtkTreeIter *placeholder)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  if (!jws_config_window_can_list (win, iter))
+    return;
+
+  /* A scan that walks everything stops at the same level a lazy one would
+   * have.  */
+  gint max_depth = 1;
+  if (!placeholder)
+    {
+      max_depth = (priv->max_depth > 0)
+        ? priv->max_depth
+        - gtk_tree_store_iter_depth (priv->tree_store, iter)
+        : 0;
+    }
+
+  DirectoryScan *scan;
+  scan = g_new0 (DirectoryScan, 1);
+  scan->win = g_object_ref (win);
+  scan->root = *iter;
+  scan->iters = g_array_new (FALSE, FALSE, sizeof (GtkTreeIter));
+  scan->directories = g_array_new (FALSE, FALSE, sizeof (guint));
+  scan->cancellable = g_cancellable_new ();
+  scan->preview_cancellable = g_object_ref (preview_cancellable);
+  scan->n_files = 0;
+  scan->placeholder = NULL;
+
+  if (placeholder)
+    {
+      GtkTreePath *placeholder_path;
+      placeholder_path = gtk_tree_model_get_path
+        (GTK_TREE_MODEL (priv->tree_store), placeholder);
+      scan->placeholder = gtk_tree_row_reference_new
+        (GTK_TREE_MODEL (priv->tree_store), placeholder_path);
+      gtk_tree_path_free (placeholder_path);
+    }
+
+  priv->directory_scans = g_list_append (priv->directory_scans, scan);
+
+  jws_scan_start (path, max_depth, priv->index,
+                  scan->cancellable,
+                  on_scan_batch, on_scan_done, scan);
+
+  jws_config_window_update_scan_progress (win);
+}
+
+static void
+directory_scan_free (DirectoryScan *scan)
+{
+  g_object_unref (scan->win);
+  g_array_unref (scan->iters);
+  g_array_unref (scan->directories);
+  g_object_unref (scan->cancellable);
+  g_object_unref (scan->preview_cancellable);
+  g_clear_pointer (&scan->placeholder, gtk_tree_row_reference_free);
+  g_free (scan);
+}
+
+static void
+on_scan_batch (GPtrArray *entries, gpointer scan_ptr)
+{
+  DirectoryScan *scan = scan_ptr;
+
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (scan->win);
+
+  /* Scans are cancelled before any row they add to is removed, and a
+   * cancelled scan doesn't deliver anything, so all of these iters are
+   * still valid.  */
+  for (guint i = 0; i < entries->len; i++)
+    {
+      JwsScanEntry *entry = g_ptr_array_index (entries, i);
+
+      GtkTreeIter *parent_iter;
+      parent_iter = (entry->parent < 0)
+        ? &scan->root
+        : &g_array_index (scan->iters, GtkTreeIter, entry->parent);
+
+      GtkTreeIter iter;
+      jws_config_window_insert_entry (scan->win, parent_iter, -1, entry,
+                                      scan->preview_cancellable,
+                                      scan->placeholder != NULL,
+                                      &iter);
+
+      g_array_append_val (scan->iters, iter);
+
+      /* Directories at the last level aren't listed, so they aren't
+       * watched either.  */
+      if (entry->is_directory && !entry->is_repeat
+          && jws_config_window_can_list (scan->win, &iter))
+        {
+          guint number = scan->iters->len - 1;
+          g_array_append_val (scan->directories, number);
+        }
+
+      if (!entry->is_directory)
+        scan->n_files++;
+    }
+
+  jws_config_window_update_scan_progress (scan->win);
+}
+
+static void
+on_scan_done (gboolean completed, gpointer scan_ptr)
+{
+  DirectoryScan *scan = scan_ptr;
+
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (scan->win);
+
+  priv->directory_scans = g_list_remove (priv->directory_scans, scan);
+
+  /* The placeholder is gone if the directory was removed or listed some
+   * other way in the meantime.  If the scan was stopped, the directory keeps
+   * the placeholder and the rows found so far, and is listed again from the
+   * start the next time it's expanded.  */
+  if (priv->tree_store
+      && scan->placeholder
+      && gtk_tree_row_reference_valid (scan->placeholder))
+    {
+      GtkTreePath *placeholder_path;
+      placeholder_path = gtk_tree_row_reference_get_path (scan->placeholder);
+
+      GtkTreeIter placeholder;
+      gtk_tree_model_get_iter (GTK_TREE_MODEL (priv->tree_store),
+                               &placeholder, placeholder_path);
+
+      if (completed)
+        {
+          gtk_tree_store_remove (priv->tree_store, &placeholder);
+          jws_config_window_watch_directory (scan->win, &scan->root);
+        }
+      else
+        {
+          gtk_tree_path_up (placeholder_path);
+          gtk_tree_view_collapse_row (GTK_TREE_VIEW (priv->tree_view),
+                                      placeholder_path);
+        }
+
+      gtk_tree_path_free (placeholder_path);
+    }
+
+  /* Everything the scan went through is in the tree now.  Watching only
+   * starts here, so a change can't add a row the scan adds again.  */
+  if (priv->tree_store && completed && !scan->placeholder)
+    {
+      jws_config_window_watch_directory (scan->win, &scan->root);
+
+      /* Repeats were left empty, so watching them would only add rows
+       * that are already somewhere else.  */
+      for (guint i = 0; i < scan->directories->len; i++)
+        {
+          guint number = g_array_index (scan->directories, guint, i);
+          jws_config_window_watch_directory
+            (scan->win, &g_array_index (scan->iters, GtkTreeIter, number));
+        }
+    }
+
+  /* The window may already be closed if the scan was cancelled.  */
+  if (priv->tree_store)
+    jws_config_window_update_scan_progress (scan->win);
+
+  directory_scan_free (scan);
+}
+
+static void
+jws_config_window_update_scan_progress (JwsConfigWindow *win)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  gboolean is_scanning = FALSE;
+  guint n_files = 0;
+
+  for (GList *iter = priv->directory_scans; iter; iter = g_list_next (iter))
+    {
+      DirectoryScan *scan = iter->data;
+      if (g_cancellable_is_cancelled (scan->cancellable))
+        continue;
+
+      is_scanning = TRUE;
+      n_files += scan->n_files;
+    }
+
+  gtk_widget_set_visible (priv->scan_box, is_scanning);
+
+  if (!is_scanning)
+    return;
+
+  /* There's no way to know how much is left, so just show it's moving.  */
+  gchar *text;
+  text = g_strdup_printf (ngettext ("Scanning, found %u file",
+                                    "Scanning, found %u files",
+                                    n_files),
+                          n_files);
+  gtk_progress_bar_set_text (GTK_PROGRESS_BAR (priv->scan_progress_bar),
+                             text);
+  gtk_progress_bar_pulse (GTK_PROGRESS_BAR (priv->scan_progress_bar));
+  g_free (text);
+}
+
+static void
+jws_config_window_cancel_scans_for_iter (JwsConfigWindow *win,
+                                         GtkTreeIter *iter)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  gboolean is_directory = FALSE;
+  gtk_tree_model_get (GTK_TREE_MODEL (priv->tree_store), iter,
+                      IS_DIRECTORY_COLUMN, &is_directory,
+                      -1);
+
+  for (GList *list_iter = priv->directory_scans;
+       list_iter;
+       list_iter = g_list_next (list_iter))
+    {
+      DirectoryScan *scan = list_iter->data;
+
+      /* The root of a cancelled scan may have been removed already.  */
+      if (g_cancellable_is_cancelled (scan->cancellable))
+        continue;
+
+      /* Rows the scan finds later might go under a directory it added, so
+       * removing one stops all of it.  Nothing goes under a file, so the
+       * scan can carry on without it.  */
+      if (is_same_row (&scan->root, iter)
+          || gtk_tree_store_is_ancestor (priv->tree_store, iter, &scan->root)
+          || (is_directory
+              && gtk_tree_store_is_ancestor (priv->tree_store,
+                                             &scan->root, iter)))
+        g_cancellable_cancel (scan->cancellable);
+    }
+
+  jws_config_window_update_scan_progress (win);
+}
+
+static void
+jws_config_window_cancel_all_scans (JwsConfigWindow *win)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  for (GList *iter = priv->directory_scans; iter; iter = g_list_next (iter))
+    {
+      DirectoryScan *scan = iter->data;
+      g_cancellable_cancel (scan->cancellable);
+    }
+
+  /* The window may be closing.  */
+  if (priv->tree_store)
+    jws_config_window_update_scan_progress (win);
+}
+
+static void
+jws_config_window_begin_bulk_load (JwsConfigWindow *win)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  if (priv->bulk_load_depth++ == 0)
+    gtk_tree_view_set_model (GTK_TREE_VIEW (priv->tree_view), NULL);
+}
+
+static void
+jws_config_window_end_bulk_load (JwsConfigWindow *win)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  g_return_if_fail (priv->bulk_load_depth > 0);
+
+  if (--priv->bulk_load_depth == 0)
+    {
+      gtk_tree_view_set_model (GTK_TREE_VIEW (priv->tree_view),
+                               GTK_TREE_MODEL (priv->tree_store));
+      jws_config_window_queue_preview_priority_update (win);
+    }
+}
+
+static void
+jws_config_window_insert_entry (JwsConfigWindow *win,
+                                GtkTreeIter *parent_iter,
+                                gint position,
+                                JwsScanEntry *entry,
+                                GCancellable *preview_cancellable,
+                                gboolean with_placeholder,
+                                GtkTreeIter *iter)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  /* Setting the values while inserting means one signal per row instead of
+   * two.  Rows inside collapsed directories, which is most of them while a
+   * directory is first scanned, cost the view almost nothing.  */
+  gtk_tree_store_insert_with_values (priv->tree_store, iter,
+                                     parent_iter, position,
+                                     PATH_COLUMN, entry->path,
+                                     NAME_COLUMN, entry->name,
+                                     IS_DIRECTORY_COLUMN, entry->is_directory,
+                                     PREVIEW_COLUMN, NULL,
+                                     CANCELLABLE_COLUMN, preview_cancellable,
+                                     MTIME_COLUMN, entry->mtime,
+                                     DEVICE_COLUMN, entry->device,
+                                     INODE_COLUMN, entry->inode,
+                                     SORT_KEY_COLUMN, entry->sort_key,
+                                     -1);
+
+  /* A scan of one directory only knows about repeats inside it, the rows
+   * above tell whether it leads back to one of them.  */
+  if (entry->is_directory && with_placeholder && !entry->is_repeat
+      && jws_config_window_can_list (win, iter)
+      && !jws_config_window_is_inside_itself (win, iter))
+    jws_config_window_add_placeholder (win, iter);
+}
+
+static void
+jws_config_window_add_placeholder (JwsConfigWindow *win,
+                                   GtkTreeIter *parent_iter)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  GtkTreeIter iter;
+  gtk_tree_store_insert_with_values (priv->tree_store, &iter,
+                                     parent_iter, -1,
+                                     NAME_COLUMN, _("Loading..."),
+                                     IS_PLACEHOLDER_COLUMN, TRUE,
+                                     -1);
+}
+
+static gboolean
+jws_config_window_is_inside_itself (JwsConfigWindow *win, GtkTreeIter *iter)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  GtkTreeModel *model;
+  model = GTK_TREE_MODEL (priv->tree_store);
+
+  guint64 device = 0;
+  guint64 inode = 0;
+  gtk_tree_model_get (model, iter,
+                      DEVICE_COLUMN, &device,
+                      INODE_COLUMN, &inode,
+                      -1);
+
+  if (device == 0 && inode == 0)
+    return FALSE;
+
+  GtkTreeIter child = *iter;
+  GtkTreeIter ancestor;
+  while (gtk_tree_model_iter_parent (model, &ancestor, &child))
+    {
+      guint64 ancestor_device = 0;
+      guint64 ancestor_inode = 0;
+      gtk_tree_model_get (model, &ancestor,
+                          DEVICE_COLUMN, &ancestor_device,
+                          INODE_COLUMN, &ancestor_inode,
+                          -1);
+
+      if (ancestor_device == device && ancestor_inode == inode)
+        return TRUE;
+
+      child = ancestor;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+jws_config_window_can_list (JwsConfigWindow *win, GtkTreeIter *iter)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  return priv->max_depth <= 0
+    || gtk_tree_store_iter_depth (priv->tree_store, iter) < priv->max_depth;
+}
+
+static gboolean
+jws_config_window_is_placeholder (JwsConfigWindow *win, GtkTreeIter *iter)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  gboolean is_placeholder = FALSE;
+  gtk_tree_model_get (GTK_TREE_MODEL (priv->tree_store), iter,
+                      IS_PLACEHOLDER_COLUMN, &is_placeholder,
+                      -1);
+
+  return is_placeholder;
+}
+
+static gboolean
+jws_config_window_get_placeholder (JwsConfigWindow *win,
+                                   GtkTreeIter *iter,
+                                   GtkTreeIter *placeholder)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  GtkTreeModel *model;
+  model = GTK_TREE_MODEL (priv->tree_store);
+
+  /* The placeholder is added first and rows found later go after it, so it
+   * stays the first child.  */
+  GtkTreeIter child;
+  if (!gtk_tree_model_iter_children (model, &child, iter)
+      || !jws_config_window_is_placeholder (win, &child))
+    return FALSE;
+
+  if (placeholder)
+    *placeholder = child;
+  return TRUE;
+}
+
+static void
+jws_config_window_clear_directory (JwsConfigWindow *win, GtkTreeIter *iter)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  GtkTreeModel *model;
+  model = GTK_TREE_MODEL (priv->tree_store);
+
+  /* Only the scans at or under the directory, a scan of the directory above
+   * it may still be adding its siblings.  */
+  for (GList *list_iter = priv->directory_scans;
+       list_iter;
+       list_iter = g_list_next (list_iter))
+    {
+      DirectoryScan *scan = list_iter->data;
+
+      if (g_cancellable_is_cancelled (scan->cancellable))
+        continue;
+
+      if (is_same_row (&scan->root, iter)
+          || gtk_tree_store_is_ancestor (priv->tree_store, iter, &scan->root))
+        g_cancellable_cancel (scan->cancellable);
+    }
+
+  jws_config_window_update_scan_progress (win);
+
+  GtkTreeIter child;
+  gboolean has_child = gtk_tree_model_iter_children (model, &child, iter);
+  while (has_child)
+    {
+      if (jws_config_window_is_placeholder (win, &child))
+        {
+          has_child = gtk_tree_model_iter_next (model, &child);
+          continue;
+        }
+
+      jws_config_window_cancel_previews_for_iter (win, &child);
+      jws_config_window_release_previews_for_iter (win, &child);
+      /* Moves child to the next row.  */
+      has_child = gtk_tree_store_remove (priv->tree_store, &child);
+    }
+}
+
+static void
+jws_config_window_list_directory_now (JwsConfigWindow *win,
+                                      GtkTreeIter *iter)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  GtkTreeIter placeholder;
+  if (!jws_config_window_get_placeholder (win, iter, &placeholder))
+    return;
+
+  /* Start over even if it's being scanned, since the scan may not get to the
+   * end for a while.  */
+  jws_config_window_clear_directory (win, iter);
+
+  gchar *path = NULL;
+  GCancellable *preview_cancellable = NULL;
+  gtk_tree_model_get (GTK_TREE_MODEL (priv->tree_store), iter,
+                      PATH_COLUMN, &path,
+                      CANCELLABLE_COLUMN, &preview_cancellable,
+                      -1);
+
+  GPtrArray *entries;
+  entries = jws_scan_list (path, priv->index, NULL);
+
+  for (guint i = 0; i < entries->len; i++)
+    {
+      GtkTreeIter child;
+      jws_config_window_insert_entry (win, iter, -1,
+                                      g_ptr_array_index (entries, i),
+                                      preview_cancellable,
+                                      TRUE,
+                                      &child);
+    }
+
+  gtk_tree_store_remove (priv->tree_store, &placeholder);
+
+  jws_config_window_watch_directory (win, iter);
+
+  g_ptr_array_unref (entries);
+  g_free (path);
+  g_clear_object (&preview_cancellable);
+}
+
+static gboolean
+on_test_expand_row (GtkTreeView *view,
+                    GtkTreeIter *iter,
+                    GtkTreePath *path,
+                    gpointer win)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  GtkTreeIter placeholder;
+  if (!jws_config_window_get_placeholder (win, iter, &placeholder))
+    return FALSE;
+
+  /* It's already being listed.  */
+  for (GList *list_iter = priv->directory_scans;
+       list_iter;
+       list_iter = g_list_next (list_iter))
+    {
+      DirectoryScan *scan = list_iter->data;
+      if (!g_cancellable_is_cancelled (scan->cancellable)
+          && is_same_row (&scan->root, iter))
+        return FALSE;
+    }
+
+  /* Rows left from a scan that was stopped.  */
+  jws_config_window_clear_directory (win, iter);
+
+  gchar *dir_path = NULL;
+  GCancellable *preview_cancellable = NULL;
+  gtk_tree_model_get (GTK_TREE_MODEL (priv->tree_store), iter,
+                      PATH_COLUMN, &dir_path,
+                      CANCELLABLE_COLUMN, &preview_cancellable,
+                      -1);
+
+  /* The placeholder shows while the rows come in.  */
+  jws_config_window_start_scan (win, iter, dir_path, preview_cancellable,
+                                &placeholder);
+
+  g_free (dir_path);
+  g_clear_object (&preview_cancellable);
+
+  return FALSE;
+}
+
+static gboolean
+select_row_func (GtkTreeSelection *selection,
+                 GtkTreeModel *model,
+                 GtkTreePath *path,
+                 gboolean path_currently_selected,
+                 gpointer data)
+{
+  GtkTreeIter iter;
+  if (!gtk_tree_model_get_iter (model, &iter, path))
+    return TRUE;
+
+  gboolean is_placeholder = FALSE;
+  gtk_tree_model_get (model, &iter,
+                      IS_PLACEHOLDER_COLUMN, &is_placeholder,
+                      -1);
+
+  /* Placeholders can't be removed or moved.  */
+  return !is_placeholder;
+}
+
+static void
+jws_config_window_watch_directory (JwsConfigWindow *win, GtkTreeIter *iter)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  if (!priv->watch_directories)
+    return;
+
+  GtkTreeModel *model;
+  model = GTK_TREE_MODEL (priv->tree_store);
+
+  gchar *path = NULL;
+  GFileMonitor *monitor = NULL;
+  gtk_tree_model_get (model, iter,
+                      PATH_COLUMN, &path,
+                      MONITOR_COLUMN, &monitor,
+                      -1);
+
+  if (monitor || !path)
+    {
+      g_free (path);
+      g_clear_object (&monitor);
+      return;
+    }
+
+  GFile *file;
+  file = g_file_new_for_path (path);
+
+  /* Running out of inotify watches, or a file system that can't be watched,
+   * just leaves the directory as it was listed.  */
+  monitor = g_file_monitor_directory (file, G_FILE_MONITOR_WATCH_MOVES, NULL,
+                                      NULL);
+
+  if (monitor)
+    {
+      GtkTreePath *tree_path;
+      tree_path = gtk_tree_model_get_path (model, iter);
+
+      DirectoryWatch *watch;
+      watch = g_new0 (DirectoryWatch, 1);
+      watch->win = win;
+      watch->row = gtk_tree_row_reference_new (model, tree_path);
+      gtk_tree_path_free (tree_path);
+
+      g_signal_connect_data (monitor, "changed",
+                             G_CALLBACK (on_directory_changed),
+                             watch,
+                             (GClosureNotify) directory_watch_free,
+                             0);
+
+      gtk_tree_store_set (priv->tree_store, iter,
+                          MONITOR_COLUMN, monitor,
+                          -1);
+      g_object_unref (monitor);
+    }
+
+  g_object_unref (file);
+  g_free (path);
+}
+
+static void
+directory_watch_free (DirectoryWatch *watch, GClosure *closure)
+{
+  gtk_tree_row_reference_free (watch->row);
+  g_free (watch);
+}
+
+static void
+on_directory_changed (GFileMonitor *monitor,
+                      GFile *file,
+                      GFile *other_file,
+                      GFileMonitorEvent event_type,
+                      gpointer watch_ptr)
+{
+  DirectoryWatch *watch = watch_ptr;
+
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (watch->win);
+
+  /* The monitor goes away with the row, but the window may be closing.  */
+  if (!priv->tree_store || !gtk_tree_row_reference_valid (watch->row))
+    return;
+
+  GtkTreePath *tree_path;
+  tree_path = gtk_tree_row_reference_get_path (watch->row);
+
+  GtkTreeIter iter;
+  gtk_tree_model_get_iter (GTK_TREE_MODEL (priv->tree_store), &iter,
+                           tree_path);
+  gtk_tree_path_free (tree_path);
+
+  /* Only the row for the file that changed is touched, so keeping a big
+   * directory current costs about as much as what changed in it.  */
+  switch (event_type)
+    {
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+      jws_config_window_add_watched_file (watch->win, &iter, file);
+      break;
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_MOVED_OUT:
+      jws_config_window_remove_watched_file (watch->win, &iter, file);
+      break;
+    case G_FILE_MONITOR_EVENT_RENAMED:
+      jws_config_window_rename_watched_file (watch->win, &iter, file,
+                                             other_file);
+      break;
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+      jws_config_window_update_watched_file (watch->win, &iter, file);
+      break;
+    default:
+      break;
+    }
+}
+
+static gboolean
+jws_config_window_find_child (JwsConfigWindow *win,
+                              GtkTreeIter *parent_iter,
+                              const gchar *path,
+                              GtkTreeIter *child)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  GtkTreeModel *model;
+  model = GTK_TREE_MODEL (priv->tree_store);
+
+  gboolean has_child;
+  for (has_child = gtk_tree_model_iter_children (model, child, parent_iter);
+       has_child;
+       has_child = gtk_tree_model_iter_next (model, child))
+    {
+      gchar *child_path = NULL;
+      gtk_tree_model_get (model, child,
+                          PATH_COLUMN, &child_path,
+                          -1);
+
+      gboolean is_match;
+      is_match = (g_strcmp0 (child_path, path) == 0);
+      g_free (child_path);
+
+      if (is_match)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+jws_config_window_find_sorted_position (JwsConfigWindow *win,
+                                        GtkTreeIter *parent_iter,
+                                        const gchar *name,
+                                        GtkTreeIter *skip,
+                                        GtkTreeIter *sibling,
+                                        gint *position)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  GtkTreeModel *model;
+  model = GTK_TREE_MODEL (priv->tree_store);
+
+  gint n_before = 0;
+
+  gchar *key;
+  key = jws_scan_get_sort_key (name);
+
+  gboolean is_found = FALSE;
+
+  GtkTreeIter child;
+  gboolean has_child;
+  for (has_child = gtk_tree_model_iter_children (model, &child, parent_iter);
+       has_child;
+       has_child = gtk_tree_model_iter_next (model, &child))
+    {
+      if (skip && is_same_row (&child, skip))
+        continue;
+
+      gchar *child_name = NULL;
+      gchar *child_key = NULL;
+      gtk_tree_model_get (model, &child,
+                          NAME_COLUMN, &child_name,
+                          SORT_KEY_COLUMN, &child_key,
+                          -1);
+
+      if (!child_name)
+        {
+          n_before++;
+          continue;
+        }
+
+      /* In the same order as a scan, see jws_scan_get_sort_key ().  Rows
+       * from the index don't have keys, they're kept once they're made so
+       * each change only costs one more.  */
+      if (!child_key)
+        {
+          child_key = jws_scan_get_sort_key (child_name);
+          gtk_tree_store_set (priv->tree_store, &child,
+                              SORT_KEY_COLUMN, child_key,
+                              -1);
+        }
+
+      gint result;
+      result = strcmp (key, child_key);
+      if (result == 0)
+        result = strcmp (name, child_name);
+
+      g_free (child_key);
+      g_free (child_name);
+
+      if (result < 0)
+        {
+          is_found = TRUE;
+          break;
+        }
+
+      n_before++;
+    }
+
+  g_free (key);
+
+  if (is_found && sibling)
+    *sibling = child;
+  if (position)
+    *position = (is_found) ? n_before : -1;
+  return is_found;
+}
+
+static void
+jws_config_window_add_watched_file (JwsConfigWindow *win,
+                                    GtkTreeIter *parent_iter,
+                                    GFile *file)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  gchar *path;
+  path = g_file_get_path (file);
+
+  /* A file written over another one, which only needs a new preview.  */
+  GtkTreeIter iter;
+  if (jws_config_window_find_child (win, parent_iter, path, &iter))
+    {
+      g_free (path);
+      jws_config_window_update_watched_file (win, parent_iter, file);
+      return;
+    }
+  g_free (path);
+
+  JwsScanEntry *entry;
+  entry = jws_scan_query (file, NULL);
+  if (!entry)
+    return;
+
+  /* Left out the same way a scan would leave it out.  */
+  if (!jws_scan_rules_allow (jws_scan_rules_get_default (),
+                             entry->name,
+                             entry->is_directory))
+    {
+      jws_scan_entry_free (entry);
+      return;
+    }
+
+  GCancellable *preview_cancellable = NULL;
+  gtk_tree_model_get (GTK_TREE_MODEL (priv->tree_store), parent_iter,
+                      CANCELLABLE_COLUMN, &preview_cancellable,
+                      -1);
+
+  gint position;
+  jws_config_window_find_sorted_position (win, parent_iter, entry->name,
+                                          NULL, NULL, &position);
+
+  /* The preview is requested when the row is drawn, like any other.  */
+  jws_config_window_insert_entry (win, parent_iter, position, entry,
+                                  preview_cancellable,
+                                  priv->lazy_expansion,
+                                  &iter);
+
+  if (entry->is_directory && !priv->lazy_expansion)
+    jws_config_window_start_scan (win, &iter, entry->path,
+                                  preview_cancellable, NULL);
+
+  g_clear_object (&preview_cancellable);
+  jws_scan_entry_free (entry);
+}
+
+static void
+jws_config_window_remove_watched_file (JwsConfigWindow *win,
+                                       GtkTreeIter *parent_iter,
+                                       GFile *file)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  gchar *path;
+  path = g_file_get_path (file);
+
+  GtkTreeIter iter;
+  if (jws_config_window_find_child (win, parent_iter, path, &iter))
+    {
+      jws_config_window_cancel_scans_for_iter (win, &iter);
+      jws_config_window_cancel_previews_for_iter (win, &iter);
+      jws_config_window_release_previews_for_iter (win, &iter);
+      gtk_tree_store_remove (priv->tree_store, &iter);
+    }
+
+  g_free (path);
+}
+
+static void
+jws_config_window_rename_watched_file (JwsConfigWindow *win,
+                                       GtkTreeIter *parent_iter,
+                                       GFile *file,
+                                       GFile *new_file)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  GtkTreeModel *model;
+  model = GTK_TREE_MODEL (priv->tree_store);
+
+  gchar *path;
+  path = g_file_get_path (file);
+
+  GtkTreeIter iter;
+  gboolean has_row;
+  has_row = jws_config_window_find_child (win, parent_iter, path, &iter);
+  g_free (path);
+
+  gboolean is_directory = FALSE;
+  if (has_row)
+    gtk_tree_model_get (model, &iter,
+                        IS_DIRECTORY_COLUMN, &is_directory,
+                        -1);
+
+  /* Every row under a directory has its path in it, so a renamed directory
+   * is listed again.  Only the row for the directory itself is redone, the
+   * rest of the tree stays as it is.  */
+  if (!has_row || is_directory)
+    {
+      jws_config_window_remove_watched_file (win, parent_iter, file);
+      jws_config_window_add_watched_file (win, parent_iter, new_file);
+      return;
+    }
+
+  gchar *new_name;
+  new_name = g_file_get_basename (new_file);
+
+  /* Renamed to something the scan rules leave out, like a hidden file.  */
+  if (!jws_scan_rules_allow (jws_scan_rules_get_default (), new_name, FALSE))
+    {
+      g_free (new_name);
+      jws_config_window_remove_watched_file (win, parent_iter, file);
+      return;
+    }
+
+  /* A file that was renamed over.  */
+  jws_config_window_remove_watched_file (win, parent_iter, new_file);
+
+  gchar *new_path;
+  new_path = g_file_get_path (new_file);
+
+  /* A preview that's still loading would look for the old path, so it's
+   * asked for again.  One that's already there is still right.  */
+  JwsPreviewJob *job = NULL;
+  gtk_tree_model_get (model, &iter,
+                      PREVIEW_JOB_COLUMN, &job,
+                      -1);
+  if (job)
+    {
+      jws_preview_pool_cancel_job (priv->preview_pool, job);
+      jws_preview_job_unref (job);
+    }
+
+  gtk_tree_store_set (priv->tree_store, &iter,
+                      PATH_COLUMN, new_path,
+                      NAME_COLUMN, new_name,
+                      SORT_KEY_COLUMN, NULL,
+                      PREVIEW_JOB_COLUMN, NULL,
+                      -1);
+
+  GtkTreeIter sibling;
+  if (jws_config_window_find_sorted_position (win, parent_iter, new_name,
+                                              &iter, &sibling, NULL))
+    gtk_tree_store_move_before (priv->tree_store, &iter, &sibling);
+  else
+    gtk_tree_store_move_before (priv->tree_store, &iter, NULL);
+
+  g_free (new_path);
+  g_free (new_name);
+}
+
+static void
+jws_config_window_update_watched_file (JwsConfigWindow *win,
+                                       GtkTreeIter *parent_iter,
+                                       GFile *file)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  gchar *path;
+  path = g_file_get_path (file);
+
+  GtkTreeIter iter;
+  gboolean has_row;
+  has_row = jws_config_window_find_child (win, parent_iter, path, &iter);
+  g_free (path);
+
+  if (!has_row)
+    return;
+
+  gboolean is_directory = FALSE;
+  gint64 mtime = 0;
+  JwsPreviewJob *job = NULL;
+  gtk_tree_model_get (GTK_TREE_MODEL (priv->tree_store), &iter,
+                      IS_DIRECTORY_COLUMN, &is_directory,
+                      MTIME_COLUMN, &mtime,
+                      PREVIEW_JOB_COLUMN, &job,
+                      -1);
+
+  JwsScanEntry *entry = NULL;
+  if (!is_directory)
+    entry = jws_scan_query (file, NULL);
+
+  /* The preview is loaded again with the new time when the row is drawn, so
+   * the old one doesn't come back from the caches.  */
+  if (entry && !entry->is_directory && entry->mtime != mtime)
+    {
+      if (job)
+        jws_preview_pool_cancel_job (priv->preview_pool, job);
+
+      jws_config_window_clear_row_preview (win, &iter);
+      gtk_tree_store_set (priv->tree_store, &iter,
+                          MTIME_COLUMN, entry->mtime,
+                          PREVIEW_JOB_COLUMN, NULL,
+                          -1);
+    }
+
+  if (job)
+    jws_preview_job_unref (job);
+  jws_scan_entry_free (entry);
+}
+
+gchar *
+jws_get_type_string (gboolean is_directory)
+{
+  gchar *type_string = NULL;
+  if (is_directory)
+    {
+      type_string = g_strdup (_("Directory"));
+    }
+  else
+    {
+      type_string = g_strdup (_("File"));
+    }
+  return type_string;
+}
+
+static void
+preview_request_free (PreviewRequest *request)
+{
+  g_free (request);
+}
+
+static void
+jws_config_window_set_row_preview (JwsConfigWindow *win,
+                                   GtkTreeIter *iter,
+                                   GdkPixbuf *preview)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  /* The fast preview a good one replaces doesn't count anymore.  */
+  GdkPixbuf *old_preview = NULL;
+  gtk_tree_model_get (GTK_TREE_MODEL (priv->tree_store), iter,
+                      PREVIEW_COLUMN, &old_preview,
+                      -1);
+  if (old_preview)
+    {
+      gsize old_bytes = gdk_pixbuf_get_byte_length (old_preview);
+      priv->preview_bytes -= MIN (old_bytes, priv->preview_bytes);
+      g_object_unref (old_preview);
+    }
+
+  gtk_tree_store_set (priv->tree_store, iter,
+                      PREVIEW_COLUMN, preview,
+                      -1);
+
+  priv->preview_bytes += gdk_pixbuf_get_byte_length (preview);
+
+  if (priv->preview_budget > 0
+      && priv->preview_bytes > priv->preview_budget
+      && priv->preview_evict_source == 0)
+    {
+      priv->preview_evict_source
+        = g_idle_add_full (G_PRIORITY_LOW, evict_offscreen_previews, win,
+                           NULL);
+    }
+}
+
+static JwsPreviewJob *
+jws_config_window_request_preview (JwsConfigWindow *win, GtkTreeIter *iter)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  gchar *path = NULL;
+  GCancellable *cancellable = NULL;
+  gint64 mtime = 0;
+  gtk_tree_model_get (GTK_TREE_MODEL (priv->tree_store), iter,
+                      PATH_COLUMN, &path,
+                      CANCELLABLE_COLUMN, &cancellable,
+                      MTIME_COLUMN, &mtime,
+                      -1);
+
+  JwsPreviewJob *job = NULL;
+
+  /* If this file was in the tree before, reloading or scrolling back to an
+   * evicted row for example, its preview is probably still around.  */
+  GdkPixbuf *preview;
+  preview = jws_preview_cache_lookup (priv->preview_cache, path, mtime);
+
+  if (!preview && priv->atlas)
+    preview = jws_atlas_lookup (priv->atlas, path, mtime);
+
+  PreviewRequest *request;
+  request = g_new0 (PreviewRequest, 1);
+  request->iter = *iter;
+
+  /* The time may have come from the directory index, which doesn't see
+   * files written to in place.  It's shown right away but checked on a
+   * worker, since reading the time here would stall scrolling on network
+   * shares.  */
+  if (preview)
+    {
+      jws_config_window_set_row_preview (win, iter, preview);
+      job = jws_preview_pool_push_check (priv->preview_pool, path, mtime,
+                                         preview, cancellable,
+                                         request,
+                                         (GDestroyNotify)
+                                         preview_request_free);
+      g_object_unref (preview);
+    }
+  else
+    {
+      job = jws_preview_pool_push (priv->preview_pool, path, cancellable,
+                                   request,
+                                   (GDestroyNotify) preview_request_free);
+    }
+
+  gtk_tree_store_set (priv->tree_store, iter,
+                      PREVIEW_JOB_COLUMN, job,
+                      -1);
+
+  g_free (path);
+  g_clear_object (&cancellable);
+
+  return job;
+}
+
+static void
+jws_config_window_cancel_previews_for_iter (JwsConfigWindow *win,
+                                            GtkTreeIter *iter)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  GtkTreeModel *model;
+  model = GTK_TREE_MODEL (priv->tree_store);
+
+  /* A top level row owns the cancellable for everything under it.  */
+  if (gtk_tree_store_iter_depth (priv->tree_store, iter) == 0)
+    {
+      GCancellable *cancellable = NULL;
+      gtk_tree_model_get (model, iter,
+                          CANCELLABLE_COLUMN, &cancellable,
+                          -1);
+      if (cancellable)
+        {
+          g_cancellable_cancel (cancellable);
+          g_object_unref (cancellable);
+        }
+      return;
+    }
+
+  JwsPreviewJob *job = NULL;
+  gtk_tree_model_get (model, iter,
+                      PREVIEW_JOB_COLUMN, &job,
+                      -1);
+  if (job)
+    {
+      jws_preview_pool_cancel_job (priv->preview_pool, job);
+      jws_preview_job_unref (job);
+    }
+
+  GtkTreeIter child;
+  gboolean has_child;
+  for (has_child = gtk_tree_model_iter_children (model, &child, iter);
+       has_child;
+       has_child = gtk_tree_model_iter_next (model, &child))
+    {
+      jws_config_window_cancel_previews_for_iter (win, &child);
+    }
+}
+
+static void
+jws_config_window_clear_row_preview (JwsConfigWindow *win,
+                                     GtkTreeIter *iter)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  GdkPixbuf *preview = NULL;
+  gtk_tree_model_get (GTK_TREE_MODEL (priv->tree_store), iter,
+                      PREVIEW_COLUMN, &preview,
+                      -1);
+  if (!preview)
+    return;
+
+  gsize bytes = gdk_pixbuf_get_byte_length (preview);
+  priv->preview_bytes -= MIN (bytes, priv->preview_bytes);
+  g_object_unref (preview);
+
+  gtk_tree_store_set (priv->tree_store, iter,
+                      PREVIEW_COLUMN, NULL,
+                      -1);
+}
+
+static void
+jws_config_window_release_previews_for_iter (JwsConfigWindow *win,
+                                             GtkTreeIter *iter)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  GtkTreeModel *model;
+  model = GTK_TREE_MODEL (priv->tree_store);
+
+  GdkPixbuf *preview = NULL;
+  gtk_tree_model_get (model, iter,
+                      PREVIEW_COLUMN, &preview,
+                      -1);
+  if (preview)
+    {
+      gsize bytes = gdk_pixbuf_get_byte_length (preview);
+      priv->preview_bytes -= MIN (bytes, priv->preview_bytes);
+      g_object_unref (preview);
+    }
+
+  GtkTreeIter child;
+  gboolean has_child;
+  for (has_child = gtk_tree_model_iter_children (model, &child, iter);
+       has_child;
+       has_child = gtk_tree_model_iter_next (model, &child))
+    {
+      jws_config_window_release_previews_for_iter (win, &child);
+    }
+}
+
+static void
+jws_config_window_cancel_all_previews (JwsConfigWindow *win)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  GtkTreeModel *model;
+  model = GTK_TREE_MODEL (priv->tree_store);
+
+  /* The new generation drops everything still queued without looking at it,
+   * cancelling the top level rows stops the loads that already started.  */
+  jws_preview_pool_cancel_all (priv->preview_pool);
+
+  GtkTreeIter iter;
+  gboolean has_row;
+  for (has_row = gtk_tree_model_get_iter_first (model, &iter);
+       has_row;
+       has_row = gtk_tree_model_iter_next (model, &iter))
+    {
+      jws_config_window_cancel_previews_for_iter (win, &iter);
+    }
+}
+
+static void
+on_preview_ready (const gchar *path,
+                  GdkPixbuf *preview,
+                  gint64 mtime,
+                  gboolean is_final,
+                  gpointer request_ptr,
+                  gpointer win)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (JWS_CONFIG_WINDOW (win));
+
+  PreviewRequest *request = request_ptr;
+
+  /* The pool doesn't call this for cancelled jobs, so the row is still
+   * there.  Failed files keep their job so they aren't tried again.  */
+  if (!preview)
+    return;
+
+  GdkPixbuf *old_preview = NULL;
+  gint64 row_mtime = 0;
+  gtk_tree_model_get (GTK_TREE_MODEL (priv->tree_store), &request->iter,
+                      PREVIEW_COLUMN, &old_preview,
+                      MTIME_COLUMN, &row_mtime,
+                      -1);
+  g_clear_object (&old_preview);
+
+  /* A check found the file as it was, so the row already has this.  */
+  if (preview == old_preview)
+    {
+      gtk_tree_store_set (priv->tree_store, &request->iter,
+                          PREVIEW_JOB_COLUMN, NULL,
+                          -1);
+      return;
+    }
+
+  /* The worker read the real time, which the row may not have had if it
+   * came from the directory index.  */
+  if (mtime < 0)
+    mtime = row_mtime;
+  else if (mtime != row_mtime)
+    gtk_tree_store_set (priv->tree_store, &request->iter,
+                        MTIME_COLUMN, mtime,
+                        -1);
+
+  /* Even if the row is gone by now, it might come back.  Only final
+   * previews are kept, since a row that finds one in the cache never asks
+   * for a better one, and the atlas takes it as final too.  */
+  if (is_final)
+    jws_preview_cache_insert (priv->preview_cache, path, mtime, preview);
+
+  jws_config_window_set_row_preview (JWS_CONFIG_WINDOW (win), &request->iter,
+                                     preview);
+
+  if (is_final)
+    {
+      gtk_tree_store_set (priv->tree_store, &request->iter,
+                          PREVIEW_JOB_COLUMN, NULL,
+                          -1);
+      priv->atlas_dirty = TRUE;
+    }
+}
+
+static void
+add_previews_to_atlas (JwsConfigWindow *win,
+                       JwsAtlasWriter *writer,
+                       GtkTreeIter *parent)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  GtkTreeModel *model;
+  model = GTK_TREE_MODEL (priv->tree_store);
+
+  GtkTreeIter iter;
+  gboolean has_row;
+  for (has_row = gtk_tree_model_iter_children (model, &iter, parent);
+       has_row;
+       has_row = gtk_tree_model_iter_next (model, &iter))
+    {
+      gchar *path = NULL;
+      gboolean is_directory = FALSE;
+      GdkPixbuf *preview = NULL;
+      JwsPreviewJob *job = NULL;
+      gint64 mtime = 0;
+      gtk_tree_model_get (model, &iter,
+                          PATH_COLUMN, &path,
+                          IS_DIRECTORY_COLUMN, &is_directory,
+                          PREVIEW_COLUMN, &preview,
+                          PREVIEW_JOB_COLUMN, &job,
+                          MTIME_COLUMN, &mtime,
+                          -1);
+
+      if (is_directory)
+        {
+          add_previews_to_atlas (win, writer, &iter);
+        }
+      else if (path)
+        {
+          /* A row with a job only has a fast preview so far.  Rows that were
+           * evicted or haven't been refined yet keep what the old atlas had
+           * for them, as long as the file hasn't changed.  */
+          if (preview && !job)
+            {
+              jws_atlas_writer_add (writer, path, mtime, preview);
+            }
+          else if (priv->atlas)
+            {
+              GdkPixbuf *saved;
+              saved = jws_atlas_lookup (priv->atlas, path, mtime);
+              if (saved)
+                {
+                  jws_atlas_writer_add (writer, path, mtime, saved);
+                  g_object_unref (saved);
+                }
+            }
+        }
+
+      g_free (path);
+      g_clear_object (&preview);
+      if (job)
+        jws_preview_job_unref (job);
+    }
+}
+
+static void
+jws_config_window_save_atlas (JwsConfigWindow *win)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  if (!priv->atlas_file || !priv->atlas_dirty)
+    return;
+
+  JwsAtlasWriter *writer;
+  writer = jws_atlas_writer_new (JWS_CONFIG_WINDOW_PREVIEW_HEIGHT);
+  add_previews_to_atlas (win, writer, NULL);
+
+  /* The old atlas can stay mapped, the new one is renamed over it.  */
+  GError *err = NULL;
+  if (!jws_atlas_writer_save (writer, priv->atlas_file, &err))
+    {
+      g_warning ("Failed to save previews to %s: %s",
+                 priv->atlas_file, err->message);
+      g_error_free (err);
+    }
+
+  jws_atlas_writer_free (writer);
+  priv->atlas_dirty = FALSE;
+}
+
+static void
+jws_config_window_save_index (JwsConfigWindow *win)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  if (!priv->index)
+    return;
 
-  preview_column = gtk_tree_view_column_new_with_attributes (_("Preview"),
-                                                             pixbuf_renderer,
-                                                             "pixbuf",
-                                                             PREVIEW_COLUMN,
-                                                             NULL);
-  gtk_tree_view_insert_column (as_view, preview_column, PREVIEW_COLUMN);
+  gchar *index_file;
+  index_file = jws_index_get_default_file ();
 
-  priv->tree_selection = gtk_tree_view_get_selection
-    (GTK_TREE_VIEW (priv->tree_view));
-  gtk_tree_selection_set_mode (priv->tree_selection, GTK_SELECTION_MULTIPLE);
+  GError *err = NULL;
+  if (!jws_index_save (priv->index, index_file, &err))
+    {
+      g_warning ("Failed to save directory index to %s: %s",
+                 index_file, err->message);
+      g_error_free (err);
+    }
+
+  g_free (index_file);
 }
 
-static gchar *
-get_home_directory ()
+static void
+jws_config_window_open_atlas (JwsConfigWindow *win,
+                              const gchar *config_path)
 {
-  return g_strdup (g_get_home_dir ());
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
+
+  g_clear_pointer (&priv->atlas, jws_atlas_free);
+  g_clear_pointer (&priv->atlas_file, g_free);
+  priv->atlas_dirty = FALSE;
+
+  if (!config_path)
+    return;
+
+  priv->atlas_file = jws_atlas_get_file_for_config (config_path);
+
+  /* Not having one yet is normal, the first load of a config makes it.  */
+  GError *err = NULL;
+  priv->atlas = jws_atlas_open (priv->atlas_file,
+                                JWS_CONFIG_WINDOW_PREVIEW_HEIGHT,
+                                &err);
+  if (!priv->atlas)
+    {
+      if (!g_error_matches (err, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("%s", err->message);
+      g_error_free (err);
+    }
 }
 
-void
-jws_config_window_add_file_selection (JwsConfigWindow *win)
+static void
+jws_config_window_queue_preview_priority_update (JwsConfigWindow *win)
 {
-  GtkWidget *dialog;
-  dialog = gtk_file_chooser_dialog_new (_("Choose File"),
-                                        GTK_WINDOW (win),
-                                        GTK_FILE_CHOOSER_ACTION_OPEN,
-                                        _("Add"), GTK_RESPONSE_ACCEPT,
-                                        _("Cancel"), GTK_RESPONSE_CANCEL,
-                                        NULL);
-  gchar *home_dir;
-  home_dir = get_home_directory ();
-  gtk_file_chooser_set_current_folder (GTK_FILE_CHOOSER (dialog), home_dir);
-  g_free (home_dir);
-
-  gtk_file_chooser_set_select_multiple (GTK_FILE_CHOOSER (dialog), TRUE);
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (win);
 
-  GtkFileFilter *filter;
-  filter = gtk_file_filter_new ();
+  /* The view can still scroll while the window is being destroyed.  */
+  if (!priv->preview_pool)
+    return;
 
-  gtk_file_filter_add_pixbuf_formats (filter);
+  if (priv->preview_priority_source == 0)
+    priv->preview_priority_source = g_idle_add (update_preview_priorities,
+                                                win);
+}
 
-  /* I don't think I have to free this because it's a floating reference.  */
-  gtk_file_chooser_set_filter (GTK_FILE_CHOOSER (dialog), filter);
+static gboolean
+get_next_visible_iter (GtkTreeView *view,
+                       GtkTreeModel *model,
+                       GtkTreeIter *iter)
+{
+  GtkTreePath *tree_path;
+  tree_path = gtk_tree_model_get_path (model, iter);
 
-  int response;
-  response = gtk_dialog_run (GTK_DIALOG (dialog));
+  gboolean is_expanded;
+  is_expanded = gtk_tree_view_row_expanded (view, tree_path);
+  gtk_tree_path_free (tree_path);
 
-  GSList *file_list = NULL;
+  GtkTreeIter next;
 
-  if (response == GTK_RESPONSE_ACCEPT)
+  if (is_expanded && gtk_tree_model_iter_children (model, &next, iter))
     {
-      file_list = gtk_file_chooser_get_filenames (GTK_FILE_CHOOSER (dialog));
+      *iter = next;
+      return TRUE;
     }
 
-  gtk_widget_destroy (dialog);
+  GtkTreeIter current = *iter;
 
-  GSList *iter;
-  for (iter = file_list; iter != NULL; iter = g_slist_next (iter))
+  while (TRUE)
     {
-      jws_config_window_add_file (win, iter->data);
-      g_free (iter->data);
+      next = current;
+      if (gtk_tree_model_iter_next (model, &next))
+        {
+          *iter = next;
+          return TRUE;
+        }
+
+      GtkTreeIter parent;
+      if (!gtk_tree_model_iter_parent (model, &parent, &current))
+        return FALSE;
+
+      current = parent;
     }
-  g_slist_free (file_list);
 }
 
-void
-jws_config_window_add_directory_selection (JwsConfigWindow *win)
+static gboolean
+get_previous_visible_iter (GtkTreeView *view,
+                           GtkTreeModel *model,
+                           GtkTreeIter *iter)
 {
-  GtkWidget *dialog;
-  dialog = gtk_file_chooser_dialog_new (_("Choose Directory"),
-                                        GTK_WINDOW (win),
-                                        GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
-                                        _("Add"), GTK_RESPONSE_ACCEPT,
-                                        _("Cancel"), GTK_RESPONSE_CANCEL,
-                                        NULL);
-  gchar *home_dir;
-  home_dir = get_home_directory ();
-  gtk_file_chooser_set_current_folder (GTK_FILE_CHOOSER (dialog), home_dir);
-  g_free (home_dir);
+  GtkTreeIter previous = *iter;
 
-  gtk_file_chooser_set_select_multiple (GTK_FILE_CHOOSER (dialog), TRUE);
+  if (!gtk_tree_model_iter_previous (model, &previous))
+    {
+      GtkTreeIter parent;
+      if (!gtk_tree_model_iter_parent (model, &parent, iter))
+        return FALSE;
 
-  int response;
-  response = gtk_dialog_run (GTK_DIALOG (dialog));
+      *iter = parent;
+      return TRUE;
+    }
 
-  GSList *file_list = NULL;
+  /* The row before is the last visible row inside the previous sibling.  */
+  GtkTreePath *tree_path;
+  tree_path = gtk_tree_model_get_path (model, &previous);
 
-  if (response == GTK_RESPONSE_ACCEPT)
+  int child_count;
+  while (gtk_tree_view_row_expanded (view, tree_path)
+         && (child_count = gtk_tree_model_iter_n_children (model,
+                                                           &previous)) > 0)
     {
-      file_list = gtk_file_chooser_get_filenames (GTK_FILE_CHOOSER (dialog));
+      GtkTreeIter child;
+      gtk_tree_model_iter_nth_child (model, &child, &previous,
+                                     child_count - 1);
+      previous = child;
+
+      gtk_tree_path_free (tree_path);
+      tree_path = gtk_tree_model_get_path (model, &previous);
     }
 
-  gtk_widget_destroy (dialog);
+  gtk_tree_path_free (tree_path);
 
-  GSList *iter;
-  for (iter = file_list; iter != NULL; iter = g_slist_next (iter))
-    {
-      jws_config_window_add_file (win, iter->data);
-      g_free (iter->data);
-    }
-  g_slist_free (file_list);
+  *iter = previous;
+  return TRUE;
 }
 
+/* Moves the job for the row ahead of the others if it still has one, or
+ * loads its preview if it never had one or it was evicted.  */
 static void
-jws_config_window_add_file_for_iter_recurse (JwsConfigWindow *win,
-                                             const char *path,
-                                             GtkTreeIter *parent_iter)
+promote_preview_for_iter (JwsConfigWindow *win, GtkTreeIter *iter)
 {
   JwsConfigWindowPrivate *priv;
   priv = jws_config_window_get_instance_private (win);
 
-  GFile *file;
-  file = g_file_new_for_path (path);
-
-  GFileType file_type;
-  file_type = g_file_query_file_type (file, G_FILE_QUERY_INFO_NONE, NULL);
-
-  gchar *basename;
-  basename = g_file_get_basename (file);
-
-  /* This variable is redundant becuase I could just use path from the
-   * arguments list but I felt like doing it this way just in case path is
-   * formatted weirdly or something.  */
-  gchar *file_path;
-  file_path = g_file_get_path (file);
+  JwsPreviewJob *job = NULL;
+  GdkPixbuf *preview = NULL;
+  gboolean is_directory = FALSE;
+  gchar *path = NULL;
+  gtk_tree_model_get (GTK_TREE_MODEL (priv->tree_store), iter,
+                      PREVIEW_JOB_COLUMN, &job,
+                      PREVIEW_COLUMN, &preview,
+                      IS_DIRECTORY_COLUMN, &is_directory,
+                      PATH_COLUMN, &path,
+                      -1);
 
-  gchar *type_string = NULL;
+  /* A file without a preview or a job hasn't been drawn yet or had its
+   * preview evicted.  */
+  if (preview)
+    g_object_unref (preview);
+  else if (!job && !is_directory && path)
+    job = jws_config_window_request_preview (win, iter);
 
-  GtkTreeIter iter;
-  gtk_tree_store_append (priv->tree_store, &iter, parent_iter);
+  g_free (path);
 
-  if (file_type == G_FILE_TYPE_REGULAR)
+  if (job)
     {
-      type_string = jws_get_type_string (FALSE);
+      jws_preview_pool_set_priority (priv->preview_pool, job,
+                                     JWS_PREVIEW_PRIORITY_VISIBLE);
+      /* The array takes the reference.  */
+      g_ptr_array_add (priv->visible_preview_jobs, job);
+    }
+}
 
-      gtk_tree_store_set (priv->tree_store, &iter,
-                          PATH_COLUMN, file_path,
-                          NAME_COLUMN, basename,
-                          IS_DIRECTORY_COLUMN, FALSE,
-                          PREVIEW_COLUMN, NULL,
-                          -1);
+static gboolean
+update_preview_priorities (gpointer win)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (JWS_CONFIG_WINDOW (win));
 
-      GtkTreePath *as_path;
-      as_path = gtk_tree_model_get_path (GTK_TREE_MODEL (priv->tree_store),
-                                         &iter);
-      GtkTreeRowReference *row_ref;
-      row_ref = gtk_tree_row_reference_new (GTK_TREE_MODEL (priv->tree_store),
-                                            as_path);
-      gtk_tree_path_free (as_path);
+  priv->preview_priority_source = 0;
 
-      g_async_queue_push (priv->preview_queue, row_ref);
-    }
-  else if (file_type == G_FILE_TYPE_DIRECTORY)
+  /* Everything that was close to the screen goes back first.  Going
+   * backwards keeps them in the same order at the front of the normal
+   * queue.  */
+  for (int i = priv->visible_preview_jobs->len - 1; i >= 0; i--)
     {
-      type_string = jws_get_type_string (TRUE);
-
-
-      gtk_tree_store_set (priv->tree_store, &iter,
-                          PATH_COLUMN, file_path,
-                          NAME_COLUMN, basename,
-                          IS_DIRECTORY_COLUMN, TRUE,
-                          PREVIEW_COLUMN, NULL,
-                          -1);
+      jws_preview_pool_set_priority (priv->preview_pool,
+                                     g_ptr_array_index
+                                     (priv->visible_preview_jobs, i),
+                                     JWS_PREVIEW_PRIORITY_NORMAL);
+    }
+  g_ptr_array_set_size (priv->visible_preview_jobs, 0);
 
-      GFileEnumerator *enumerator;
-      enumerator = g_file_enumerate_children (file,
-                                              "*",
-                                              G_FILE_QUERY_INFO_NONE,
-                                              NULL,
-                                              NULL);
+  GtkTreeView *view = GTK_TREE_VIEW (priv->tree_view);
+  GtkTreeModel *model = GTK_TREE_MODEL (priv->tree_store);
 
-      if (enumerator)
-        {
-          GFile *child_file;
+  GtkTreePath *start_path;
+  GtkTreePath *end_path;
 
-          gboolean iter_err = TRUE;
-          iter_err = g_file_enumerator_iterate (enumerator,
-                                                NULL,
-                                                &child_file,
-                                                NULL,
-                                                NULL);
+  if (!gtk_tree_view_get_visible_range (view, &start_path, &end_path))
+    return G_SOURCE_REMOVE;
 
-          GList *dirent_list = NULL;
+  GtkTreeIter start_iter;
+  if (!gtk_tree_model_get_iter (model, &start_iter, start_path))
+    {
+      gtk_tree_path_free (start_path);
+      gtk_tree_path_free (end_path);
+      return G_SOURCE_REMOVE;
+    }
 
-          while (iter_err && child_file != NULL)
-            {
-              gchar *child_path;
-              child_path = g_file_get_path (child_file);
-              dirent_list = g_list_append (dirent_list, child_path);
-              /*jws_config_window_add_file_for_iter_recurse (win,*/
-                                                           /*child_path,*/
-                                                           /*&iter);*/
-              /*g_free (child_path);*/
-              iter_err = g_file_enumerator_iterate (enumerator,
-                                                    NULL,
-                                                    &child_file,
-                                                    NULL,
-                                                    NULL);
-            }
+  /* The rows on screen come first, in order.  */
+  GtkTreeIter iter = start_iter;
+  gboolean is_valid = TRUE;
+  while (is_valid)
+    {
+      promote_preview_for_iter (win, &iter);
 
-          dirent_list = g_list_sort (dirent_list, (GCompareFunc) g_strcmp0);
+      GtkTreePath *tree_path;
+      tree_path = gtk_tree_model_get_path (model, &iter);
+      gboolean is_last = (gtk_tree_path_compare (tree_path, end_path) >= 0);
+      gtk_tree_path_free (tree_path);
 
-          for (GList *list_iter = dirent_list;
-               list_iter;
-               list_iter = g_list_next (list_iter))
-            {
-              jws_config_window_add_file_for_iter_recurse (win,
-                                                           list_iter->data,
-                                                           &iter);
-            }
+      if (is_last)
+        break;
 
-          g_list_free_full (dirent_list, (GDestroyNotify) g_free);
-        }
-      g_object_unref (enumerator);
+      is_valid = get_next_visible_iter (view, model, &iter);
     }
 
-  g_object_unref (file);
-  g_free (type_string);
-  g_free (basename);
-  g_free (file_path);
-}
-
-void
-jws_config_window_add_file (JwsConfigWindow *win, const char *path)
-{
-  jws_config_window_add_file_for_iter_recurse (win, path, NULL);
-}
-
-gchar *
-jws_get_type_string (gboolean is_directory)
-{
-  gchar *type_string = NULL;
-  if (is_directory)
+  /* Then the ones right after, which is where people usually scroll to, and
+   * then the ones right before.  */
+  for (int i = 0;
+       is_valid && i < JWS_CONFIG_WINDOW_PREVIEW_LOOKAHEAD
+       && (is_valid = get_next_visible_iter (view, model, &iter));
+       i++)
     {
-      type_string = g_strdup (_("Directory"));
+      promote_preview_for_iter (win, &iter);
     }
-  else
+
+  iter = start_iter;
+  for (int i = 0;
+       i < JWS_CONFIG_WINDOW_PREVIEW_LOOKAHEAD
+       && get_previous_visible_iter (view, model, &iter);
+       i++)
     {
-      type_string = g_strdup (_("File"));
+      promote_preview_for_iter (win, &iter);
     }
-  return type_string;
+
+  gtk_tree_path_free (start_path);
+  gtk_tree_path_free (end_path);
+
+  return G_SOURCE_REMOVE;
 }
 
-static void
-destroy_row_reference (gpointer row_ref)
+static gboolean
+is_same_row (GtkTreeIter *a, GtkTreeIter *b)
 {
-  gtk_tree_row_reference_free (((GtkTreeRowReference *) row_ref));
+  return a->user_data == b->user_data;
 }
 
-static void *
-preview_thread_run (gpointer win)
+static void
+collect_preview_rows (EvictScan *scan,
+                      GtkTreeIter *parent,
+                      gboolean parent_expanded)
 {
-  JwsConfigWindowPrivate *priv;
-  priv = jws_config_window_get_instance_private (JWS_CONFIG_WINDOW (win));
-
-  GtkTreePath *tree_path;
   GtkTreeIter iter;
-
-  gchar *path;
-
-  while (!jws_config_window_get_should_exit_thread (JWS_CONFIG_WINDOW (win)))
+  gboolean has_row;
+  for (has_row = gtk_tree_model_iter_children (scan->model, &iter, parent);
+       has_row;
+       has_row = gtk_tree_model_iter_next (scan->model, &iter))
     {
-      GtkTreeRowReference *row_ref;
-      row_ref = g_async_queue_try_pop (priv->preview_queue);
+      gint index = -1;
+      if (parent_expanded)
+        {
+          index = scan->n_visible++;
+          if (is_same_row (&iter, &scan->start_iter))
+            scan->start_index = index;
+          if (is_same_row (&iter, &scan->end_iter))
+            scan->end_index = index;
+        }
+
+      GdkPixbuf *preview = NULL;
+      gtk_tree_model_get (scan->model, &iter,
+                          PREVIEW_COLUMN, &preview,
+                          -1);
+      if (preview)
+        {
+          EvictCandidate candidate;
+          candidate.iter = iter;
+          candidate.bytes = gdk_pixbuf_get_byte_length (preview);
+          candidate.distance = index;
+          g_array_append_val (scan->candidates, candidate);
+
+          scan->total_bytes += candidate.bytes;
+          g_object_unref (preview);
+        }
 
-      if (row_ref && gtk_tree_row_reference_valid (row_ref))
+      if (gtk_tree_model_iter_has_child (scan->model, &iter))
         {
-          tree_path = gtk_tree_row_reference_get_path (row_ref);
-          if (tree_path)
+          gboolean is_expanded = FALSE;
+          if (parent_expanded)
             {
-              gtk_tree_model_get_iter (GTK_TREE_MODEL (priv->tree_store),
-                                       &iter,
-                                       tree_path);
-              gtk_tree_model_get (GTK_TREE_MODEL (priv->tree_store),
-                                  &iter,
-                                  PATH_COLUMN, &path,
-                                  -1);
-              GdkPixbuf *preview_src = gdk_pixbuf_new_from_file (path,
-                                                                 NULL);
-              g_free (path);
-              if (preview_src)
-                {
-                  GdkPixbuf *preview;
-                  int height = JWS_CONFIG_WINDOW_PREVIEW_HEIGHT;
-                  preview =
-                    jws_create_scaled_pixbuf (preview_src,
-                                              -1,
-                                              height);
-                  g_object_unref (preview_src);
-                  /* I need to rewrite this part so that it uses something like
-                   * a mutex instead to make sure that it wasn't removed.  */
-                  if (gtk_tree_row_reference_valid (row_ref))
-                    {
-                      gtk_tree_store_set (priv->tree_store, &iter,
-                                          PREVIEW_COLUMN, preview,
-                                          -1);
-                    }
-                  g_object_unref (preview);
-                }
+              GtkTreePath *tree_path;
+              tree_path = gtk_tree_model_get_path (scan->model, &iter);
+              is_expanded = gtk_tree_view_row_expanded (scan->view,
+                                                        tree_path);
+              gtk_tree_path_free (tree_path);
             }
-          gtk_tree_row_reference_free (row_ref);
-          gtk_tree_path_free (tree_path);
+
+          collect_preview_rows (scan, &iter, is_expanded);
         }
     }
-  return NULL;
 }
 
-GdkPixbuf *
-jws_create_scaled_pixbuf (GdkPixbuf *src,
-                          int width,
-                          int height)
+/* Farthest first.  */
+static gint
+compare_evict_candidates (gconstpointer a, gconstpointer b)
 {
-  int src_width;
-  int src_height;
+  const EvictCandidate *first = a;
+  const EvictCandidate *second = b;
 
-  GdkPixbuf *dest = NULL;;
+  if (first->distance == second->distance)
+    return 0;
+  return (first->distance > second->distance) ? -1 : 1;
+}
 
-  if (src)
-    {
-      src_width = gdk_pixbuf_get_width (src);
-      src_height = gdk_pixbuf_get_height (src);
+static gboolean
+evict_offscreen_previews (gpointer win)
+{
+  JwsConfigWindowPrivate *priv;
+  priv = jws_config_window_get_instance_private (JWS_CONFIG_WINDOW (win));
 
-      int dest_width = src_width;
-      int dest_height = src_height;
+  priv->preview_evict_source = 0;
 
-      if (width > 0)
-        {
-          dest_width = width;
-          if (height <= 0)
-            {
-              dest_height = width * src_height / src_width;
-            }
-        }
-      if (height > 0)
-        {
-          dest_height = height;
-          if (width <= 0)
-            {
-              dest_width = height * src_width / src_height;
-            }
-        }
+  EvictScan scan;
+  scan.view = GTK_TREE_VIEW (priv->tree_view);
+  scan.model = GTK_TREE_MODEL (priv->tree_store);
+  scan.candidates = g_array_new (FALSE, FALSE, sizeof (EvictCandidate));
+  scan.total_bytes = 0;
+  scan.n_visible = 0;
+  scan.start_index = 0;
+  scan.end_index = 0;
 
-      dest = gdk_pixbuf_scale_simple (src, dest_width, dest_height,
-                                      GDK_INTERP_HYPER);
+  /* No row is ever the same as an empty iter.  */
+  scan.start_iter = (GtkTreeIter) { 0 };
+  scan.end_iter = (GtkTreeIter) { 0 };
 
+  GtkTreePath *start_path;
+  GtkTreePath *end_path;
+  if (gtk_tree_view_get_visible_range (scan.view, &start_path, &end_path))
+    {
+      gtk_tree_model_get_iter (scan.model, &scan.start_iter, start_path);
+      gtk_tree_model_get_iter (scan.model, &scan.end_iter, end_path);
+      gtk_tree_path_free (start_path);
+      gtk_tree_path_free (end_path);
     }
 
-  return dest;
-}
+  collect_preview_rows (&scan, NULL, TRUE);
 
-gboolean
-jws_config_window_get_should_exit_thread (JwsConfigWindow *win)
-{
-  gboolean should_exit = FALSE;
-  if (win)
+  /* The same rows that get their previews first are never evicted, so
+   * scrolling a little never loses anything.  */
+  gint keep_start = scan.start_index - JWS_CONFIG_WINDOW_PREVIEW_LOOKAHEAD;
+  gint keep_end = scan.end_index + JWS_CONFIG_WINDOW_PREVIEW_LOOKAHEAD;
+
+  guint n_kept = 0;
+  for (guint i = 0; i < scan.candidates->len; i++)
     {
-      JwsConfigWindowPrivate *priv;
-      priv = jws_config_window_get_instance_private (win);
+      EvictCandidate *candidate;
+      candidate = &g_array_index (scan.candidates, EvictCandidate, i);
+
+      gint index = candidate->distance;
+      if (index < 0)
+        candidate->distance = G_MAXINT;
+      else if (index < keep_start)
+        candidate->distance = keep_start - index;
+      else if (index > keep_end)
+        candidate->distance = index - keep_end;
+      else
+        continue;
 
-      g_mutex_lock (&priv->should_exit_thread_mutex);
-      should_exit = priv->should_exit_thread;
-      g_mutex_unlock (&priv->should_exit_thread_mutex);
+      g_array_index (scan.candidates, EvictCandidate, n_kept++) = *candidate;
     }
+  g_array_set_size (scan.candidates, n_kept);
 
-  return should_exit;
-}
+  g_array_sort (scan.candidates, compare_evict_candidates);
 
-void
-jws_config_window_set_should_exit_thread (JwsConfigWindow *win,
-                                          gboolean should_exit_thread)
-{
-  if (win)
+  /* Going a quarter below the budget means this doesn't run again for every
+   * new preview once the tree is full.  */
+  gsize target = priv->preview_budget - priv->preview_budget / 4;
+
+  for (guint i = 0;
+       i < scan.candidates->len && scan.total_bytes > target;
+       i++)
     {
-      JwsConfigWindowPrivate *priv;
-      priv = jws_config_window_get_instance_private (win);
-      
-      g_mutex_lock (&priv->should_exit_thread_mutex);
-      priv->should_exit_thread = should_exit_thread;
-      g_mutex_unlock (&priv->should_exit_thread_mutex);
+      EvictCandidate *candidate;
+      candidate = &g_array_index (scan.candidates, EvictCandidate, i);
+
+      /* A row that is still waiting for its good preview doesn't need it
+       * anymore, it gets one again from the cache or a new job.  */
+      JwsPreviewJob *job = NULL;
+      gtk_tree_model_get (scan.model, &candidate->iter,
+                          PREVIEW_JOB_COLUMN, &job,
+                          -1);
+      if (job)
+        {
+          jws_preview_pool_cancel_job (priv->preview_pool, job);
+          jws_preview_job_unref (job);
+        }
+
+      gtk_tree_store_set (priv->tree_store, &candidate->iter,
+                          PREVIEW_COLUMN, NULL,
+                          PREVIEW_JOB_COLUMN, NULL,
+                          -1);
+      scan.total_bytes -= candidate->bytes;
     }
+
+  priv->preview_bytes = scan.total_bytes;
+
+  g_array_unref (scan.candidates);
+
+  return G_SOURCE_REMOVE;
 }
 
 void
@@ -902,11 +3162,13 @@ on_row_activated (GtkTreeView *view,
   gtk_tree_model_get_iter (model, &iter, path);
 
   gboolean is_directory;
+  gboolean is_placeholder;
   gtk_tree_model_get (model, &iter,
                       IS_DIRECTORY_COLUMN, &is_directory,
+                      IS_PLACEHOLDER_COLUMN, &is_placeholder,
                       -1);
 
-  if (!is_directory)
+  if (!is_directory && !is_placeholder)
     jws_config_window_show_image_for_row (win, row_ref);
 }
 
@@ -1004,11 +3266,18 @@ jws_config_window_get_next_image_row (JwsConfigWindow *win,
       gtk_tree_model_get_iter (tree_model, &iter, new_path);
 
       gboolean is_directory;
+      gboolean is_placeholder;
       gtk_tree_model_get (tree_model, &iter,
                           IS_DIRECTORY_COLUMN, &is_directory,
+                          IS_PLACEHOLDER_COLUMN, &is_placeholder,
                           -1);
 
-      if (!is_directory)
+      /* The next image could be inside a directory that was never expanded,
+       * so it has to be listed to go into it.  */
+      if (is_directory)
+        jws_config_window_list_directory_now (win, &iter);
+
+      if (!is_directory && !is_placeholder)
         {
           found_new_path = TRUE;
         }
@@ -1060,11 +3329,18 @@ jws_config_window_get_previous_image_row (JwsConfigWindow *win,
       gtk_tree_model_get_iter (tree_model, &iter, new_path);
 
       gboolean is_directory;
+      gboolean is_placeholder;
       gtk_tree_model_get (tree_model, &iter,
                           IS_DIRECTORY_COLUMN, &is_directory,
+                          IS_PLACEHOLDER_COLUMN, &is_placeholder,
                           -1);
+
+      /* The next image could be inside a directory that was never expanded,
+       * so it has to be listed to go into it.  */
+      if (is_directory)
+        jws_config_window_list_directory_now (win, &iter);
       
-      if (!is_directory)
+      if (!is_directory && !is_placeholder)
         {
           found_new_path = TRUE;
         }
@@ -1151,6 +3427,9 @@ on_remove_button_clicked (JwsConfigWindow *win)
           tree_path = gtk_tree_row_reference_get_path (slist_iter->data);
 
           gtk_tree_model_get_iter (as_model, &iter, tree_path);
+          jws_config_window_cancel_scans_for_iter (win, &iter);
+          jws_config_window_cancel_previews_for_iter (win, &iter);
+          jws_config_window_release_previews_for_iter (win, &iter);
           gtk_tree_store_remove (priv->tree_store, &iter);
 
           gtk_tree_path_free (tree_path);
@@ -1446,12 +3725,28 @@ jws_config_window_set_gui_from_info (JwsConfigWindow *win)
   gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (priv->randomize_button),
                                 randomize_order);
 
+  /* Keep the previews of the config being replaced for next time before the
+   * tree is cleared, then use the ones saved for the new one.  */
+  jws_config_window_save_atlas (win);
+  jws_config_window_open_atlas (win, priv->current_file);
+  jws_config_window_save_index (win);
+
+  jws_config_window_cancel_all_scans (win);
+  jws_config_window_cancel_all_previews (win);
+
+  /* Clearing a big tree with the view attached removes the rows from the
+   * view one at a time.  */
+  jws_config_window_begin_bulk_load (win);
+
   gtk_tree_store_clear (priv->tree_store);
+  priv->preview_bytes = 0;
   GList *iter;
   for (iter = file_list; iter; iter = g_list_next (iter))
     {
       jws_config_window_add_file (win, iter->data);
     }
+
+  jws_config_window_end_bulk_load (win);
 }
 
 void
@@ -1805,11 +4100,19 @@ on_tree_view_button_press (GtkWidget *tree_view,
   GtkTreeModel *model;
   model = GTK_TREE_MODEL (priv->tree_store);
 
+  GtkTreeIter iter;
+  gtk_tree_model_get_iter (model, &iter, tree_path);
+
+  /* There's nothing to do with a placeholder.  */
+  if (jws_config_window_is_placeholder (win, &iter))
+    {
+      gtk_tree_path_free (tree_path);
+      return FALSE;
+    }
+
   GtkTreeRowReference *row_ref;
   row_ref = gtk_tree_row_reference_new (model,
                                         tree_path);
-  GtkTreeIter iter;
-  gtk_tree_model_get_iter (model, &iter, tree_path);
 
   GtkWidget *item_menu;
   item_menu = gtk_menu_new ();
@@ -2036,6 +4339,9 @@ jws_config_window_remove_row (JwsConfigWindow *win,
   gtk_tree_model_get_iter (GTK_TREE_MODEL (priv->tree_store), &iter,
                            tree_path);
 
+  jws_config_window_cancel_scans_for_iter (win, &iter);
+  jws_config_window_cancel_previews_for_iter (win, &iter);
+  jws_config_window_release_previews_for_iter (win, &iter);
   gtk_tree_store_remove (priv->tree_store, &iter);
 
   gtk_tree_path_free (tree_path);
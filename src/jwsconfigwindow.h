@@ -23,6 +23,7 @@ along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
 #include <gtk/gtk.h>
 #include "jwsconfigapplication.h"
 #include "jwsinfo.h"
+#include "jwspreview.h"
 
 #define JWS_TYPE_CONFIG_WINDOW (jws_config_window_get_type ())
 #define JWS_CONFIG_WINDOW(obj) \
@@ -31,6 +32,17 @@ along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #define JWS_CONFIG_WINDOW_PREVIEW_HEIGHT 100
 
+/* In megabytes, enough for well over a thousand previews.  */
+#define JWS_CONFIG_WINDOW_DEFAULT_MEMORY_CACHE_SIZE 128
+
+/* In megabytes, how much the previews shown in the tree can use before rows
+ * far from the screen let go of theirs.  */
+#define JWS_CONFIG_WINDOW_DEFAULT_TREE_MEMORY 64
+
+/* How many rows above and below the visible ones also get their previews
+ * loaded first, so scrolling a little doesn't show empty rows.  */
+#define JWS_CONFIG_WINDOW_PREVIEW_LOOKAHEAD 32
+
 typedef struct _JwsConfigWindow JwsConfigWindow;
 typedef struct _JwsConfigWindowClass JwsConfigWindowClass;
 
@@ -48,13 +60,6 @@ void
 jws_config_window_set_current_file (JwsConfigWindow *win,
                                     const gchar *file);
 
-gboolean
-jws_config_window_get_should_exit_thread (JwsConfigWindow *win);
-
-void
-jws_config_window_set_should_exit_thread (JwsConfigWindow *win,
-                                          gboolean should_exit_thread);
-
 void
 jws_config_window_show_optional_side_buttons (JwsConfigWindow *win,
                                               gboolean visible);
@@ -79,15 +84,6 @@ jws_config_window_add_directory_selection (JwsConfigWindow *win);
 gchar *
 jws_get_type_string (gboolean is_directory);
 
-/* If width or height are positive, the pixbuf will have the dimension.  If one
- * of them are not set, that dimension will be scaled to the other.  If neither
- * are set, it will be the dimensions of the original.  Returns a new pixbuf
- * which must freed with g_object_free.  */
-GdkPixbuf *
-jws_create_scaled_pixbuf (GdkPixbuf *src,
-                          int width,
-                          int height);
-
 /* Free with g_free ().  */
 gchar *
 jws_config_window_get_path_for_row (JwsConfigWindow *win,
@@ -0,0 +1,430 @@
+/* jwsexif.c - reading thumbnails embedded in JPEG files
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "jwsexif.h"
+
+#include <string.h>
+
+/* How far into the file to look for the frame header.  Segments are skipped
+ * rather than read, except for APP1, which can't be longer than 64 KiB.  */
+#define JWS_EXIF_READ_SIZE (128 * 1024)
+
+/* How far the shape of the thumbnail can be from the image's, as a fraction
+ * of the image's aspect ratio.  Rounding a 160 pixel wide thumbnail is well
+ * within this, but bars added to fit 4:3 aren't.  */
+#define JWS_EXIF_MAX_ASPECT_ERROR 0.03
+
+#define JWS_EXIF_TAG_EXIF_IFD 0x8769
+#define JWS_EXIF_TAG_PIXEL_X_DIMENSION 0xA002
+#define JWS_EXIF_TAG_PIXEL_Y_DIMENSION 0xA003
+#define JWS_EXIF_TAG_THUMBNAIL_OFFSET 0x0201
+#define JWS_EXIF_TAG_THUMBNAIL_LENGTH 0x0202
+
+#define JWS_EXIF_TYPE_SHORT 3
+
+typedef struct _JwsExifTiff JwsExifTiff;
+
+/* The TIFF structure inside the APP1 segment, all offsets are from data.  */
+struct _JwsExifTiff
+{
+  const guchar *data;
+  gsize length;
+  gboolean is_big_endian;
+};
+
+typedef struct _JwsExifInfo JwsExifInfo;
+
+/* What was found in the first part of the file.  Sizes are 0 if not found.  */
+struct _JwsExifInfo
+{
+  const guchar *thumbnail;
+  gsize thumbnail_length;
+
+  /* From the frame header, which is always right.  */
+  int frame_width;
+  int frame_height;
+
+  /* From the EXIF data, which editors don't always update.  */
+  int exif_width;
+  int exif_height;
+};
+
+static gboolean
+jws_exif_read_u16 (JwsExifTiff *tiff, gsize offset, guint *value);
+
+static gboolean
+jws_exif_read_u32 (JwsExifTiff *tiff, gsize offset, guint32 *value);
+
+/* Reads the value of a SHORT or LONG entry.  */
+static gboolean
+jws_exif_read_entry_value (JwsExifTiff *tiff, gsize entry, guint32 *value);
+
+/* Returns the number of entries in the IFD at offset or -1.  */
+static int
+jws_exif_get_ifd_count (JwsExifTiff *tiff, guint32 offset);
+
+static void
+jws_exif_parse_tiff (JwsExifTiff *tiff, JwsExifInfo *info);
+
+/* Reads exactly count bytes, returns FALSE at the end of the file.  */
+static gboolean
+jws_exif_read_bytes (GInputStream *stream,
+                     guchar *buffer,
+                     gsize count,
+                     GCancellable *cancellable);
+
+/* Walks the segments of the JPEG in stream, reading only the APP1 segment
+ * and the frame header.  The thumbnail in info points into *app1, which
+ * should be freed with g_free ().  */
+static void
+jws_exif_read_jpeg (GInputStream *stream,
+                    GCancellable *cancellable,
+                    JwsExifInfo *info,
+                    guchar **app1);
+
+static GdkPixbuf *
+jws_exif_decode (const guchar *data, gsize length);
+
+static gboolean
+jws_exif_read_u16 (JwsExifTiff *tiff, gsize offset, guint *value)
+{
+  if (offset + 2 > tiff->length)
+    return FALSE;
+
+  const guchar *bytes = tiff->data + offset;
+  if (tiff->is_big_endian)
+    *value = (bytes[0] << 8) | bytes[1];
+  else
+    *value = (bytes[1] << 8) | bytes[0];
+
+  return TRUE;
+}
+
+static gboolean
+jws_exif_read_u32 (JwsExifTiff *tiff, gsize offset, guint32 *value)
+{
+  if (offset + 4 > tiff->length)
+    return FALSE;
+
+  const guchar *bytes = tiff->data + offset;
+  if (tiff->is_big_endian)
+    *value = ((guint32) bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8)
+      | bytes[3];
+  else
+    *value = ((guint32) bytes[3] << 24) | (bytes[2] << 16) | (bytes[1] << 8)
+      | bytes[0];
+
+  return TRUE;
+}
+
+static gboolean
+jws_exif_read_entry_value (JwsExifTiff *tiff, gsize entry, guint32 *value)
+{
+  guint type;
+  if (!jws_exif_read_u16 (tiff, entry + 2, &type))
+    return FALSE;
+
+  /* A single SHORT sits in the first half of the value field.  */
+  if (type == JWS_EXIF_TYPE_SHORT)
+    {
+      guint short_value;
+      if (!jws_exif_read_u16 (tiff, entry + 8, &short_value))
+        return FALSE;
+      *value = short_value;
+      return TRUE;
+    }
+
+  return jws_exif_read_u32 (tiff, entry + 8, value);
+}
+
+static int
+jws_exif_get_ifd_count (JwsExifTiff *tiff, guint32 offset)
+{
+  guint count;
+  if (offset == 0 || !jws_exif_read_u16 (tiff, offset, &count))
+    return -1;
+
+  if (offset + 2 + (gsize) count * 12 > tiff->length)
+    return -1;
+
+  return count;
+}
+
+static void
+jws_exif_parse_tiff (JwsExifTiff *tiff, JwsExifInfo *info)
+{
+  if (tiff->length < 8)
+    return;
+
+  if (memcmp (tiff->data, "MM", 2) == 0)
+    tiff->is_big_endian = TRUE;
+  else if (memcmp (tiff->data, "II", 2) == 0)
+    tiff->is_big_endian = FALSE;
+  else
+    return;
+
+  guint magic;
+  guint32 ifd0;
+  if (!jws_exif_read_u16 (tiff, 2, &magic) || magic != 42
+      || !jws_exif_read_u32 (tiff, 4, &ifd0))
+    return;
+
+  int count;
+  count = jws_exif_get_ifd_count (tiff, ifd0);
+  if (count < 0)
+    return;
+
+  guint32 exif_ifd = 0;
+  for (int i = 0; i < count; i++)
+    {
+      gsize entry = ifd0 + 2 + (gsize) i * 12;
+      guint tag;
+      jws_exif_read_u16 (tiff, entry, &tag);
+      if (tag == JWS_EXIF_TAG_EXIF_IFD)
+        jws_exif_read_entry_value (tiff, entry, &exif_ifd);
+    }
+
+  /* The dimensions are only a fallback for when the frame header is too far
+   * in, so it's fine if they're missing.  */
+  int exif_count;
+  exif_count = jws_exif_get_ifd_count (tiff, exif_ifd);
+  for (int i = 0; i < exif_count; i++)
+    {
+      gsize entry = exif_ifd + 2 + (gsize) i * 12;
+      guint tag;
+      guint32 value = 0;
+      jws_exif_read_u16 (tiff, entry, &tag);
+      if (tag == JWS_EXIF_TAG_PIXEL_X_DIMENSION
+          && jws_exif_read_entry_value (tiff, entry, &value))
+        info->exif_width = MIN (value, (guint32) G_MAXINT);
+      else if (tag == JWS_EXIF_TAG_PIXEL_Y_DIMENSION
+               && jws_exif_read_entry_value (tiff, entry, &value))
+        info->exif_height = MIN (value, (guint32) G_MAXINT);
+    }
+
+  /* IFD1, which describes the thumbnail, comes right after IFD0.  */
+  guint32 ifd1;
+  if (!jws_exif_read_u32 (tiff, ifd0 + 2 + (gsize) count * 12, &ifd1))
+    return;
+
+  int thumbnail_count;
+  thumbnail_count = jws_exif_get_ifd_count (tiff, ifd1);
+
+  guint32 thumbnail_offset = 0;
+  guint32 thumbnail_length = 0;
+  for (int i = 0; i < thumbnail_count; i++)
+    {
+      gsize entry = ifd1 + 2 + (gsize) i * 12;
+      guint tag;
+      jws_exif_read_u16 (tiff, entry, &tag);
+      if (tag == JWS_EXIF_TAG_THUMBNAIL_OFFSET)
+        jws_exif_read_entry_value (tiff, entry, &thumbnail_offset);
+      else if (tag == JWS_EXIF_TAG_THUMBNAIL_LENGTH)
+        jws_exif_read_entry_value (tiff, entry, &thumbnail_length);
+    }
+
+  if (thumbnail_offset == 0 || thumbnail_length == 0
+      || (gsize) thumbnail_offset + thumbnail_length > tiff->length)
+    return;
+
+  info->thumbnail = tiff->data + thumbnail_offset;
+  info->thumbnail_length = thumbnail_length;
+}
+
+static gboolean
+jws_exif_read_bytes (GInputStream *stream,
+                     guchar *buffer,
+                     gsize count,
+                     GCancellable *cancellable)
+{
+  gsize length = 0;
+  return g_input_stream_read_all (stream, buffer, count, &length, cancellable,
+                                  NULL)
+    && length == count;
+}
+
+static void
+jws_exif_read_jpeg (GInputStream *stream,
+                    GCancellable *cancellable,
+                    JwsExifInfo *info,
+                    guchar **app1)
+{
+  /* Most files listed aren't JPEGs, so they're turned away after two
+   * bytes.  */
+  guchar header[4];
+  if (!jws_exif_read_bytes (stream, header, 2, cancellable)
+      || header[0] != 0xFF || header[1] != 0xD8)
+    return;
+
+  gsize position = 2;
+
+  while (position < JWS_EXIF_READ_SIZE)
+    {
+      if (!jws_exif_read_bytes (stream, header, 2, cancellable)
+          || header[0] != 0xFF)
+        return;
+
+      /* Markers can be padded with any number of 0xFF bytes.  */
+      while (header[1] == 0xFF)
+        {
+          if (!jws_exif_read_bytes (stream, header + 1, 1, cancellable))
+            return;
+          position++;
+        }
+
+      guchar marker = header[1];
+
+      /* The image data starts here, there's nothing more to find.  */
+      if (marker == 0xDA || marker == 0xD9)
+        return;
+
+      if (!jws_exif_read_bytes (stream, header + 2, 2, cancellable))
+        return;
+
+      gsize segment_length = (header[2] << 8) | header[3];
+      if (segment_length < 2)
+        return;
+
+      gsize payload_length = segment_length - 2;
+
+      if (marker == 0xE1 && !*app1 && payload_length > 6)
+        {
+          *app1 = g_malloc (payload_length);
+          if (!jws_exif_read_bytes (stream, *app1, payload_length,
+                                    cancellable))
+            return;
+
+          if (memcmp (*app1, "Exif\0\0", 6) == 0)
+            {
+              JwsExifTiff tiff = {*app1 + 6, payload_length - 6, FALSE};
+              jws_exif_parse_tiff (&tiff, info);
+            }
+          else
+            {
+              /* Probably XMP, the EXIF data may still come after it.  */
+              g_clear_pointer (app1, g_free);
+            }
+        }
+      /* Any start of frame marker, except for the ones that aren't.  */
+      else if (marker >= 0xC0 && marker <= 0xCF
+               && marker != 0xC4 && marker != 0xC8 && marker != 0xCC
+               && payload_length >= 5)
+        {
+          guchar frame[5];
+          if (jws_exif_read_bytes (stream, frame, 5, cancellable))
+            {
+              info->frame_height = (frame[1] << 8) | frame[2];
+              info->frame_width = (frame[3] << 8) | frame[4];
+            }
+          return;
+        }
+      else if (payload_length > 0
+               && g_input_stream_skip (stream, payload_length, cancellable,
+                                       NULL) != (gssize) payload_length)
+        {
+          return;
+        }
+
+      position += 2 + segment_length;
+    }
+}
+
+static GdkPixbuf *
+jws_exif_decode (const guchar *data, gsize length)
+{
+  GdkPixbufLoader *loader;
+  loader = gdk_pixbuf_loader_new_with_type ("jpeg", NULL);
+  if (!loader)
+    return NULL;
+
+  gboolean is_valid;
+  is_valid = gdk_pixbuf_loader_write (loader, data, length, NULL);
+  if (is_valid)
+    is_valid = gdk_pixbuf_loader_close (loader, NULL);
+  else
+    gdk_pixbuf_loader_close (loader, NULL);
+
+  GdkPixbuf *pixbuf = NULL;
+  if (is_valid)
+    pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+  if (pixbuf)
+    g_object_ref (pixbuf);
+
+  g_object_unref (loader);
+
+  return pixbuf;
+}
+
+GdkPixbuf *
+jws_exif_load_thumbnail (const gchar *path,
+                         int min_height,
+                         GCancellable *cancellable)
+{
+  g_return_val_if_fail (path != NULL, NULL);
+
+  GFile *file;
+  file = g_file_new_for_path (path);
+
+  GFileInputStream *stream;
+  stream = g_file_read (file, cancellable, NULL);
+  g_object_unref (file);
+
+  if (!stream)
+    return NULL;
+
+  /* The segment headers are read a few bytes at a time, and skipping within
+   * the buffer saves a seek for the small segments.  */
+  GInputStream *buffered;
+  buffered = g_buffered_input_stream_new (G_INPUT_STREAM (stream));
+  g_object_unref (stream);
+
+  JwsExifInfo info;
+  memset (&info, 0, sizeof (JwsExifInfo));
+
+  guchar *app1 = NULL;
+  jws_exif_read_jpeg (buffered, cancellable, &info, &app1);
+  g_object_unref (buffered);
+
+  int image_width = info.frame_width ? info.frame_width : info.exif_width;
+  int image_height = info.frame_height ? info.frame_height : info.exif_height;
+
+  GdkPixbuf *thumbnail = NULL;
+
+  /* Without the size of the image there's no telling if the thumbnail has
+   * bars, so it isn't used.  */
+  if (info.thumbnail && image_width > 0 && image_height > 0)
+    thumbnail = jws_exif_decode (info.thumbnail, info.thumbnail_length);
+
+  g_free (app1);
+
+  if (!thumbnail)
+    return NULL;
+
+  int width = gdk_pixbuf_get_width (thumbnail);
+  int height = gdk_pixbuf_get_height (thumbnail);
+
+  double image_aspect = (double) image_width / image_height;
+  double aspect = (double) width / height;
+
+  if (height < min_height
+      || ABS (aspect - image_aspect) > image_aspect * JWS_EXIF_MAX_ASPECT_ERROR)
+    g_clear_object (&thumbnail);
+
+  return thumbnail;
+}
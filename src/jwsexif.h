@@ -0,0 +1,39 @@
+/* jwsexif.h - header for reading thumbnails embedded in JPEG files
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef JWSEXIF_H
+#define JWSEXIF_H
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gio/gio.h>
+
+/* Cameras and most photo editors put a small JPEG thumbnail in the EXIF data
+ * at the start of the file.  Reading it only takes the first few kilobytes of
+ * the file and decoding something tiny, instead of the whole image.  */
+
+/* Returns the thumbnail embedded in the JPEG file at path if it is at least
+ * min_height pixels high and has the same shape as the image, so it isn't
+ * letterboxed.  Returns NULL if there isn't one like that or the file isn't a
+ * JPEG with EXIF data.  Free the result with g_object_unref ().  */
+GdkPixbuf *
+jws_exif_load_thumbnail (const gchar *path,
+                         int min_height,
+                         GCancellable *cancellable);
+
+#endif /* JWSEXIF_H */
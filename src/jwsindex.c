@@ -0,0 +1,441 @@
+/* jwsindex.c - the index of directories that were listed
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "jwsindex.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "jwsscan.h"
+
+#define JWS_INDEX_MAGIC "JWSINDEX"
+
+/* Bump this whenever the format or the order of the listings changes.
+ * GVariant data is in native byte order, so an index from a machine with
+ * the other order is thrown away too.  */
+#define JWS_INDEX_VERSION 4
+
+/* The magic, the version, then for each directory its path, its
+ * modification time, when it was last used and its children, each a name,
+ * whether it's a directory, its modification time, its device and its
+ * inode.  */
+#define JWS_INDEX_FORMAT "(sua(sxxa(sbxtt)))"
+
+/* Listings that haven't been used for this long, in seconds, are dropped
+ * when the index is saved, so directories that are gone or no longer in any
+ * config don't stay in it forever.  */
+#define JWS_INDEX_MAX_AGE (30 * 24 * 60 * 60)
+
+/* A listing that is used again is only marked as used if it's been at least
+ * this long, in seconds, so looking things up doesn't make the index be
+ * written again every time.  */
+#define JWS_INDEX_USE_INTERVAL (24 * 60 * 60)
+
+typedef struct _JwsIndexChild JwsIndexChild;
+
+struct _JwsIndexChild
+{
+  gchar *name;
+  gboolean is_directory;
+  /* Seconds since the epoch.  */
+  gint64 mtime;
+  guint64 device;
+  guint64 inode;
+};
+
+typedef struct _JwsIndexDirectory JwsIndexDirectory;
+
+struct _JwsIndexDirectory
+{
+  /* Microseconds since the epoch.  */
+  gint64 mtime;
+  /* Seconds since the epoch.  */
+  gint64 last_used;
+  /* JwsIndexChilds, sorted.  */
+  GArray *children;
+};
+
+struct _JwsIndex
+{
+  gint ref_count;
+
+  /* Protects everything below.  */
+  GMutex mutex;
+  /* Maps directory paths to JwsIndexDirectorys.  */
+  GHashTable *directories;
+  /* Whether anything changed since the index was loaded or saved.  */
+  gboolean is_dirty;
+};
+
+static JwsIndexDirectory *
+jws_index_directory_new (gint64 mtime, gint64 last_used);
+
+static void
+jws_index_directory_free (JwsIndexDirectory *directory);
+
+static void
+jws_index_child_clear (JwsIndexChild *child);
+
+gchar *
+jws_index_get_default_file ()
+{
+  return g_build_filename (g_get_user_cache_dir (),
+                           "jws-config",
+                           "directories.index",
+                           NULL);
+}
+
+JwsIndex *
+jws_index_new ()
+{
+  JwsIndex *index;
+  index = g_new0 (JwsIndex, 1);
+
+  index->ref_count = 1;
+  g_mutex_init (&index->mutex);
+  index->directories = g_hash_table_new_full (g_str_hash,
+                                              g_str_equal,
+                                              g_free,
+                                              (GDestroyNotify)
+                                              jws_index_directory_free);
+  index->is_dirty = FALSE;
+
+  return index;
+}
+
+JwsIndex *
+jws_index_load (const gchar *file, GError **err)
+{
+  g_return_val_if_fail (file != NULL, NULL);
+
+  GMappedFile *mapped_file;
+  mapped_file = g_mapped_file_new (file, FALSE, err);
+  if (!mapped_file)
+    return NULL;
+
+  GBytes *bytes;
+  bytes = g_mapped_file_get_bytes (mapped_file);
+  g_mapped_file_unref (mapped_file);
+
+  /* Not trusted, so a damaged file reads as empty values instead of
+   * crashing.  */
+  GVariant *variant;
+  variant = g_variant_new_from_bytes (G_VARIANT_TYPE (JWS_INDEX_FORMAT),
+                                      bytes,
+                                      FALSE);
+  g_variant_ref_sink (variant);
+  g_bytes_unref (bytes);
+
+  const gchar *magic;
+  guint32 version;
+  GVariantIter *directory_iter;
+  g_variant_get (variant, "(&sua(sxxa(sbxtt)))",
+                 &magic, &version, &directory_iter);
+
+  if (strcmp (magic, JWS_INDEX_MAGIC) != 0
+      || version != JWS_INDEX_VERSION)
+    {
+      g_set_error (err,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_DATA,
+                   "Directory index %s is not valid.",
+                   file);
+      g_variant_iter_free (directory_iter);
+      g_variant_unref (variant);
+      return NULL;
+    }
+
+  JwsIndex *index;
+  index = jws_index_new ();
+
+  const gchar *path;
+  gint64 mtime;
+  gint64 last_used;
+  GVariantIter *child_iter;
+  while (g_variant_iter_loop (directory_iter, "(&sxxa(sbxtt))",
+                              &path, &mtime, &last_used, &child_iter))
+    {
+      JwsIndexDirectory *directory;
+      directory = jws_index_directory_new (mtime, last_used);
+
+      const gchar *name;
+      gboolean is_directory;
+      gint64 child_mtime;
+      guint64 device;
+      guint64 inode;
+      while (g_variant_iter_loop (child_iter, "(&sbxtt)",
+                                  &name, &is_directory, &child_mtime,
+                                  &device, &inode))
+        {
+          JwsIndexChild child;
+          child.name = g_strdup (name);
+          child.is_directory = is_directory;
+          child.mtime = child_mtime;
+          child.device = device;
+          child.inode = inode;
+          g_array_append_val (directory->children, child);
+        }
+
+      g_hash_table_replace (index->directories, g_strdup (path), directory);
+    }
+
+  g_variant_iter_free (directory_iter);
+  g_variant_unref (variant);
+
+  return index;
+}
+
+JwsIndex *
+jws_index_ref (JwsIndex *index)
+{
+  g_return_val_if_fail (index != NULL, NULL);
+
+  g_atomic_int_inc (&index->ref_count);
+  return index;
+}
+
+void
+jws_index_unref (JwsIndex *index)
+{
+  if (!index || !g_atomic_int_dec_and_test (&index->ref_count))
+    return;
+
+  g_hash_table_unref (index->directories);
+  g_mutex_clear (&index->mutex);
+  g_free (index);
+}
+
+static JwsIndexDirectory *
+jws_index_directory_new (gint64 mtime, gint64 last_used)
+{
+  JwsIndexDirectory *directory;
+  directory = g_new (JwsIndexDirectory, 1);
+
+  directory->mtime = mtime;
+  directory->last_used = last_used;
+  directory->children = g_array_new (FALSE, FALSE, sizeof (JwsIndexChild));
+  g_array_set_clear_func (directory->children,
+                          (GDestroyNotify) jws_index_child_clear);
+
+  return directory;
+}
+
+static void
+jws_index_directory_free (JwsIndexDirectory *directory)
+{
+  if (!directory)
+    return;
+
+  g_array_unref (directory->children);
+  g_free (directory);
+}
+
+static void
+jws_index_child_clear (JwsIndexChild *child)
+{
+  g_free (child->name);
+}
+
+GPtrArray *
+jws_index_lookup (JwsIndex *index, const gchar *path, gint64 mtime)
+{
+  g_return_val_if_fail (index != NULL, NULL);
+  g_return_val_if_fail (path != NULL, NULL);
+
+  GPtrArray *entries = NULL;
+
+  g_mutex_lock (&index->mutex);
+
+  JwsIndexDirectory *directory;
+  directory = g_hash_table_lookup (index->directories, path);
+
+  if (directory && directory->mtime == mtime)
+    {
+      gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+      if (now - directory->last_used >= JWS_INDEX_USE_INTERVAL)
+        {
+          directory->last_used = now;
+          index->is_dirty = TRUE;
+        }
+
+      entries = g_ptr_array_new_full (directory->children->len,
+                                      (GDestroyNotify) jws_scan_entry_free);
+
+      for (guint i = 0; i < directory->children->len; i++)
+        {
+          JwsIndexChild *child;
+          child = &g_array_index (directory->children, JwsIndexChild, i);
+
+          JwsScanEntry *entry;
+          entry = g_new0 (JwsScanEntry, 1);
+          entry->path = g_build_filename (path, child->name, NULL);
+          entry->name = g_strdup (child->name);
+          entry->is_directory = child->is_directory;
+          entry->mtime = child->mtime;
+          entry->device = child->device;
+          entry->inode = child->inode;
+          entry->parent = -1;
+
+          g_ptr_array_add (entries, entry);
+        }
+    }
+
+  g_mutex_unlock (&index->mutex);
+
+  return entries;
+}
+
+void
+jws_index_insert (JwsIndex *index,
+                  const gchar *path,
+                  gint64 mtime,
+                  GPtrArray *entries)
+{
+  g_return_if_fail (index != NULL);
+  g_return_if_fail (path != NULL);
+  g_return_if_fail (entries != NULL);
+
+  JwsIndexDirectory *directory;
+  directory = jws_index_directory_new (mtime,
+                                       g_get_real_time () / G_USEC_PER_SEC);
+
+  for (guint i = 0; i < entries->len; i++)
+    {
+      JwsScanEntry *entry = g_ptr_array_index (entries, i);
+
+      JwsIndexChild child;
+      child.name = g_strdup (entry->name);
+      child.is_directory = entry->is_directory;
+      child.mtime = entry->mtime;
+      child.device = entry->device;
+      child.inode = entry->inode;
+      g_array_append_val (directory->children, child);
+    }
+
+  g_mutex_lock (&index->mutex);
+  g_hash_table_replace (index->directories, g_strdup (path), directory);
+  index->is_dirty = TRUE;
+  g_mutex_unlock (&index->mutex);
+}
+
+void
+jws_index_remove (JwsIndex *index, const gchar *path)
+{
+  g_return_if_fail (index != NULL);
+  g_return_if_fail (path != NULL);
+
+  g_mutex_lock (&index->mutex);
+  if (g_hash_table_remove (index->directories, path))
+    index->is_dirty = TRUE;
+  g_mutex_unlock (&index->mutex);
+}
+
+gboolean
+jws_index_save (JwsIndex *index, const gchar *file, GError **err)
+{
+  g_return_val_if_fail (index != NULL, FALSE);
+  g_return_val_if_fail (file != NULL, FALSE);
+
+  g_mutex_lock (&index->mutex);
+
+  if (!index->is_dirty)
+    {
+      g_mutex_unlock (&index->mutex);
+      return TRUE;
+    }
+
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sxxa(sbxtt))"));
+
+  gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  g_hash_table_iter_init (&iter, index->directories);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      JwsIndexDirectory *directory = value;
+
+      if (now - directory->last_used > JWS_INDEX_MAX_AGE)
+        {
+          g_hash_table_iter_remove (&iter);
+          continue;
+        }
+
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("(sxxa(sbxtt))"));
+      g_variant_builder_add (&builder, "s", key);
+      g_variant_builder_add (&builder, "x", directory->mtime);
+      g_variant_builder_add (&builder, "x", directory->last_used);
+
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(sbxtt)"));
+      for (guint i = 0; i < directory->children->len; i++)
+        {
+          JwsIndexChild *child;
+          child = &g_array_index (directory->children, JwsIndexChild, i);
+          g_variant_builder_add (&builder, "(sbxtt)",
+                                 child->name,
+                                 child->is_directory,
+                                 child->mtime,
+                                 child->device,
+                                 child->inode);
+        }
+      g_variant_builder_close (&builder);
+
+      g_variant_builder_close (&builder);
+    }
+
+  index->is_dirty = FALSE;
+
+  g_mutex_unlock (&index->mutex);
+
+  GVariant *variant;
+  variant = g_variant_new (JWS_INDEX_FORMAT,
+                           JWS_INDEX_MAGIC,
+                           (guint32) JWS_INDEX_VERSION,
+                           &builder);
+  g_variant_ref_sink (variant);
+
+  gchar *directory_path;
+  directory_path = g_path_get_dirname (file);
+  g_mkdir_with_parents (directory_path, 0700);
+  g_free (directory_path);
+
+  /* Written to a temporary file and renamed over the old one, and only
+   * readable by the user, since it lists their files.  */
+  gboolean is_saved;
+  is_saved = g_file_set_contents_full (file,
+                                       g_variant_get_data (variant),
+                                       g_variant_get_size (variant),
+                                       G_FILE_SET_CONTENTS_CONSISTENT,
+                                       0600,
+                                       err);
+
+  g_variant_unref (variant);
+
+  if (!is_saved)
+    {
+      g_mutex_lock (&index->mutex);
+      index->is_dirty = TRUE;
+      g_mutex_unlock (&index->mutex);
+    }
+
+  return is_saved;
+}
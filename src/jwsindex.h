@@ -0,0 +1,81 @@
+/* jwsindex.h - header for the index of directories that were listed
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef JWSINDEX_H
+#define JWSINDEX_H
+
+#include <glib.h>
+
+/* An index remembers the sorted contents of every directory that was
+ * listed, along with the directory's modification time.  Adding, removing
+ * or renaming anything in a directory changes its time, so as long as it's
+ * the same the old listing can be used again, which costs one stat () for
+ * the directory instead of one for every file in it.  Files written to in
+ * place don't change the time of their directory, so their times in the
+ * index can be out of date, and have to be checked before anything is
+ * looked up by them.  Listings that aren't used for a month are dropped.
+ *
+ * One index is shared by every config and kept in
+ * ~/.cache/jws-config/directories.index.  It's safe to use from several
+ * threads at once.  */
+typedef struct _JwsIndex JwsIndex;
+
+/* Free with g_free ().  */
+gchar *
+jws_index_get_default_file ();
+
+JwsIndex *
+jws_index_new ();
+
+/* Reads the index saved in file.  Returns NULL and sets err if it doesn't
+ * exist or isn't valid.  */
+JwsIndex *
+jws_index_load (const gchar *file, GError **err);
+
+JwsIndex *
+jws_index_ref (JwsIndex *index);
+
+void
+jws_index_unref (JwsIndex *index);
+
+/* Returns the listing of the directory at path as a sorted array of
+ * JwsScanEntry with a parent of -1, if there is one for the same
+ * modification time, in microseconds.  Otherwise returns NULL.  Free with
+ * g_ptr_array_unref ().  */
+GPtrArray *
+jws_index_lookup (JwsIndex *index, const gchar *path, gint64 mtime);
+
+/* Remembers entries, a sorted array of JwsScanEntry, as the listing of the
+ * directory at path when it had the modification time mtime.  */
+void
+jws_index_insert (JwsIndex *index,
+                  const gchar *path,
+                  gint64 mtime,
+                  GPtrArray *entries);
+
+/* Forgets the listing of the directory at path.  */
+void
+jws_index_remove (JwsIndex *index, const gchar *path);
+
+/* Replaces file with the index if anything changed since it was loaded or
+ * last saved, creating the directory if needed.  */
+gboolean
+jws_index_save (JwsIndex *index, const gchar *file, GError **err);
+
+#endif /* JWSINDEX_H */
@@ -0,0 +1,123 @@
+/* jwspreferences.c - jws-config's own settings
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "jwspreferences.h"
+
+/* Loaded the first time anything asks for a value and never modified after
+ * that, so it's safe to read from the preview threads too.  */
+static GKeyFile *
+jws_preferences_get_key_file ()
+{
+  static gsize initialized = 0;
+  static GKeyFile *key_file = NULL;
+
+  if (g_once_init_enter (&initialized))
+    {
+      key_file = g_key_file_new ();
+
+      gchar *path;
+      path = jws_preferences_get_file ();
+
+      /* A missing file just means that everything is default.  */
+      g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, NULL);
+      g_free (path);
+
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return key_file;
+}
+
+gchar *
+jws_preferences_get_file ()
+{
+  return g_build_filename (g_get_user_config_dir (),
+                           "jws-config",
+                           "jws-config.conf",
+                           NULL);
+}
+
+gint
+jws_preferences_get_integer (const gchar *group,
+                             const gchar *key,
+                             gint default_value)
+{
+  GError *err = NULL;
+  gint value;
+  value = g_key_file_get_integer (jws_preferences_get_key_file (),
+                                  group,
+                                  key,
+                                  &err);
+
+  if (err)
+    {
+      g_error_free (err);
+      return default_value;
+    }
+
+  return value;
+}
+
+gboolean
+jws_preferences_get_boolean (const gchar *group,
+                             const gchar *key,
+                             gboolean default_value)
+{
+  GError *err = NULL;
+  gboolean value;
+  value = g_key_file_get_boolean (jws_preferences_get_key_file (),
+                                  group,
+                                  key,
+                                  &err);
+
+  if (err)
+    {
+      g_error_free (err);
+      return default_value;
+    }
+
+  return value;
+}
+
+gchar *
+jws_preferences_get_string (const gchar *group,
+                            const gchar *key,
+                            const gchar *default_value)
+{
+  gchar *value;
+  value = g_key_file_get_string (jws_preferences_get_key_file (),
+                                 group,
+                                 key,
+                                 NULL);
+
+  if (!value)
+    value = g_strdup (default_value);
+
+  return value;
+}
+
+gchar **
+jws_preferences_get_string_list (const gchar *group, const gchar *key)
+{
+  return g_key_file_get_string_list (jws_preferences_get_key_file (),
+                                     group,
+                                     key,
+                                     NULL,
+                                     NULL);
+}
@@ -0,0 +1,134 @@
+/* jwspreferences.h - header for jws-config's own settings
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef JWSPREFERENCES_H
+#define JWSPREFERENCES_H
+
+#include <glib.h>
+
+/* These are settings for jws-config itself, not for JWS, so they don't belong
+ * in ~/.jws.  They are read once from a key file in the user's config
+ * directory, usually ~/.config/jws-config/jws-config.conf, and missing keys
+ * fall back to the defaults passed in by the caller.  For example:
+ *
+ * [Previews]
+ * Threads=4
+ */
+
+#define JWS_PREFERENCES_GROUP_PREVIEWS "Previews"
+
+/* Number of preview worker threads, 0 or less means one per processor.  */
+#define JWS_PREFERENCES_KEY_PREVIEW_THREADS "Threads"
+
+/* Whether to read and write thumbnails in ~/.cache/thumbnails, on by default.
+ */
+#define JWS_PREFERENCES_KEY_THUMBNAIL_CACHE "ThumbnailCache"
+
+/* Whether to use the thumbnails embedded in JPEG files, on by default.  */
+#define JWS_PREFERENCES_KEY_EMBEDDED_THUMBNAILS "EmbeddedThumbnails"
+
+/* How many megabytes of finished previews to keep in memory for rows that are
+ * removed and added again.  */
+#define JWS_PREFERENCES_KEY_MEMORY_CACHE_SIZE "MemoryCacheSize"
+
+/* How many megabytes of previews the rows in the tree can hold at once, 0 or
+ * less means no limit.  */
+#define JWS_PREFERENCES_KEY_TREE_MEMORY "TreeMemory"
+
+/* Whether previews are shown quickly scaled first and redone with better
+ * scaling once everything else is loaded, on by default.  */
+#define JWS_PREFERENCES_KEY_PROGRESSIVE "Progressive"
+
+/* Which box filter shrinks big images before the final scaling, one of
+ * "auto", "avx2", "sse2", "scalar" or "none" to leave it all to GdkPixbuf.  */
+#define JWS_PREFERENCES_KEY_SCALER "Scaler"
+
+#define JWS_PREFERENCES_GROUP_SCANNING "Scanning"
+
+/* Number of threads listing directories while scanning, 0 or less means the
+ * default of 4, and more than 64 means 64.  More help most on network file
+ * systems, where each listing spends most of its time waiting.  */
+#define JWS_PREFERENCES_KEY_SCAN_THREADS "Threads"
+
+/* Whether directories are only listed when they're expanded, on by default.
+ * Off means everything under a directory is scanned as soon as it's added.  */
+#define JWS_PREFERENCES_KEY_LAZY_EXPANSION "LazyExpansion"
+
+/* Whether directories in the tree follow files being added, removed and
+ * renamed on disk, on by default.  Each listed directory takes one inotify
+ * watch.  */
+#define JWS_PREFERENCES_KEY_WATCH_DIRECTORIES "WatchDirectories"
+
+/* Whether listings of directories are kept in
+ * ~/.cache/jws-config/directories.index and used again while the directories
+ * haven't changed, on by default.  */
+#define JWS_PREFERENCES_KEY_DIRECTORY_INDEX "DirectoryIndex"
+
+/* What to do with a directory found again while scanning, through a
+ * symbolic link or a bind mount, one of "collapse" to show it without its
+ * contents, "skip" to leave it and files that are hard links to ones already
+ * found out, or "keep" to scan it again.  A directory inside itself is never
+ * scanned again.  The default is "collapse".  */
+#define JWS_PREFERENCES_KEY_DUPLICATES "Duplicates"
+
+/* Which files scans add, a list of glob patterns.  Patterns like "*.jpg"
+ * match the extension without regard to case.  By default every format
+ * GdkPixbuf can load.  */
+#define JWS_PREFERENCES_KEY_INCLUDE "Include"
+
+/* Directories scans leave out along with everything in them, a list of glob
+ * patterns matched against the name.  By default .git, node_modules and
+ * @eaDir.  */
+#define JWS_PREFERENCES_KEY_EXCLUDE_DIRECTORIES "ExcludeDirectories"
+
+/* Whether scans add files and directories starting with a dot, off by
+ * default.  */
+#define JWS_PREFERENCES_KEY_SHOW_HIDDEN "ShowHidden"
+
+/* How many levels of directories are listed under an added directory, 0 or
+ * less for no limit, which is the default.  Directories at the last level are
+ * shown without their contents.  */
+#define JWS_PREFERENCES_KEY_MAX_DEPTH "MaxDepth"
+
+/* Free with g_free ().  */
+gchar *
+jws_preferences_get_file ();
+
+gint
+jws_preferences_get_integer (const gchar *group,
+                             const gchar *key,
+                             gint default_value);
+
+gboolean
+jws_preferences_get_boolean (const gchar *group,
+                             const gchar *key,
+                             gboolean default_value);
+
+/* Returns a copy of default_value if the key isn't set.  Free with g_free ().
+ */
+gchar *
+jws_preferences_get_string (const gchar *group,
+                            const gchar *key,
+                            const gchar *default_value);
+
+/* Returns NULL if the key isn't set.  Free with g_strfreev ().  */
+gchar **
+jws_preferences_get_string_list (const gchar *group, const gchar *key);
+
+#endif /* JWSPREFERENCES_H */
@@ -0,0 +1,409 @@
+/* jwspreview.c - load and scale previews
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "jwspreview.h"
+
+#include <glib/gstdio.h>
+
+#include "jwsexif.h"
+#include "jwspreviewstats.h"
+#include "jwsscale.h"
+#include "jwsthumbnailcache.h"
+
+/* How much of the file is handed to the loader at a time.  */
+#define JWS_PREVIEW_READ_CHUNK_SIZE (64 * 1024)
+
+GdkPixbuf *
+jws_create_scaled_pixbuf (GdkPixbuf *src,
+                          int width,
+                          int height)
+{
+  return jws_create_scaled_pixbuf_with_interp (src, width, height,
+                                               GDK_INTERP_HYPER);
+}
+
+GdkPixbuf *
+jws_create_scaled_pixbuf_with_interp (GdkPixbuf *src,
+                                      int width,
+                                      int height,
+                                      GdkInterpType interp_type)
+{
+  int src_width;
+  int src_height;
+
+  GdkPixbuf *dest = NULL;;
+
+  if (src)
+    {
+      src_width = gdk_pixbuf_get_width (src);
+      src_height = gdk_pixbuf_get_height (src);
+
+      int dest_width = src_width;
+      int dest_height = src_height;
+
+      if (width > 0)
+        {
+          dest_width = width;
+          if (height <= 0)
+            {
+              dest_height = width * src_height / src_width;
+            }
+        }
+      if (height > 0)
+        {
+          dest_height = height;
+          if (width <= 0)
+            {
+              dest_width = height * src_width / src_height;
+            }
+        }
+
+      dest = gdk_pixbuf_scale_simple (src, dest_width, dest_height,
+                                      interp_type);
+
+    }
+
+  return dest;
+}
+
+typedef struct _JwsPreviewLoadSize JwsPreviewLoadSize;
+
+/* What a load is asked to produce and what the image turned out to be.  */
+struct _JwsPreviewLoadSize
+{
+  /* If positive, the image is shrunk to fit in a square this big.  */
+  int box_size;
+  /* The image is never shrunk below this height.  */
+  int min_height;
+
+  int src_width;
+  int src_height;
+};
+
+static void
+on_loader_size_prepared (GdkPixbufLoader *loader,
+                         int width,
+                         int height,
+                         JwsPreviewLoadSize *load_size)
+{
+  load_size->src_width = width;
+  load_size->src_height = height;
+
+  if (width <= 0 || height <= 0)
+    return;
+
+  double scale = 1.0;
+
+  if (load_size->box_size > 0)
+    scale = MIN ((double) load_size->box_size / width,
+                 (double) load_size->box_size / height);
+
+  if (height * scale < load_size->min_height)
+    scale = (double) load_size->min_height / height;
+
+  /* Only ever shrink here, smaller images are scaled up afterwards like they
+   * always were.  */
+  if (scale >= 1.0)
+    return;
+
+  int dest_width = MAX (1, (int) (width * scale + 0.5));
+  int dest_height = MAX (1, (int) (height * scale + 0.5));
+
+  gdk_pixbuf_loader_set_size (loader, dest_width, dest_height);
+}
+
+static GdkPixbuf *
+jws_preview_load_with_size (const gchar *path,
+                            JwsPreviewLoadSize *load_size,
+                            GCancellable *cancellable,
+                            GError **err)
+{
+  GFile *file;
+  file = g_file_new_for_path (path);
+
+  GFileInputStream *stream;
+  stream = g_file_read (file, cancellable, err);
+  g_object_unref (file);
+
+  if (!stream)
+    return NULL;
+
+  GdkPixbufLoader *loader;
+  loader = gdk_pixbuf_loader_new ();
+  g_signal_connect (loader, "size-prepared",
+                    G_CALLBACK (on_loader_size_prepared),
+                    load_size);
+
+  guchar *buffer;
+  buffer = g_malloc (JWS_PREVIEW_READ_CHUNK_SIZE);
+
+  GError *tmp_err = NULL;
+  gboolean is_valid = TRUE;
+
+  /* Summed over the chunks so each image counts once.  */
+  gint64 read_time = 0;
+  gint64 decode_time = 0;
+
+  while (is_valid)
+    {
+      gint64 read_start = jws_preview_stats_begin ();
+
+      gssize bytes_read;
+      bytes_read = g_input_stream_read (G_INPUT_STREAM (stream),
+                                        buffer,
+                                        JWS_PREVIEW_READ_CHUNK_SIZE,
+                                        cancellable,
+                                        &tmp_err);
+
+      read_time += jws_preview_stats_elapsed (read_start);
+
+      if (bytes_read < 0)
+        {
+          is_valid = FALSE;
+        }
+      else if (bytes_read == 0)
+        {
+          break;
+        }
+      else
+        {
+          gint64 decode_start = jws_preview_stats_begin ();
+          is_valid = gdk_pixbuf_loader_write (loader, buffer, bytes_read,
+                                              &tmp_err);
+          decode_time += jws_preview_stats_elapsed (decode_start);
+        }
+    }
+
+  g_free (buffer);
+  g_object_unref (stream);
+
+  /* The loader has to be closed even if something failed, but then the error
+   * from closing it isn't interesting.  */
+  gint64 close_start = jws_preview_stats_begin ();
+  if (is_valid)
+    is_valid = gdk_pixbuf_loader_close (loader, &tmp_err);
+  else
+    gdk_pixbuf_loader_close (loader, NULL);
+  decode_time += jws_preview_stats_elapsed (close_start);
+
+  jws_preview_stats_record (JWS_PREVIEW_STAGE_READ, read_time);
+  jws_preview_stats_record (JWS_PREVIEW_STAGE_DECODE, decode_time);
+
+  GdkPixbuf *loaded = NULL;
+
+  if (is_valid)
+    {
+      loaded = gdk_pixbuf_loader_get_pixbuf (loader);
+
+      if (loaded)
+        g_object_ref (loaded);
+      else
+        g_set_error (&tmp_err, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED,
+                     "No image data in \"%s\"", path);
+    }
+
+  g_object_unref (loader);
+
+  if (tmp_err)
+    g_propagate_error (err, tmp_err);
+
+  return loaded;
+}
+
+/* Scales the result of a load to exactly height, taking ownership of it.  */
+static GdkPixbuf *
+jws_preview_finish_for_height (GdkPixbuf *loaded,
+                               int height,
+                               JwsPreviewQuality quality)
+{
+  if (!loaded || gdk_pixbuf_get_height (loaded) == height)
+    return loaded;
+
+  /* Either the image was smaller to begin with or the loader for this format
+   * ignored the requested size.  */
+  gint64 scale_start = jws_preview_stats_begin ();
+
+  GdkInterpType interp_type = GDK_INTERP_HYPER;
+  if (quality == JWS_PREVIEW_QUALITY_FAST)
+    interp_type = GDK_INTERP_BILINEAR;
+
+  int width;
+  width = MAX (1, height * gdk_pixbuf_get_width (loaded)
+               / gdk_pixbuf_get_height (loaded));
+
+  /* Most of a big reduction is done by averaging blocks, which is far
+   * cheaper.  HYPER is still given twice the final size to work with.  */
+  int min_factor = (quality == JWS_PREVIEW_QUALITY_HIGH) ? 2 : 1;
+
+  GdkPixbuf *reduced;
+  reduced = jws_scale_box_reduce (loaded, width * min_factor,
+                                  height * min_factor);
+  if (reduced)
+    {
+      g_object_unref (loaded);
+      loaded = reduced;
+    }
+
+  GdkPixbuf *preview;
+  preview = jws_create_scaled_pixbuf_with_interp (loaded, width, height,
+                                                  interp_type);
+  g_object_unref (loaded);
+
+  jws_preview_stats_end (JWS_PREVIEW_STAGE_SCALE, scale_start);
+
+  return preview;
+}
+
+GdkPixbuf *
+jws_preview_load_for_height (const gchar *path,
+                             int height,
+                             GCancellable *cancellable,
+                             GError **err)
+{
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (height > 0, NULL);
+
+  JwsPreviewLoadSize load_size = {0, height, 0, 0};
+
+  GdkPixbuf *loaded;
+  loaded = jws_preview_load_with_size (path, &load_size, cancellable, err);
+
+  return jws_preview_finish_for_height (loaded, height,
+                                        JWS_PREVIEW_QUALITY_HIGH);
+}
+
+/* Loads without the thumbnail cache.  A fast preview is decoded right at
+ * height, a good one at twice that so HYPER has something to work with.  */
+static GdkPixbuf *
+jws_preview_load_uncached (const gchar *path,
+                           int height,
+                           JwsPreviewQuality quality,
+                           GCancellable *cancellable,
+                           GError **err)
+{
+  int min_height = height;
+  if (quality == JWS_PREVIEW_QUALITY_HIGH)
+    min_height = height * 2;
+
+  JwsPreviewLoadSize load_size = {0, min_height, 0, 0};
+
+  GdkPixbuf *loaded;
+  loaded = jws_preview_load_with_size (path, &load_size, cancellable, err);
+
+  return jws_preview_finish_for_height (loaded, height, quality);
+}
+
+GdkPixbuf *
+jws_preview_load (const gchar *path,
+                  int height,
+                  JwsPreviewLoadFlags flags,
+                  JwsPreviewQuality *quality,
+                  gint64 *mtime,
+                  GCancellable *cancellable,
+                  GError **err)
+{
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (height > 0, NULL);
+  g_return_val_if_fail (quality != NULL, NULL);
+
+  GStatBuf file_info;
+  gboolean has_file_info;
+  has_file_info = (g_stat (path, &file_info) == 0);
+
+  if (mtime)
+    *mtime = (has_file_info) ? (gint64) file_info.st_mtime : -1;
+
+  gboolean use_thumbnail_cache;
+  use_thumbnail_cache = ((flags & JWS_PREVIEW_LOAD_THUMBNAIL_CACHE)
+                         && has_file_info);
+
+  if (use_thumbnail_cache)
+    {
+      gint64 lookup_start = jws_preview_stats_begin ();
+
+      GdkPixbuf *thumbnail;
+      thumbnail = jws_thumbnail_cache_lookup (path, file_info.st_mtime,
+                                              file_info.st_size, height);
+
+      jws_preview_stats_end (JWS_PREVIEW_STAGE_THUMBNAIL_LOOKUP,
+                             lookup_start);
+
+      /* Scaling a thumbnail well costs next to nothing, so there's no
+       * point in a second pass reading it again.  */
+      if (thumbnail)
+        {
+          *quality = JWS_PREVIEW_QUALITY_HIGH;
+          return jws_preview_finish_for_height (thumbnail, height, *quality);
+        }
+    }
+
+  /* This only reads the start of the file, so it's worth trying before a
+   * real decode even though most files won't have a big enough one.  */
+  if (flags & JWS_PREVIEW_LOAD_EMBEDDED_THUMBNAIL)
+    {
+      int min_height = height;
+      if (*quality == JWS_PREVIEW_QUALITY_HIGH)
+        min_height = height * 2;
+
+      gint64 embedded_start = jws_preview_stats_begin ();
+
+      GdkPixbuf *embedded;
+      embedded = jws_exif_load_thumbnail (path, min_height, cancellable);
+
+      jws_preview_stats_end (JWS_PREVIEW_STAGE_EXIF, embedded_start);
+
+      if (embedded)
+        {
+          if (gdk_pixbuf_get_height (embedded) >= height * 2)
+            *quality = JWS_PREVIEW_QUALITY_HIGH;
+          return jws_preview_finish_for_height (embedded, height, *quality);
+        }
+    }
+
+  /* A fast preview is decoded right at height so the first screen fills as
+   * soon as possible, the large decode and saving the thumbnail are left to
+   * the good one.  */
+  if (!use_thumbnail_cache || *quality == JWS_PREVIEW_QUALITY_FAST)
+    return jws_preview_load_uncached (path, height, *quality, cancellable,
+                                      err);
+
+  gint64 file_mtime = file_info.st_mtime;
+  goffset size = file_info.st_size;
+
+  /* Decode to the size of a large thumbnail so that it can be saved for next
+   * time, which is still far less than the whole image for big wallpapers.
+   * Panoramas would end up shorter than the preview though, so those are
+   * decoded taller and not saved.  */
+  JwsPreviewLoadSize load_size = {JWS_THUMBNAIL_CACHE_LARGE_SIZE, height, 0, 0};
+
+  GdkPixbuf *loaded;
+  loaded = jws_preview_load_with_size (path, &load_size, cancellable, err);
+
+  if (loaded)
+    {
+      gint64 store_start = jws_preview_stats_begin ();
+      jws_thumbnail_cache_store (path, file_mtime, size,
+                                 load_size.src_width, load_size.src_height,
+                                 loaded);
+      jws_preview_stats_end (JWS_PREVIEW_STAGE_THUMBNAIL_STORE,
+                             store_start);
+    }
+
+  return jws_preview_finish_for_height (loaded, height, *quality);
+}
@@ -0,0 +1,97 @@
+/* jwspreview.h - header for loading and scaling previews
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef JWSPREVIEW_H
+#define JWSPREVIEW_H
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gio/gio.h>
+
+typedef enum _JwsPreviewQuality JwsPreviewQuality;
+
+/* How much effort to put into scaling a preview down.  */
+enum _JwsPreviewQuality
+{
+  /* Bilinear scaling, good enough for a first look.  */
+  JWS_PREVIEW_QUALITY_FAST = 0,
+  /* GDK_INTERP_HYPER from a source at least twice the final size.  */
+  JWS_PREVIEW_QUALITY_HIGH
+};
+
+typedef enum _JwsPreviewLoadFlags JwsPreviewLoadFlags;
+
+/* Shortcuts jws_preview_load () may take instead of decoding the image.  */
+enum _JwsPreviewLoadFlags
+{
+  JWS_PREVIEW_LOAD_NONE = 0,
+  /* Read and write thumbnails in the shared thumbnail cache.  */
+  JWS_PREVIEW_LOAD_THUMBNAIL_CACHE = 1 << 0,
+  /* Use the thumbnail embedded in a JPEG's EXIF data if it's big enough.  */
+  JWS_PREVIEW_LOAD_EMBEDDED_THUMBNAIL = 1 << 1
+};
+
+/* If width or height are positive, the pixbuf will have the dimension.  If one
+ * of them are not set, that dimension will be scaled to the other.  If neither
+ * are set, it will be the dimensions of the original.  Returns a new pixbuf
+ * which must freed with g_object_free.  */
+GdkPixbuf *
+jws_create_scaled_pixbuf (GdkPixbuf *src,
+                          int width,
+                          int height);
+
+/* Same as jws_create_scaled_pixbuf () but with the given interpolation instead
+ * of always GDK_INTERP_HYPER.  */
+GdkPixbuf *
+jws_create_scaled_pixbuf_with_interp (GdkPixbuf *src,
+                                      int width,
+                                      int height,
+                                      GdkInterpType interp_type);
+
+/* Loads the image at path so that it is height pixels high, keeping the aspect
+ * ratio.  Instead of decoding the whole image and scaling it down afterwards,
+ * the loader is told the final size up front so it can decode straight to it,
+ * which for JPEG means only decoding a fraction of the data.  The file is fed
+ * to the loader in chunks and cancellable is checked in between, so a
+ * cancelled load stops early.  Returns NULL and sets err on failure, free the
+ * result with g_object_unref ().  */
+GdkPixbuf *
+jws_preview_load_for_height (const gchar *path,
+                             int height,
+                             GCancellable *cancellable,
+                             GError **err);
+
+/* Like jws_preview_load_for_height (), but tries the shortcuts in flags
+ * first.  With the thumbnail cache, a thumbnail from the shared thumbnail
+ * cache is used when there is an up to date one, and a new one is saved there
+ * after decoding a high quality preview when there isn't.  Otherwise an
+ * embedded thumbnail is used if it is at least height high, or twice that
+ * for high quality.  quality picks how the result is scaled to height, and
+ * is set to high quality if a small enough source made that as cheap.  If mtime isn't NULL, it's set to the
+ * modification time of the file before it was read, in seconds, or -1 if
+ * that couldn't be found.  */
+GdkPixbuf *
+jws_preview_load (const gchar *path,
+                  int height,
+                  JwsPreviewLoadFlags flags,
+                  JwsPreviewQuality *quality,
+                  gint64 *mtime,
+                  GCancellable *cancellable,
+                  GError **err);
+
+#endif /* JWSPREVIEW_H */
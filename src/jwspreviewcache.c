@@ -0,0 +1,176 @@
+/* jwspreviewcache.c - in-memory preview cache
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "jwspreviewcache.h"
+
+typedef struct _JwsPreviewCacheEntry JwsPreviewCacheEntry;
+
+struct _JwsPreviewCacheEntry
+{
+  /* Owned by the entry, also used as the key in the table.  */
+  gchar *path;
+  gint64 mtime;
+  GdkPixbuf *preview;
+  gsize size;
+
+  /* This entry's node in the LRU list, so moving it to the front and removing
+   * it don't have to search.  */
+  GList link;
+};
+
+struct _JwsPreviewCache
+{
+  /* Maps paths to JwsPreviewCacheEntry.  */
+  GHashTable *entries;
+
+  /* Most recently used at the head.  */
+  GQueue lru;
+
+  gsize size;
+  gsize max_bytes;
+};
+
+static void
+jws_preview_cache_entry_free (JwsPreviewCacheEntry *entry);
+
+static void
+jws_preview_cache_remove_entry (JwsPreviewCache *cache,
+                                JwsPreviewCacheEntry *entry);
+
+static void
+jws_preview_cache_entry_free (JwsPreviewCacheEntry *entry)
+{
+  g_object_unref (entry->preview);
+  g_free (entry->path);
+  g_free (entry);
+}
+
+JwsPreviewCache *
+jws_preview_cache_new (gsize max_bytes)
+{
+  JwsPreviewCache *cache;
+  cache = g_new0 (JwsPreviewCache, 1);
+
+  /* The entries own their keys, so only the values are freed.  */
+  cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          NULL,
+                                          (GDestroyNotify)
+                                          jws_preview_cache_entry_free);
+  g_queue_init (&cache->lru);
+  cache->size = 0;
+  cache->max_bytes = max_bytes;
+
+  return cache;
+}
+
+void
+jws_preview_cache_free (JwsPreviewCache *cache)
+{
+  if (!cache)
+    return;
+
+  /* The links live inside the entries, so the queue has nothing to free.  */
+  g_hash_table_destroy (cache->entries);
+  g_free (cache);
+}
+
+static void
+jws_preview_cache_remove_entry (JwsPreviewCache *cache,
+                                JwsPreviewCacheEntry *entry)
+{
+  g_queue_unlink (&cache->lru, &entry->link);
+  cache->size -= entry->size;
+  g_hash_table_remove (cache->entries, entry->path);
+}
+
+GdkPixbuf *
+jws_preview_cache_lookup (JwsPreviewCache *cache,
+                          const gchar *path,
+                          gint64 mtime)
+{
+  JwsPreviewCacheEntry *entry;
+  entry = g_hash_table_lookup (cache->entries, path);
+
+  if (!entry)
+    return NULL;
+
+  if (entry->mtime != mtime)
+    {
+      /* The file changed, so this one is never going to be useful again.  */
+      jws_preview_cache_remove_entry (cache, entry);
+      return NULL;
+    }
+
+  g_queue_unlink (&cache->lru, &entry->link);
+  g_queue_push_head_link (&cache->lru, &entry->link);
+
+  return g_object_ref (entry->preview);
+}
+
+void
+jws_preview_cache_insert (JwsPreviewCache *cache,
+                          const gchar *path,
+                          gint64 mtime,
+                          GdkPixbuf *preview)
+{
+  g_return_if_fail (preview != NULL);
+
+  jws_preview_cache_remove (cache, path);
+
+  gsize size;
+  size = gdk_pixbuf_get_byte_length (preview);
+
+  if (size > cache->max_bytes)
+    return;
+
+  while (cache->size + size > cache->max_bytes)
+    {
+      GList *oldest;
+      oldest = g_queue_peek_tail_link (&cache->lru);
+      jws_preview_cache_remove_entry (cache, oldest->data);
+    }
+
+  JwsPreviewCacheEntry *entry;
+  entry = g_new0 (JwsPreviewCacheEntry, 1);
+  entry->path = g_strdup (path);
+  entry->mtime = mtime;
+  entry->preview = g_object_ref (preview);
+  entry->size = size;
+  entry->link.data = entry;
+
+  g_queue_push_head_link (&cache->lru, &entry->link);
+  cache->size += size;
+  g_hash_table_insert (cache->entries, entry->path, entry);
+}
+
+void
+jws_preview_cache_remove (JwsPreviewCache *cache, const gchar *path)
+{
+  JwsPreviewCacheEntry *entry;
+  entry = g_hash_table_lookup (cache->entries, path);
+
+  if (entry)
+    jws_preview_cache_remove_entry (cache, entry);
+}
+
+gsize
+jws_preview_cache_get_size (JwsPreviewCache *cache)
+{
+  return cache->size;
+}
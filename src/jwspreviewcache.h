@@ -0,0 +1,61 @@
+/* jwspreviewcache.h - header for the in-memory preview cache
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef JWSPREVIEWCACHE_H
+#define JWSPREVIEWCACHE_H
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/* Keeps finished previews around by path and modification time so that rows
+ * that are cleared and added again, when reopening a file for example, get
+ * their preview back without decoding anything.  The pixel data of all the
+ * previews is kept under a byte budget by dropping the least recently used
+ * ones.  This isn't thread safe and is meant to be used from the main thread.
+ */
+typedef struct _JwsPreviewCache JwsPreviewCache;
+
+JwsPreviewCache *
+jws_preview_cache_new (gsize max_bytes);
+
+void
+jws_preview_cache_free (JwsPreviewCache *cache);
+
+/* Returns a new reference to the preview for path if there is one for the same
+ * modification time, otherwise NULL.  A hit counts as a use.  */
+GdkPixbuf *
+jws_preview_cache_lookup (JwsPreviewCache *cache,
+                          const gchar *path,
+                          gint64 mtime);
+
+/* Adds or replaces the preview for path, evicting old previews if needed.
+ * Previews larger than the whole budget aren't kept.  */
+void
+jws_preview_cache_insert (JwsPreviewCache *cache,
+                          const gchar *path,
+                          gint64 mtime,
+                          GdkPixbuf *preview);
+
+void
+jws_preview_cache_remove (JwsPreviewCache *cache, const gchar *path);
+
+/* The number of bytes of pixel data currently held.  */
+gsize
+jws_preview_cache_get_size (JwsPreviewCache *cache);
+
+#endif /* JWSPREVIEWCACHE_H */
@@ -0,0 +1,569 @@
+/* jwspreviewpool.c - pool of threads that load previews
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "jwspreviewpool.h"
+
+#include <glib/gstdio.h>
+
+#include "jwspreferences.h"
+#include "jwspreview.h"
+#include "jwspreviewstats.h"
+
+/* What gets pushed to the thread pool.  Each one tells a worker to take the
+ * best job from the queues, since the job it was pushed for may have been
+ * moved around in the meantime.  */
+static gchar jws_preview_pool_token;
+#define JWS_PREVIEW_POOL_TOKEN ((gpointer) &jws_preview_pool_token)
+
+/* How long finished jobs are collected before being delivered, in
+ * milliseconds.  About one frame at 60 Hz.  */
+#define JWS_PREVIEW_POOL_DELIVER_INTERVAL 16
+
+struct _JwsPreviewPool
+{
+  /* One for the owner and one for every job that hasn't been delivered yet,
+   * because the delivery happens in a timeout that may run after
+   * jws_preview_pool_free ().  */
+  gint ref_count;
+
+  /* Set once the owner frees the pool, accessed atomically.  */
+  gint shutting_down;
+
+  /* Jobs from an older generation than this are cancelled.  Accessed
+   * atomically.  */
+  gint generation;
+
+  GThreadPool *thread_pool;
+  int n_threads;
+  int preview_height;
+  JwsPreviewLoadFlags load_flags;
+  gboolean is_progressive;
+
+  /* Jobs waiting for a worker.  Visible ones are always taken first.  Both
+   * are protected by queue_mutex.  */
+  GMutex queue_mutex;
+  GQueue visible_queue;
+  GQueue normal_queue;
+  /* Jobs that already have a fast preview and wait for a good one.  Also
+   * protected by queue_mutex and only taken when the others are empty.  */
+  GQueue refine_queue;
+
+  /* Jobs the workers are done with and the source that delivers them, also
+   * protected by queue_mutex.  */
+  GQueue finished_queue;
+  guint deliver_source;
+
+  JwsPreviewReadyFunc ready_func;
+  gpointer user_data;
+};
+
+struct _JwsPreviewJob
+{
+  gint ref_count;
+
+  /* Only set until the job is delivered.  */
+  JwsPreviewPool *pool;
+  gchar *path;
+  GdkPixbuf *preview;
+  /* The time of the file when preview was made, or for a check the time the
+   * caller's preview was made at.  */
+  gint64 mtime;
+  /* For a check, the caller's preview, until a worker has looked at the
+   * file.  */
+  GdkPixbuf *check_preview;
+
+  gpointer data;
+  GDestroyNotify data_free;
+
+  /* What the next load for this job is going to be, and once a worker is
+   * done with it what the load turned out to be.  Only changed by the
+   * worker that has the job, or in the main thread while none has it.  */
+  JwsPreviewQuality quality;
+
+  /* When the job was pushed, if statistics are on.  */
+  gint64 queued_time;
+
+  gint generation;
+  /* Both accessed atomically and never reset once set.  */
+  gint cancelled;
+  GCancellable *cancellable;
+
+  /* The queue this job is waiting in, or NULL once a worker took it, and its
+   * node in that queue.  The node is used again for the finished queue.
+   * Protected by the pool's queue_mutex.  */
+  GQueue *queue;
+  GList link;
+};
+
+G_DEFINE_BOXED_TYPE (JwsPreviewJob, jws_preview_job,
+                     jws_preview_job_ref, jws_preview_job_unref);
+
+static JwsPreviewPool *
+jws_preview_pool_ref (JwsPreviewPool *pool);
+
+static JwsPreviewJob *
+jws_preview_pool_push_job (JwsPreviewPool *pool,
+                           const gchar *path,
+                           gint64 mtime,
+                           GdkPixbuf *check_preview,
+                           GCancellable *cancellable,
+                           gpointer job_data,
+                           GDestroyNotify job_data_free);
+
+/* Whether the file of a check job still has the time its preview was made
+ * at.  Called by the workers.  */
+static gboolean
+jws_preview_pool_is_check_current (JwsPreviewJob *job);
+
+static void
+jws_preview_pool_unref (JwsPreviewPool *pool);
+
+static void
+jws_preview_pool_run_job (gpointer token, gpointer pool);
+
+static gboolean
+jws_preview_pool_deliver_jobs (gpointer pool);
+
+static void
+jws_preview_pool_deliver_job (JwsPreviewJob *job);
+
+/* Returns the next job to work on or NULL if the queues are empty.  */
+static JwsPreviewJob *
+jws_preview_pool_take_job (JwsPreviewPool *pool);
+
+static gboolean
+jws_preview_pool_is_job_cancelled (JwsPreviewPool *pool, JwsPreviewJob *job);
+
+/* Reports the number of waiting jobs to the statistics.  Call with
+ * queue_mutex held.  */
+static void
+jws_preview_pool_update_queue_depth (JwsPreviewPool *pool);
+
+JwsPreviewJob *
+jws_preview_job_ref (JwsPreviewJob *job)
+{
+  g_atomic_int_inc (&job->ref_count);
+  return job;
+}
+
+void
+jws_preview_job_unref (JwsPreviewJob *job)
+{
+  if (!g_atomic_int_dec_and_test (&job->ref_count))
+    return;
+
+  /* A job can only be freed after being delivered, which already freed the
+   * data and let go of the pool.  */
+  g_clear_object (&job->preview);
+  g_clear_object (&job->check_preview);
+  g_clear_object (&job->cancellable);
+  g_free (job->path);
+  g_free (job);
+}
+
+JwsPreviewPool *
+jws_preview_pool_new (int n_threads,
+                      int preview_height,
+                      JwsPreviewReadyFunc ready_func,
+                      gpointer user_data)
+{
+  JwsPreviewPool *pool;
+  pool = g_new0 (JwsPreviewPool, 1);
+
+  if (n_threads <= 0)
+    n_threads = g_get_num_processors ();
+
+  pool->ref_count = 1;
+  pool->shutting_down = FALSE;
+  pool->generation = 0;
+  pool->n_threads = n_threads;
+  pool->preview_height = preview_height;
+  pool->load_flags = JWS_PREVIEW_LOAD_NONE;
+  if (jws_preferences_get_boolean (JWS_PREFERENCES_GROUP_PREVIEWS,
+                                   JWS_PREFERENCES_KEY_THUMBNAIL_CACHE,
+                                   TRUE))
+    pool->load_flags |= JWS_PREVIEW_LOAD_THUMBNAIL_CACHE;
+  if (jws_preferences_get_boolean (JWS_PREFERENCES_GROUP_PREVIEWS,
+                                   JWS_PREFERENCES_KEY_EMBEDDED_THUMBNAILS,
+                                   TRUE))
+    pool->load_flags |= JWS_PREVIEW_LOAD_EMBEDDED_THUMBNAIL;
+  pool->is_progressive = jws_preferences_get_boolean
+    (JWS_PREFERENCES_GROUP_PREVIEWS,
+     JWS_PREFERENCES_KEY_PROGRESSIVE,
+     TRUE);
+  pool->ready_func = ready_func;
+  pool->user_data = user_data;
+
+  g_mutex_init (&pool->queue_mutex);
+  g_queue_init (&pool->visible_queue);
+  g_queue_init (&pool->normal_queue);
+  g_queue_init (&pool->refine_queue);
+  g_queue_init (&pool->finished_queue);
+  pool->deliver_source = 0;
+
+  /* This can only fail for exclusive pools.  */
+  pool->thread_pool = g_thread_pool_new (jws_preview_pool_run_job,
+                                         pool,
+                                         n_threads,
+                                         FALSE,
+                                         NULL);
+
+  return pool;
+}
+
+static JwsPreviewPool *
+jws_preview_pool_ref (JwsPreviewPool *pool)
+{
+  g_atomic_int_inc (&pool->ref_count);
+  return pool;
+}
+
+static void
+jws_preview_pool_unref (JwsPreviewPool *pool)
+{
+  if (g_atomic_int_dec_and_test (&pool->ref_count))
+    {
+      g_mutex_clear (&pool->queue_mutex);
+      g_free (pool);
+    }
+}
+
+void
+jws_preview_pool_free (JwsPreviewPool *pool)
+{
+  if (!pool)
+    return;
+
+  g_atomic_int_set (&pool->shutting_down, TRUE);
+
+  /* There is one token for every queued job, so the workers empty the queues
+   * before this returns, but they see shutting_down and don't load
+   * anything.  */
+  g_thread_pool_free (pool->thread_pool, FALSE, TRUE);
+  pool->thread_pool = NULL;
+
+  jws_preview_pool_unref (pool);
+}
+
+int
+jws_preview_pool_get_n_threads (JwsPreviewPool *pool)
+{
+  return pool->n_threads;
+}
+
+JwsPreviewJob *
+jws_preview_pool_push (JwsPreviewPool *pool,
+                       const gchar *path,
+                       GCancellable *cancellable,
+                       gpointer job_data,
+                       GDestroyNotify job_data_free)
+{
+  g_return_val_if_fail (pool != NULL, NULL);
+
+  return jws_preview_pool_push_job (pool, path, -1, NULL, cancellable,
+                                    job_data, job_data_free);
+}
+
+JwsPreviewJob *
+jws_preview_pool_push_check (JwsPreviewPool *pool,
+                             const gchar *path,
+                             gint64 mtime,
+                             GdkPixbuf *preview,
+                             GCancellable *cancellable,
+                             gpointer job_data,
+                             GDestroyNotify job_data_free)
+{
+  g_return_val_if_fail (pool != NULL, NULL);
+  g_return_val_if_fail (GDK_IS_PIXBUF (preview), NULL);
+
+  return jws_preview_pool_push_job (pool, path, mtime, preview, cancellable,
+                                    job_data, job_data_free);
+}
+
+static JwsPreviewJob *
+jws_preview_pool_push_job (JwsPreviewPool *pool,
+                           const gchar *path,
+                           gint64 mtime,
+                           GdkPixbuf *check_preview,
+                           GCancellable *cancellable,
+                           gpointer job_data,
+                           GDestroyNotify job_data_free)
+{
+  JwsPreviewJob *job;
+  job = g_new0 (JwsPreviewJob, 1);
+  /* One for the caller and one that's dropped after it's delivered.  */
+  job->ref_count = 2;
+  job->pool = jws_preview_pool_ref (pool);
+  job->path = g_strdup (path);
+  job->preview = NULL;
+  job->mtime = mtime;
+  job->check_preview = (check_preview) ? g_object_ref (check_preview) : NULL;
+  job->data = job_data;
+  job->data_free = job_data_free;
+  job->quality = (pool->is_progressive
+                  ? JWS_PREVIEW_QUALITY_FAST
+                  : JWS_PREVIEW_QUALITY_HIGH);
+  job->queued_time = jws_preview_stats_begin ();
+  job->generation = g_atomic_int_get (&pool->generation);
+  job->cancelled = FALSE;
+  job->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+  job->link.data = job;
+
+  g_mutex_lock (&pool->queue_mutex);
+  job->queue = &pool->normal_queue;
+  g_queue_push_tail_link (job->queue, &job->link);
+  jws_preview_pool_update_queue_depth (pool);
+  g_mutex_unlock (&pool->queue_mutex);
+
+  jws_preview_stats_job_queued ();
+
+  g_thread_pool_push (pool->thread_pool, JWS_PREVIEW_POOL_TOKEN, NULL);
+
+  return job;
+}
+
+void
+jws_preview_pool_cancel_job (JwsPreviewPool *pool, JwsPreviewJob *job)
+{
+  g_return_if_fail (job != NULL);
+
+  g_atomic_int_set (&job->cancelled, TRUE);
+}
+
+void
+jws_preview_pool_cancel_all (JwsPreviewPool *pool)
+{
+  g_return_if_fail (pool != NULL);
+
+  g_atomic_int_inc (&pool->generation);
+}
+
+static gboolean
+jws_preview_pool_is_job_cancelled (JwsPreviewPool *pool, JwsPreviewJob *job)
+{
+  return (g_atomic_int_get (&pool->shutting_down)
+          || g_atomic_int_get (&job->cancelled)
+          || job->generation != g_atomic_int_get (&pool->generation)
+          || g_cancellable_is_cancelled (job->cancellable));
+}
+
+void
+jws_preview_pool_set_priority (JwsPreviewPool *pool,
+                               JwsPreviewJob *job,
+                               JwsPreviewPriority priority)
+{
+  g_return_if_fail (pool != NULL);
+  g_return_if_fail (job != NULL);
+
+  g_mutex_lock (&pool->queue_mutex);
+
+  GQueue *new_queue;
+  new_queue = (priority == JWS_PREVIEW_PRIORITY_VISIBLE
+               ? &pool->visible_queue
+               : &pool->normal_queue);
+
+  if (job->queue && job->queue != new_queue
+      && job->queue != &pool->refine_queue)
+    {
+      g_queue_unlink (job->queue, &job->link);
+      job->queue = new_queue;
+
+      if (priority == JWS_PREVIEW_PRIORITY_VISIBLE)
+        g_queue_push_tail_link (new_queue, &job->link);
+      else
+        g_queue_push_head_link (new_queue, &job->link);
+    }
+
+  g_mutex_unlock (&pool->queue_mutex);
+}
+
+static void
+jws_preview_pool_update_queue_depth (JwsPreviewPool *pool)
+{
+  jws_preview_stats_set_queue_depth (pool->visible_queue.length
+                                     + pool->normal_queue.length
+                                     + pool->refine_queue.length);
+}
+
+static JwsPreviewJob *
+jws_preview_pool_take_job (JwsPreviewPool *pool)
+{
+  g_mutex_lock (&pool->queue_mutex);
+
+  GList *link;
+  link = g_queue_pop_head_link (&pool->visible_queue);
+
+  if (!link)
+    link = g_queue_pop_head_link (&pool->normal_queue);
+
+  if (!link)
+    link = g_queue_pop_head_link (&pool->refine_queue);
+
+  JwsPreviewJob *job = NULL;
+
+  if (link)
+    {
+      job = link->data;
+      job->queue = NULL;
+      jws_preview_pool_update_queue_depth (pool);
+    }
+
+  g_mutex_unlock (&pool->queue_mutex);
+
+  return job;
+}
+
+static void
+jws_preview_pool_run_job (gpointer token, gpointer pool_ptr)
+{
+  JwsPreviewPool *pool = pool_ptr;
+
+  JwsPreviewJob *job;
+  job = jws_preview_pool_take_job (pool);
+
+  if (!job)
+    return;
+
+  /* This is the cheap check that keeps a reload from decoding everything
+   * that was queued before it.  */
+  if (!jws_preview_pool_is_job_cancelled (pool, job))
+    {
+      if (job->check_preview && jws_preview_pool_is_check_current (job))
+        {
+          job->preview = g_steal_pointer (&job->check_preview);
+          job->quality = JWS_PREVIEW_QUALITY_HIGH;
+        }
+      else
+        {
+          g_clear_object (&job->check_preview);
+          job->preview = jws_preview_load (job->path,
+                                           pool->preview_height,
+                                           pool->load_flags,
+                                           &job->quality,
+                                           &job->mtime,
+                                           job->cancellable,
+                                           NULL);
+        }
+    }
+
+  /* Even dropped jobs go back to the main thread because the job data, a row
+   * reference for example, may only be safe to free there.  */
+  g_mutex_lock (&pool->queue_mutex);
+
+  g_queue_push_tail_link (&pool->finished_queue, &job->link);
+
+  if (!pool->deliver_source)
+    {
+      pool->deliver_source
+        = g_timeout_add_full (G_PRIORITY_DEFAULT_IDLE,
+                              JWS_PREVIEW_POOL_DELIVER_INTERVAL,
+                              jws_preview_pool_deliver_jobs,
+                              jws_preview_pool_ref (pool),
+                              (GDestroyNotify) jws_preview_pool_unref);
+    }
+
+  g_mutex_unlock (&pool->queue_mutex);
+}
+
+static gboolean
+jws_preview_pool_is_check_current (JwsPreviewJob *job)
+{
+  GStatBuf file_info;
+  return (job->mtime >= 0
+          && g_stat (job->path, &file_info) == 0
+          && (gint64) file_info.st_mtime == job->mtime);
+}
+
+static gboolean
+jws_preview_pool_deliver_jobs (gpointer pool_ptr)
+{
+  JwsPreviewPool *pool = pool_ptr;
+
+  /* Take the whole batch at once so the workers can keep adding to the next
+   * one while this runs.  */
+  GQueue batch = G_QUEUE_INIT;
+
+  g_mutex_lock (&pool->queue_mutex);
+  batch = pool->finished_queue;
+  g_queue_init (&pool->finished_queue);
+  pool->deliver_source = 0;
+  g_mutex_unlock (&pool->queue_mutex);
+
+  GList *link;
+  while ((link = g_queue_pop_head_link (&batch)))
+    jws_preview_pool_deliver_job (link->data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+jws_preview_pool_deliver_job (JwsPreviewJob *job)
+{
+  JwsPreviewPool *pool = job->pool;
+
+  /* Cancelling happens in the main thread too, so a job that isn't cancelled
+   * by now still has somewhere to go.  */
+  gboolean is_cancelled;
+  is_cancelled = jws_preview_pool_is_job_cancelled (pool, job);
+
+  /* Only a fast preview that worked is worth redoing.  */
+  gboolean is_final;
+  is_final = (is_cancelled
+              || !job->preview
+              || job->quality == JWS_PREVIEW_QUALITY_HIGH);
+
+  if (!is_cancelled && pool->ready_func)
+    {
+      gint64 commit_start = jws_preview_stats_begin ();
+      pool->ready_func (job->path, job->preview, job->mtime, is_final,
+                        job->data, pool->user_data);
+      jws_preview_stats_end (JWS_PREVIEW_STAGE_COMMIT, commit_start);
+
+      if (is_final)
+        jws_preview_stats_end (JWS_PREVIEW_STAGE_LATENCY, job->queued_time);
+    }
+
+  if (!is_final)
+    {
+      g_clear_object (&job->preview);
+      job->quality = JWS_PREVIEW_QUALITY_HIGH;
+
+      g_mutex_lock (&pool->queue_mutex);
+      job->queue = &pool->refine_queue;
+      g_queue_push_tail_link (job->queue, &job->link);
+      jws_preview_pool_update_queue_depth (pool);
+      g_mutex_unlock (&pool->queue_mutex);
+
+      g_thread_pool_push (pool->thread_pool, JWS_PREVIEW_POOL_TOKEN, NULL);
+      return;
+    }
+
+  /* The handle may be kept around for a long time after this, but the
+   * preview belongs to whoever the ready function gave it to now.  */
+  g_clear_object (&job->preview);
+
+  if (job->data_free)
+    job->data_free (job->data);
+  job->data = NULL;
+
+  job->pool = NULL;
+  jws_preview_pool_unref (pool);
+
+  jws_preview_job_unref (job);
+}
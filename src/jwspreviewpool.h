@@ -0,0 +1,149 @@
+/* jwspreviewpool.h - header for the preview worker pool
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef JWSPREVIEWPOOL_H
+#define JWSPREVIEWPOOL_H
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gio/gio.h>
+
+#include "jwspreview.h"
+
+/* Loads previews for image files on a pool of worker threads.  Jobs are
+ * pushed from the main thread and the results are handed back to the main
+ * loop through the ready function, so the caller never has to deal with
+ * threads itself.  Finished jobs are collected and handed back in batches, at
+ * most once per frame, so a burst of fast loads doesn't redraw the tree for
+ * every single one.  Waiting jobs are taken in order, but the ones for rows the
+ * user can see can be moved ahead of the rest with
+ * jws_preview_pool_set_priority ().
+ *
+ * In progressive mode, each preview is first made with fast scaling and
+ * delivered right away.  The job then waits in a third queue that is only
+ * looked at once the others are empty, and the preview is made again with
+ * good scaling and delivered a second time.  Previews made from a cached
+ * thumbnail, or an embedded one big enough, are good right away and only
+ * delivered once.
+ *
+ * Jobs can be cancelled one at a time, through a GCancellable shared by a
+ * group of them, or all at once by starting a new generation.  None of these
+ * touch the queues, a cancelled job is just dropped without any I/O when a
+ * worker gets to it, and a load that's already running stops early if its
+ * GCancellable is cancelled.  The ready function is never called for a
+ * cancelled job.  */
+typedef struct _JwsPreviewPool JwsPreviewPool;
+
+/* A handle to a queued preview, reference counted so it can be stored in a
+ * tree model column.  */
+typedef struct _JwsPreviewJob JwsPreviewJob;
+
+#define JWS_TYPE_PREVIEW_JOB (jws_preview_job_get_type ())
+
+typedef enum _JwsPreviewPriority JwsPreviewPriority;
+
+enum _JwsPreviewPriority
+{
+  JWS_PREVIEW_PRIORITY_NORMAL = 0,
+  /* Taken before any normal job, for rows that are on screen or close.  */
+  JWS_PREVIEW_PRIORITY_VISIBLE
+};
+
+/* Called from the main loop each time a job has a preview, which is twice in
+ * progressive mode.  preview is NULL if the file couldn't be loaded and is
+ * owned by the pool, so reference it if you want to keep it.  mtime is the
+ * modification time the file had when the preview was made, in seconds, or
+ * -1 if it isn't known.  is_final is FALSE if a better preview is coming
+ * later.  job_data is the data passed to jws_preview_pool_push () and is
+ * freed after the final call.  */
+typedef void (*JwsPreviewReadyFunc) (const gchar *path,
+                                     GdkPixbuf *preview,
+                                     gint64 mtime,
+                                     gboolean is_final,
+                                     gpointer job_data,
+                                     gpointer user_data);
+
+GType
+jws_preview_job_get_type (void);
+
+JwsPreviewJob *
+jws_preview_job_ref (JwsPreviewJob *job);
+
+void
+jws_preview_job_unref (JwsPreviewJob *job);
+
+/* If n_threads is zero or less, one thread per processor is used.  */
+JwsPreviewPool *
+jws_preview_pool_new (int n_threads,
+                      int preview_height,
+                      JwsPreviewReadyFunc ready_func,
+                      gpointer user_data);
+
+/* Waits for the threads to stop.  Jobs that haven't finished are dropped and
+ * the ready function isn't called for them anymore.  */
+void
+jws_preview_pool_free (JwsPreviewPool *pool);
+
+int
+jws_preview_pool_get_n_threads (JwsPreviewPool *pool);
+
+/* Queues a preview for the file at path with normal priority.  job_data is
+ * given back to the ready function and freed with job_data_free, always in the
+ * main thread.  cancellable may be NULL.  Returns a handle to the job, free it
+ * with jws_preview_job_unref ().  */
+JwsPreviewJob *
+jws_preview_pool_push (JwsPreviewPool *pool,
+                       const gchar *path,
+                       GCancellable *cancellable,
+                       gpointer job_data,
+                       GDestroyNotify job_data_free);
+
+/* Like jws_preview_pool_push (), for a file that already has preview, which
+ * was made when the file's modification time was mtime.  The worker only
+ * reads the file's time, and hands preview back as final if it's the same,
+ * so a preview from a cache can be checked without holding up the main
+ * loop.  If the file changed, a new preview is loaded like for any other
+ * job.  */
+JwsPreviewJob *
+jws_preview_pool_push_check (JwsPreviewPool *pool,
+                             const gchar *path,
+                             gint64 mtime,
+                             GdkPixbuf *preview,
+                             GCancellable *cancellable,
+                             gpointer job_data,
+                             GDestroyNotify job_data_free);
+
+/* Cancels a single job.  */
+void
+jws_preview_pool_cancel_job (JwsPreviewPool *pool, JwsPreviewJob *job);
+
+/* Cancels every job pushed so far.  */
+void
+jws_preview_pool_cancel_all (JwsPreviewPool *pool);
+
+/* Moves a waiting job to the back of the queue for priority.  Jobs that are
+ * promoted are taken in the order they were promoted, and jobs that are
+ * demoted go to the front of the normal queue since they were just close to
+ * the screen.  Does nothing if the job has already been started or is waiting
+ * to be redone with better scaling.  */
+void
+jws_preview_pool_set_priority (JwsPreviewPool *pool,
+                               JwsPreviewJob *job,
+                               JwsPreviewPriority priority);
+
+#endif /* JWSPREVIEWPOOL_H */
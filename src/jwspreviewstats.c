@@ -0,0 +1,300 @@
+/* jwspreviewstats.c - preview loading statistics
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "jwspreviewstats.h"
+
+/* Bucket i holds times from 2^i up to 2^(i + 1) microseconds, the last one
+ * holds everything over about half a minute.  */
+#define JWS_PREVIEW_STATS_N_BUCKETS 25
+
+/* How wide the longest bar in a histogram is.  */
+#define JWS_PREVIEW_STATS_BAR_WIDTH 40
+
+typedef struct _JwsPreviewStageStats JwsPreviewStageStats;
+
+struct _JwsPreviewStageStats
+{
+  guint64 count;
+  gint64 total_time;
+  gint64 max_time;
+  guint64 buckets[JWS_PREVIEW_STATS_N_BUCKETS];
+};
+
+static gint jws_preview_stats_enabled = FALSE;
+
+/* Everything below is protected by the mutex.  */
+static GMutex jws_preview_stats_mutex;
+static JwsPreviewStageStats jws_preview_stats_stages[JWS_PREVIEW_N_STAGES];
+static guint64 jws_preview_stats_n_queued = 0;
+static gint64 jws_preview_stats_first_queued_time = 0;
+static gint64 jws_preview_stats_last_done_time = 0;
+static guint jws_preview_stats_queue_depth = 0;
+static guint jws_preview_stats_max_queue_depth = 0;
+
+static const gchar *
+jws_preview_stats_get_stage_name (JwsPreviewStage stage);
+
+static int
+jws_preview_stats_get_bucket (gint64 time);
+
+/* The time below which about fraction of the samples are, rounded up to a
+ * bucket boundary.  */
+static gint64
+jws_preview_stats_get_percentile (JwsPreviewStageStats *stats,
+                                  double fraction);
+
+static void
+jws_preview_stats_append_stage (GString *string,
+                                JwsPreviewStage stage,
+                                JwsPreviewStageStats *stats);
+
+static const gchar *
+jws_preview_stats_get_stage_name (JwsPreviewStage stage)
+{
+  switch (stage)
+    {
+    case JWS_PREVIEW_STAGE_READ:
+      return "read";
+    case JWS_PREVIEW_STAGE_DECODE:
+      return "decode";
+    case JWS_PREVIEW_STAGE_THUMBNAIL_LOOKUP:
+      return "thumbnail lookup";
+    case JWS_PREVIEW_STAGE_EXIF:
+      return "exif";
+    case JWS_PREVIEW_STAGE_THUMBNAIL_STORE:
+      return "thumbnail store";
+    case JWS_PREVIEW_STAGE_SCALE:
+      return "scale";
+    case JWS_PREVIEW_STAGE_COMMIT:
+      return "commit";
+    case JWS_PREVIEW_STAGE_LATENCY:
+      return "latency";
+    default:
+      return "unknown";
+    }
+}
+
+void
+jws_preview_stats_set_enabled (gboolean enabled)
+{
+  g_atomic_int_set (&jws_preview_stats_enabled, enabled);
+}
+
+gboolean
+jws_preview_stats_get_enabled (void)
+{
+  return g_atomic_int_get (&jws_preview_stats_enabled);
+}
+
+gint64
+jws_preview_stats_begin (void)
+{
+  if (!g_atomic_int_get (&jws_preview_stats_enabled))
+    return 0;
+
+  return g_get_monotonic_time ();
+}
+
+static int
+jws_preview_stats_get_bucket (gint64 time)
+{
+  int bucket = 0;
+  while (time > 1 && bucket < JWS_PREVIEW_STATS_N_BUCKETS - 1)
+    {
+      time >>= 1;
+      bucket++;
+    }
+  return bucket;
+}
+
+void
+jws_preview_stats_end (JwsPreviewStage stage, gint64 start)
+{
+  if (start == 0)
+    return;
+
+  jws_preview_stats_record (stage, jws_preview_stats_elapsed (start));
+}
+
+gint64
+jws_preview_stats_elapsed (gint64 start)
+{
+  if (start == 0)
+    return 0;
+
+  return MAX (g_get_monotonic_time () - start, 0);
+}
+
+void
+jws_preview_stats_record (JwsPreviewStage stage, gint64 time)
+{
+  if (!g_atomic_int_get (&jws_preview_stats_enabled)
+      || stage >= JWS_PREVIEW_N_STAGES)
+    return;
+
+  gint64 now = g_get_monotonic_time ();
+
+  g_mutex_lock (&jws_preview_stats_mutex);
+
+  JwsPreviewStageStats *stats = &jws_preview_stats_stages[stage];
+  stats->count++;
+  stats->total_time += time;
+  stats->max_time = MAX (stats->max_time, time);
+  stats->buckets[jws_preview_stats_get_bucket (time)]++;
+
+  if (stage == JWS_PREVIEW_STAGE_LATENCY)
+    jws_preview_stats_last_done_time = now;
+
+  g_mutex_unlock (&jws_preview_stats_mutex);
+}
+
+void
+jws_preview_stats_job_queued (void)
+{
+  if (!g_atomic_int_get (&jws_preview_stats_enabled))
+    return;
+
+  g_mutex_lock (&jws_preview_stats_mutex);
+
+  if (jws_preview_stats_n_queued == 0)
+    jws_preview_stats_first_queued_time = g_get_monotonic_time ();
+  jws_preview_stats_n_queued++;
+
+  g_mutex_unlock (&jws_preview_stats_mutex);
+}
+
+void
+jws_preview_stats_set_queue_depth (guint depth)
+{
+  if (!g_atomic_int_get (&jws_preview_stats_enabled))
+    return;
+
+  g_mutex_lock (&jws_preview_stats_mutex);
+
+  jws_preview_stats_queue_depth = depth;
+  jws_preview_stats_max_queue_depth = MAX (jws_preview_stats_max_queue_depth,
+                                           depth);
+
+  g_mutex_unlock (&jws_preview_stats_mutex);
+}
+
+static gint64
+jws_preview_stats_get_percentile (JwsPreviewStageStats *stats,
+                                  double fraction)
+{
+  guint64 target = (guint64) (stats->count * fraction + 0.5);
+  guint64 seen = 0;
+
+  for (int i = 0; i < JWS_PREVIEW_STATS_N_BUCKETS; i++)
+    {
+      seen += stats->buckets[i];
+      if (seen >= target)
+        return MIN ((gint64) 1 << (i + 1), stats->max_time);
+    }
+
+  return stats->max_time;
+}
+
+static void
+jws_preview_stats_append_stage (GString *string,
+                                JwsPreviewStage stage,
+                                JwsPreviewStageStats *stats)
+{
+  g_string_append_printf (string, "%s: %" G_GUINT64_FORMAT " samples",
+                          jws_preview_stats_get_stage_name (stage),
+                          stats->count);
+
+  if (stats->count == 0)
+    {
+      g_string_append (string, "\n");
+      return;
+    }
+
+  g_string_append_printf (string,
+                          ", total %.3f s, mean %.3f ms, p50 < %.3f ms, "
+                          "p95 < %.3f ms, p99 < %.3f ms, max %.3f ms\n",
+                          stats->total_time / 1e6,
+                          stats->total_time / 1e3 / stats->count,
+                          jws_preview_stats_get_percentile (stats, 0.5) / 1e3,
+                          jws_preview_stats_get_percentile (stats, 0.95) / 1e3,
+                          jws_preview_stats_get_percentile (stats, 0.99) / 1e3,
+                          stats->max_time / 1e3);
+
+  guint64 largest = 0;
+  for (int i = 0; i < JWS_PREVIEW_STATS_N_BUCKETS; i++)
+    largest = MAX (largest, stats->buckets[i]);
+
+  for (int i = 0; i < JWS_PREVIEW_STATS_N_BUCKETS; i++)
+    {
+      if (stats->buckets[i] == 0)
+        continue;
+
+      int width = (int) (stats->buckets[i] * JWS_PREVIEW_STATS_BAR_WIDTH
+                         / largest);
+      g_string_append_printf (string, "  < %10.3f ms %10" G_GUINT64_FORMAT
+                              " ",
+                              ((gint64) 1 << (i + 1)) / 1e3,
+                              stats->buckets[i]);
+      for (int j = 0; j < MAX (width, 1); j++)
+        g_string_append_c (string, '#');
+      g_string_append_c (string, '\n');
+    }
+}
+
+gchar *
+jws_preview_stats_to_string (void)
+{
+  GString *string;
+  string = g_string_new (NULL);
+
+  g_mutex_lock (&jws_preview_stats_mutex);
+
+  guint64 n_done;
+  n_done = jws_preview_stats_stages[JWS_PREVIEW_STAGE_LATENCY].count;
+
+  g_string_append_printf (string,
+                          "Preview statistics\n"
+                          "jobs queued: %" G_GUINT64_FORMAT
+                          ", finished: %" G_GUINT64_FORMAT "\n"
+                          "queue depth: %u, max %u\n",
+                          jws_preview_stats_n_queued,
+                          n_done,
+                          jws_preview_stats_queue_depth,
+                          jws_preview_stats_max_queue_depth);
+
+  if (n_done > 0
+      && jws_preview_stats_last_done_time
+      > jws_preview_stats_first_queued_time)
+    {
+      double seconds = (jws_preview_stats_last_done_time
+                        - jws_preview_stats_first_queued_time) / 1e6;
+      g_string_append_printf (string,
+                              "throughput: %.1f images/s over %.3f s\n",
+                              n_done / seconds,
+                              seconds);
+    }
+
+  for (int i = 0; i < JWS_PREVIEW_N_STAGES; i++)
+    jws_preview_stats_append_stage (string, i,
+                                    &jws_preview_stats_stages[i]);
+
+  g_mutex_unlock (&jws_preview_stats_mutex);
+
+  return g_string_free (string, FALSE);
+}
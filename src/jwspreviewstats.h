@@ -0,0 +1,89 @@
+/* jwspreviewstats.h - header for preview loading statistics
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef JWSPREVIEWSTATS_H
+#define JWSPREVIEWSTATS_H
+
+#include <glib.h>
+
+/* Timings for each step of loading previews, to tell whether slow previews
+ * come from the disk, the decoder or scaling.  Nothing is recorded until
+ * jws_preview_stats_set_enabled () is called, so the rest of the time this
+ * costs one atomic read per step.  Everything here is thread safe.  */
+
+typedef enum _JwsPreviewStage JwsPreviewStage;
+
+enum _JwsPreviewStage
+{
+  /* Reading an image file, one sample per image.  */
+  JWS_PREVIEW_STAGE_READ = 0,
+  /* Feeding it to the decoder, one sample per image.  */
+  JWS_PREVIEW_STAGE_DECODE,
+  /* Looking up thumbnails in the thumbnail cache.  */
+  JWS_PREVIEW_STAGE_THUMBNAIL_LOOKUP,
+  /* Reading thumbnails embedded in EXIF data.  */
+  JWS_PREVIEW_STAGE_EXIF,
+  /* Saving thumbnails to the thumbnail cache.  */
+  JWS_PREVIEW_STAGE_THUMBNAIL_STORE,
+  /* Scaling decoded images to preview size.  */
+  JWS_PREVIEW_STAGE_SCALE,
+  /* Putting finished previews in the tree, in the main thread.  */
+  JWS_PREVIEW_STAGE_COMMIT,
+  /* From queueing a job to its final preview being committed.  */
+  JWS_PREVIEW_STAGE_LATENCY,
+  JWS_PREVIEW_N_STAGES
+};
+
+void
+jws_preview_stats_set_enabled (gboolean enabled);
+
+gboolean
+jws_preview_stats_get_enabled (void);
+
+/* Returns the current time to pass to jws_preview_stats_end (), or 0 if
+ * statistics are off.  */
+gint64
+jws_preview_stats_begin (void);
+
+/* Records the time since start for stage, unless start is 0.  */
+void
+jws_preview_stats_end (JwsPreviewStage stage, gint64 start);
+
+/* Returns the time since start, or 0 if start is 0, for a step done in
+ * pieces that add up to one sample.  */
+gint64
+jws_preview_stats_elapsed (gint64 start);
+
+/* Records time as one sample for stage, if statistics are on.  */
+void
+jws_preview_stats_record (JwsPreviewStage stage, gint64 time);
+
+/* Records that a job was queued, for the throughput.  */
+void
+jws_preview_stats_job_queued (void);
+
+/* Records how many jobs are waiting for a worker right now.  */
+void
+jws_preview_stats_set_queue_depth (guint depth);
+
+/* A readable summary with a histogram for each stage.  Free with g_free ().  */
+gchar *
+jws_preview_stats_to_string (void);
+
+#endif /* JWSPREVIEWSTATS_H */
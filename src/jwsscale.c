@@ -0,0 +1,342 @@
+/* jwsscale.c - box filter used to shrink previews
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "jwsscale.h"
+
+#include <string.h>
+
+#include "jwspreferences.h"
+
+/* The vector versions need GCC or Clang style target attributes, which lets
+ * them live next to the plain one without building the whole program for a
+ * newer CPU.  */
+#if (defined (__x86_64__) || defined (__i386__)) && defined (__GNUC__)
+#define JWS_SCALE_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/* Adds n bytes of a source row to a row of sums.  */
+typedef void (*JwsScaleAccumulateFunc) (guint32 *sums,
+                                        const guchar *row,
+                                        gsize n);
+
+/* Set once from the preference or by jws_scale_set_impl (), accessed
+ * atomically.  -1 means it hasn't been set yet.  */
+static gint jws_scale_impl = -1;
+
+static void
+jws_scale_accumulate_scalar (guint32 *sums, const guchar *row, gsize n);
+
+#ifdef JWS_SCALE_HAVE_X86
+static void
+jws_scale_accumulate_sse2 (guint32 *sums, const guchar *row, gsize n);
+
+static void
+jws_scale_accumulate_avx2 (guint32 *sums, const guchar *row, gsize n);
+#endif
+
+static gboolean
+jws_scale_is_impl_supported (JwsScaleImpl impl);
+
+static void
+jws_scale_accumulate_scalar (guint32 *sums, const guchar *row, gsize n)
+{
+  for (gsize i = 0; i < n; i++)
+    sums[i] += row[i];
+}
+
+#ifdef JWS_SCALE_HAVE_X86
+__attribute__ ((target ("sse2")))
+static void
+jws_scale_accumulate_sse2 (guint32 *sums, const guchar *row, gsize n)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  gsize i = 0;
+
+  /* Widen 16 bytes at a time to four vectors of 32 bit sums.  */
+  for (; i + 16 <= n; i += 16)
+    {
+      __m128i bytes = _mm_loadu_si128 ((const __m128i *) (row + i));
+      __m128i low = _mm_unpacklo_epi8 (bytes, zero);
+      __m128i high = _mm_unpackhi_epi8 (bytes, zero);
+
+      __m128i *dest = (__m128i *) (sums + i);
+
+      _mm_storeu_si128 (dest,
+                        _mm_add_epi32 (_mm_loadu_si128 (dest),
+                                       _mm_unpacklo_epi16 (low, zero)));
+      _mm_storeu_si128 (dest + 1,
+                        _mm_add_epi32 (_mm_loadu_si128 (dest + 1),
+                                       _mm_unpackhi_epi16 (low, zero)));
+      _mm_storeu_si128 (dest + 2,
+                        _mm_add_epi32 (_mm_loadu_si128 (dest + 2),
+                                       _mm_unpacklo_epi16 (high, zero)));
+      _mm_storeu_si128 (dest + 3,
+                        _mm_add_epi32 (_mm_loadu_si128 (dest + 3),
+                                       _mm_unpackhi_epi16 (high, zero)));
+    }
+
+  for (; i < n; i++)
+    sums[i] += row[i];
+}
+
+__attribute__ ((target ("avx2")))
+static void
+jws_scale_accumulate_avx2 (guint32 *sums, const guchar *row, gsize n)
+{
+  gsize i = 0;
+
+  for (; i + 16 <= n; i += 16)
+    {
+      __m128i bytes = _mm_loadu_si128 ((const __m128i *) (row + i));
+      __m256i low = _mm256_cvtepu8_epi32 (bytes);
+      __m256i high = _mm256_cvtepu8_epi32 (_mm_srli_si128 (bytes, 8));
+
+      __m256i *dest = (__m256i *) (sums + i);
+
+      _mm256_storeu_si256 (dest,
+                           _mm256_add_epi32 (_mm256_loadu_si256 (dest), low));
+      _mm256_storeu_si256 (dest + 1,
+                           _mm256_add_epi32 (_mm256_loadu_si256 (dest + 1),
+                                             high));
+    }
+
+  for (; i < n; i++)
+    sums[i] += row[i];
+}
+#endif /* JWS_SCALE_HAVE_X86 */
+
+static gboolean
+jws_scale_is_impl_supported (JwsScaleImpl impl)
+{
+  switch (impl)
+    {
+    case JWS_SCALE_IMPL_NONE:
+    case JWS_SCALE_IMPL_SCALAR:
+      return TRUE;
+#ifdef JWS_SCALE_HAVE_X86
+    case JWS_SCALE_IMPL_SSE2:
+      return __builtin_cpu_supports ("sse2");
+    case JWS_SCALE_IMPL_AVX2:
+      return __builtin_cpu_supports ("avx2");
+#endif
+    default:
+      return FALSE;
+    }
+}
+
+JwsScaleImpl
+jws_scale_get_best_impl (void)
+{
+  if (jws_scale_is_impl_supported (JWS_SCALE_IMPL_AVX2))
+    return JWS_SCALE_IMPL_AVX2;
+  if (jws_scale_is_impl_supported (JWS_SCALE_IMPL_SSE2))
+    return JWS_SCALE_IMPL_SSE2;
+  return JWS_SCALE_IMPL_SCALAR;
+}
+
+JwsScaleImpl
+jws_scale_get_impl (void)
+{
+  gint impl;
+  impl = g_atomic_int_get (&jws_scale_impl);
+
+  if (impl >= 0)
+    return impl;
+
+  gchar *name;
+  name = jws_preferences_get_string (JWS_PREFERENCES_GROUP_PREVIEWS,
+                                     JWS_PREFERENCES_KEY_SCALER,
+                                     "auto");
+
+  JwsScaleImpl from_name = JWS_SCALE_IMPL_NONE;
+  if (!jws_scale_impl_from_string (name, &from_name)
+      || !jws_scale_is_impl_supported (from_name))
+    from_name = jws_scale_get_best_impl ();
+
+  g_free (name);
+
+  /* Two threads may get here at the same time, but they come up with the same
+   * answer unless jws_scale_set_impl () was called, which should win.  */
+  g_atomic_int_compare_and_exchange (&jws_scale_impl, -1, from_name);
+
+  return g_atomic_int_get (&jws_scale_impl);
+}
+
+void
+jws_scale_set_impl (JwsScaleImpl impl)
+{
+  if (!jws_scale_is_impl_supported (impl))
+    impl = jws_scale_get_best_impl ();
+
+  g_atomic_int_set (&jws_scale_impl, impl);
+}
+
+const gchar *
+jws_scale_impl_to_string (JwsScaleImpl impl)
+{
+  switch (impl)
+    {
+    case JWS_SCALE_IMPL_NONE:
+      return "none";
+    case JWS_SCALE_IMPL_SCALAR:
+      return "scalar";
+    case JWS_SCALE_IMPL_SSE2:
+      return "sse2";
+    case JWS_SCALE_IMPL_AVX2:
+      return "avx2";
+    default:
+      return "unknown";
+    }
+}
+
+gboolean
+jws_scale_impl_from_string (const gchar *name, JwsScaleImpl *impl)
+{
+  if (!name)
+    return FALSE;
+
+  if (g_ascii_strcasecmp (name, "auto") == 0)
+    *impl = jws_scale_get_best_impl ();
+  else if (g_ascii_strcasecmp (name, "none") == 0)
+    *impl = JWS_SCALE_IMPL_NONE;
+  else if (g_ascii_strcasecmp (name, "scalar") == 0)
+    *impl = JWS_SCALE_IMPL_SCALAR;
+  else if (g_ascii_strcasecmp (name, "sse2") == 0)
+    *impl = JWS_SCALE_IMPL_SSE2;
+  else if (g_ascii_strcasecmp (name, "avx2") == 0)
+    *impl = JWS_SCALE_IMPL_AVX2;
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+GdkPixbuf *
+jws_scale_box_reduce (GdkPixbuf *src, int min_width, int min_height)
+{
+  return jws_scale_box_reduce_with_impl (src, min_width, min_height,
+                                         jws_scale_get_impl ());
+}
+
+GdkPixbuf *
+jws_scale_box_reduce_with_impl (GdkPixbuf *src,
+                                int min_width,
+                                int min_height,
+                                JwsScaleImpl impl)
+{
+  g_return_val_if_fail (GDK_IS_PIXBUF (src), NULL);
+
+  JwsScaleAccumulateFunc accumulate;
+
+  switch (impl)
+    {
+    case JWS_SCALE_IMPL_SCALAR:
+      accumulate = jws_scale_accumulate_scalar;
+      break;
+#ifdef JWS_SCALE_HAVE_X86
+    case JWS_SCALE_IMPL_SSE2:
+      accumulate = jws_scale_accumulate_sse2;
+      break;
+    case JWS_SCALE_IMPL_AVX2:
+      accumulate = jws_scale_accumulate_avx2;
+      break;
+#endif
+    default:
+      return NULL;
+    }
+
+  if (gdk_pixbuf_get_colorspace (src) != GDK_COLORSPACE_RGB
+      || gdk_pixbuf_get_bits_per_sample (src) != 8)
+    return NULL;
+
+  int n_channels = gdk_pixbuf_get_n_channels (src);
+  int src_width = gdk_pixbuf_get_width (src);
+  int src_height = gdk_pixbuf_get_height (src);
+  int src_stride = gdk_pixbuf_get_rowstride (src);
+
+  int x_factor = src_width / MAX (min_width, 1);
+  int y_factor = src_height / MAX (min_height, 1);
+
+  if (x_factor < 1)
+    x_factor = 1;
+  if (y_factor < 1)
+    y_factor = 1;
+
+  if (x_factor < 2 && y_factor < 2)
+    return NULL;
+
+  /* The last few columns and rows that don't fill a whole block are left
+   * out, which is at most one block's worth and never shows at preview
+   * size.  */
+  int dest_width = src_width / x_factor;
+  int dest_height = src_height / y_factor;
+
+  GdkPixbuf *dest;
+  dest = gdk_pixbuf_new (GDK_COLORSPACE_RGB,
+                         gdk_pixbuf_get_has_alpha (src),
+                         8,
+                         dest_width,
+                         dest_height);
+  if (!dest)
+    return NULL;
+
+  int dest_stride = gdk_pixbuf_get_rowstride (dest);
+  const guchar *src_pixels = gdk_pixbuf_read_pixels (src);
+  guchar *dest_pixels = gdk_pixbuf_get_pixels (dest);
+
+  gsize row_length = (gsize) dest_width * x_factor * n_channels;
+  guint32 *sums;
+  sums = g_new (guint32, row_length);
+
+  guint32 area = (guint32) x_factor * y_factor;
+
+  /* Alpha is averaged like the other channels instead of weighting colors by
+   * it, which only makes a difference at the edges of transparent areas.  */
+  for (int y = 0; y < dest_height; y++)
+    {
+      memset (sums, 0, row_length * sizeof (guint32));
+
+      /* This is where nearly all the time goes, one pass over every source
+       * byte, so it's the part that's vectorized.  */
+      const guchar *src_row = src_pixels + (gsize) y * y_factor * src_stride;
+      for (int i = 0; i < y_factor; i++)
+        accumulate (sums, src_row + (gsize) i * src_stride, row_length);
+
+      guchar *dest_row = dest_pixels + (gsize) y * dest_stride;
+      const guint32 *block = sums;
+
+      for (int x = 0; x < dest_width; x++)
+        {
+          for (int c = 0; c < n_channels; c++)
+            {
+              guint32 total = 0;
+              for (int i = 0; i < x_factor; i++)
+                total += block[i * n_channels + c];
+
+              dest_row[x * n_channels + c] = (total + area / 2) / area;
+            }
+          block += x_factor * n_channels;
+        }
+    }
+
+  g_free (sums);
+
+  return dest;
+}
@@ -0,0 +1,82 @@
+/* jwsscale.h - header for the box filter used to shrink previews
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef JWSSCALE_H
+#define JWSSCALE_H
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/* gdk_pixbuf_scale_simple () looks at every source pixel for every
+ * destination pixel it touches, which gets slow when a 4K image is shrunk to
+ * a 100 pixel preview.  Most of that reduction can be done much faster by
+ * averaging whole blocks of pixels, leaving only a small final step for
+ * GdkPixbuf.  The block averaging has SSE2 and AVX2 versions that are picked
+ * at runtime, and a plain C one for everything else.  */
+
+typedef enum _JwsScaleImpl JwsScaleImpl;
+
+enum _JwsScaleImpl
+{
+  /* Don't use the box filter at all, leave everything to GdkPixbuf.  */
+  JWS_SCALE_IMPL_NONE = 0,
+  JWS_SCALE_IMPL_SCALAR,
+  JWS_SCALE_IMPL_SSE2,
+  JWS_SCALE_IMPL_AVX2
+};
+
+/* The fastest version this CPU can run.  */
+JwsScaleImpl
+jws_scale_get_best_impl (void);
+
+/* The version jws_scale_box_reduce () uses.  Unless it was set with
+ * jws_scale_set_impl (), it comes from the Scaler preference and defaults to
+ * the best one.  */
+JwsScaleImpl
+jws_scale_get_impl (void);
+
+/* Versions the CPU can't run fall back to the best one it can.  */
+void
+jws_scale_set_impl (JwsScaleImpl impl);
+
+/* Names used for the Scaler preference, "none", "scalar", "sse2" and "avx2".
+ */
+const gchar *
+jws_scale_impl_to_string (JwsScaleImpl impl);
+
+/* Returns FALSE if name isn't one of the names above.  */
+gboolean
+jws_scale_impl_from_string (const gchar *name, JwsScaleImpl *impl);
+
+/* Shrinks src by whole factors, averaging each block of pixels, so that the
+ * result is as small as possible while still at least min_width by
+ * min_height.  Returns NULL if it can't be shrunk by at least two in some
+ * direction, if the format isn't 8 bit RGB or RGBA or if the box filter is
+ * turned off.  Otherwise returns a new pixbuf, free with g_object_unref ().  */
+GdkPixbuf *
+jws_scale_box_reduce (GdkPixbuf *src, int min_width, int min_height);
+
+/* Same as jws_scale_box_reduce () with a specific version, which must be
+ * supported by the CPU.  */
+GdkPixbuf *
+jws_scale_box_reduce_with_impl (GdkPixbuf *src,
+                                int min_width,
+                                int min_height,
+                                JwsScaleImpl impl);
+
+#endif /* JWSSCALE_H */
@@ -0,0 +1,317 @@
+/* jwsscaletest.c - checks the box filter versions against each other
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <string.h>
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "jwsscale.h"
+
+/* How far the plain C version may be from GdkPixbuf's own box filter over
+ * the same blocks, on average per channel.  They round differently, but
+ * anything more than that is a real mistake.  */
+#define JWS_SCALE_TEST_MAX_MEAN_DIFFERENCE 1.0
+
+typedef struct _JwsScaleTestCase JwsScaleTestCase;
+
+struct _JwsScaleTestCase
+{
+  const gchar *name;
+  int width;
+  int height;
+  gboolean has_alpha;
+  int min_width;
+  int min_height;
+};
+
+/* Odd sizes, rows whose length isn't a multiple of any vector width, factors
+ * that don't divide the size and factors of 1 in one direction.  */
+static const JwsScaleTestCase jws_scale_test_cases[] =
+  {
+    {"rgb-odd", 1001, 677, FALSE, 300, 200},
+    {"rgba-odd", 1001, 677, TRUE, 300, 200},
+    {"rgb-tiny", 37, 29, FALSE, 5, 4},
+    {"rgba-tiny", 37, 29, TRUE, 5, 4},
+    {"rgb-wide", 4097, 3, FALSE, 100, 1},
+    {"rgba-tall", 3, 1001, TRUE, 1, 100},
+    {"rgb-4k", 3840, 2160, FALSE, 177, 100},
+    {"rgba-4k", 3840, 2160, TRUE, 177, 100},
+    {"rgb-rows-only", 333, 777, FALSE, 333, 100},
+    {"rgba-columns-only", 777, 333, TRUE, 100, 333}
+  };
+
+/* Noise in every channel, alpha included unless is_opaque, so any byte
+ * that's summed wrong shows.  */
+static GdkPixbuf *
+jws_scale_test_create_image (int width,
+                             int height,
+                             gboolean has_alpha,
+                             gboolean is_opaque);
+
+/* Every version the CPU can run gives the same bytes as the plain C one.  */
+static void
+test_scale_impls_match (gconstpointer test_case);
+
+/* The same with a source that starts at an odd offset into a bigger image,
+ * so nothing is aligned.  */
+static void
+test_scale_impls_match_unaligned (gconstpointer test_case);
+
+/* The plain C version is close to GdkPixbuf's box filter over the blocks it
+ * averages.  */
+static void
+test_scale_matches_gdk_pixbuf (gconstpointer test_case);
+
+static void
+jws_scale_test_check_impls (GdkPixbuf *src, const JwsScaleTestCase *test_case);
+
+static gboolean
+jws_scale_test_is_supported (JwsScaleImpl impl);
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  for (gsize i = 0; i < G_N_ELEMENTS (jws_scale_test_cases); i++)
+    {
+      const JwsScaleTestCase *test_case = &jws_scale_test_cases[i];
+      gchar *path;
+
+      path = g_strdup_printf ("/scale/impls-match/%s", test_case->name);
+      g_test_add_data_func (path, test_case, test_scale_impls_match);
+      g_free (path);
+
+      path = g_strdup_printf ("/scale/impls-match-unaligned/%s",
+                              test_case->name);
+      g_test_add_data_func (path, test_case,
+                            test_scale_impls_match_unaligned);
+      g_free (path);
+
+      path = g_strdup_printf ("/scale/matches-gdk-pixbuf/%s",
+                              test_case->name);
+      g_test_add_data_func (path, test_case, test_scale_matches_gdk_pixbuf);
+      g_free (path);
+    }
+
+  return g_test_run ();
+}
+
+static GdkPixbuf *
+jws_scale_test_create_image (int width,
+                             int height,
+                             gboolean has_alpha,
+                             gboolean is_opaque)
+{
+  GdkPixbuf *image;
+  image = gdk_pixbuf_new (GDK_COLORSPACE_RGB, has_alpha, 8, width, height);
+  g_assert_nonnull (image);
+
+  int n_channels = gdk_pixbuf_get_n_channels (image);
+  int stride = gdk_pixbuf_get_rowstride (image);
+  guchar *pixels = gdk_pixbuf_get_pixels (image);
+
+  /* Fixed seed so a failure can be reproduced.  */
+  GRand *rand;
+  rand = g_rand_new_with_seed (width * 31 + height);
+
+  for (int y = 0; y < height; y++)
+    {
+      guchar *row = pixels + (gsize) y * stride;
+      for (int i = 0; i < width * n_channels; i++)
+        row[i] = g_rand_int_range (rand, 0, 256);
+
+      if (has_alpha && is_opaque)
+        {
+          for (int x = 0; x < width; x++)
+            row[x * n_channels + 3] = 255;
+        }
+    }
+
+  g_rand_free (rand);
+
+  return image;
+}
+
+static gboolean
+jws_scale_test_is_supported (JwsScaleImpl impl)
+{
+  /* jws_scale_set_impl () falls back for unsupported versions, the same way
+   * the bench finds out.  */
+  jws_scale_set_impl (impl);
+  return jws_scale_get_impl () == impl;
+}
+
+static void
+jws_scale_test_check_impls (GdkPixbuf *src, const JwsScaleTestCase *test_case)
+{
+  GdkPixbuf *expected;
+  expected = jws_scale_box_reduce_with_impl (src,
+                                             test_case->min_width,
+                                             test_case->min_height,
+                                             JWS_SCALE_IMPL_SCALAR);
+  g_assert_nonnull (expected);
+
+  int width = gdk_pixbuf_get_width (expected);
+  int height = gdk_pixbuf_get_height (expected);
+  int n_channels = gdk_pixbuf_get_n_channels (expected);
+
+  JwsScaleImpl impls[] = {JWS_SCALE_IMPL_SSE2, JWS_SCALE_IMPL_AVX2};
+
+  for (gsize i = 0; i < G_N_ELEMENTS (impls); i++)
+    {
+      if (!jws_scale_test_is_supported (impls[i]))
+        {
+          g_test_message ("%s isn't supported, not checked",
+                          jws_scale_impl_to_string (impls[i]));
+          continue;
+        }
+
+      GdkPixbuf *actual;
+      actual = jws_scale_box_reduce_with_impl (src,
+                                               test_case->min_width,
+                                               test_case->min_height,
+                                               impls[i]);
+      g_assert_nonnull (actual);
+      g_assert_cmpint (gdk_pixbuf_get_width (actual), ==, width);
+      g_assert_cmpint (gdk_pixbuf_get_height (actual), ==, height);
+      g_assert_cmpint (gdk_pixbuf_get_n_channels (actual), ==, n_channels);
+
+      /* Row by row, since the padding at the end of each isn't written.  */
+      const guchar *expected_pixels = gdk_pixbuf_read_pixels (expected);
+      const guchar *actual_pixels = gdk_pixbuf_read_pixels (actual);
+      int expected_stride = gdk_pixbuf_get_rowstride (expected);
+      int actual_stride = gdk_pixbuf_get_rowstride (actual);
+
+      for (int y = 0; y < height; y++)
+        {
+          const guchar *expected_row;
+          expected_row = expected_pixels + (gsize) y * expected_stride;
+          const guchar *actual_row;
+          actual_row = actual_pixels + (gsize) y * actual_stride;
+
+          if (memcmp (expected_row, actual_row,
+                      (gsize) width * n_channels) != 0)
+            {
+              g_test_message ("%s differs from scalar in row %d",
+                              jws_scale_impl_to_string (impls[i]), y);
+              g_test_fail ();
+              break;
+            }
+        }
+
+      g_object_unref (actual);
+    }
+
+  g_object_unref (expected);
+}
+
+static void
+test_scale_impls_match (gconstpointer test_case_ptr)
+{
+  const JwsScaleTestCase *test_case = test_case_ptr;
+
+  GdkPixbuf *src;
+  src = jws_scale_test_create_image (test_case->width, test_case->height,
+                                     test_case->has_alpha, FALSE);
+
+  jws_scale_test_check_impls (src, test_case);
+
+  g_object_unref (src);
+}
+
+static void
+test_scale_impls_match_unaligned (gconstpointer test_case_ptr)
+{
+  const JwsScaleTestCase *test_case = test_case_ptr;
+
+  GdkPixbuf *image;
+  image = jws_scale_test_create_image (test_case->width + 1,
+                                       test_case->height + 1,
+                                       test_case->has_alpha, FALSE);
+
+  GdkPixbuf *src;
+  src = gdk_pixbuf_new_subpixbuf (image, 1, 1,
+                                  test_case->width, test_case->height);
+
+  jws_scale_test_check_impls (src, test_case);
+
+  g_object_unref (src);
+  g_object_unref (image);
+}
+
+static void
+test_scale_matches_gdk_pixbuf (gconstpointer test_case_ptr)
+{
+  const JwsScaleTestCase *test_case = test_case_ptr;
+
+  /* GdkPixbuf weights colors by alpha and the box filter doesn't, so the
+   * two only agree on opaque images.  */
+  GdkPixbuf *src;
+  src = jws_scale_test_create_image (test_case->width, test_case->height,
+                                     test_case->has_alpha, TRUE);
+
+  GdkPixbuf *reduced;
+  reduced = jws_scale_box_reduce_with_impl (src,
+                                            test_case->min_width,
+                                            test_case->min_height,
+                                            JWS_SCALE_IMPL_SCALAR);
+  g_assert_nonnull (reduced);
+
+  int width = gdk_pixbuf_get_width (reduced);
+  int height = gdk_pixbuf_get_height (reduced);
+  int n_channels = gdk_pixbuf_get_n_channels (reduced);
+
+  /* The box filter leaves out the columns and rows that don't fill a whole
+   * block, so GdkPixbuf only gets the part that's averaged.  */
+  int x_factor = test_case->width / width;
+  int y_factor = test_case->height / height;
+  GdkPixbuf *blocks;
+  blocks = gdk_pixbuf_new_subpixbuf (src, 0, 0,
+                                     width * x_factor, height * y_factor);
+
+  GdkPixbuf *reference;
+  reference = gdk_pixbuf_scale_simple (blocks, width, height,
+                                       GDK_INTERP_TILES);
+  g_assert_nonnull (reference);
+
+  const guchar *reduced_pixels = gdk_pixbuf_read_pixels (reduced);
+  const guchar *reference_pixels = gdk_pixbuf_read_pixels (reference);
+  int reduced_stride = gdk_pixbuf_get_rowstride (reduced);
+  int reference_stride = gdk_pixbuf_get_rowstride (reference);
+
+  guint64 total = 0;
+  for (int y = 0; y < height; y++)
+    {
+      for (int i = 0; i < width * n_channels; i++)
+        {
+          total += ABS (reduced_pixels[(gsize) y * reduced_stride + i]
+                        - reference_pixels[(gsize) y * reference_stride + i]);
+        }
+    }
+
+  double mean_difference;
+  mean_difference = (double) total / ((double) width * height * n_channels);
+  g_assert_cmpfloat (mean_difference, <=, JWS_SCALE_TEST_MAX_MEAN_DIFFERENCE);
+
+  g_object_unref (reference);
+  g_object_unref (blocks);
+  g_object_unref (reduced);
+  g_object_unref (src);
+}
@@ -0,0 +1,1326 @@
+/* jwsscan.c - scanning directories in the background
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "jwsscan.h"
+
+#include <string.h>
+
+#include "jwspreferences.h"
+#include "jwsscanrules.h"
+
+/* How long found entries are collected before being delivered, in
+ * milliseconds.  */
+#define JWS_SCAN_DELIVERY_INTERVAL 16
+
+#define JWS_SCAN_DEFAULT_THREADS 4
+
+/* Each worker is a thread of its own, so a mistyped Threads can't start
+ * thousands of them.  */
+#define JWS_SCAN_MAX_THREADS 64
+
+/* A directory changed this close to when it was listed, in microseconds,
+ * could change again without its time moving, since file systems keep
+ * times on a coarse clock and FAT, NFS and SMB only to a second or two.
+ * Such listings aren't saved in the index.  */
+#define JWS_SCAN_RACY_INTERVAL (2 * G_USEC_PER_SEC)
+
+/* Everything an entry needs.  The scan rules only look at the name, so
+ * nothing else is asked for, which keeps file systems from reading content
+ * types or permissions for files that are thrown away.  */
+#define JWS_SCAN_ATTRIBUTES                     \
+  G_FILE_ATTRIBUTE_STANDARD_TYPE ","            \
+  G_FILE_ATTRIBUTE_STANDARD_NAME ","            \
+  G_FILE_ATTRIBUTE_TIME_MODIFIED ","            \
+  G_FILE_ATTRIBUTE_UNIX_DEVICE ","              \
+  G_FILE_ATTRIBUTE_UNIX_INODE
+
+typedef struct _JwsScan JwsScan;
+
+/* See JWS_PREFERENCES_KEY_DUPLICATES.  */
+typedef enum
+{
+  JWS_SCAN_DUPLICATES_COLLAPSE,
+  JWS_SCAN_DUPLICATES_SKIP,
+  JWS_SCAN_DUPLICATES_KEEP
+} JwsScanDuplicates;
+
+typedef struct _JwsScanId JwsScanId;
+
+struct _JwsScanId
+{
+  guint64 device;
+  guint64 inode;
+};
+
+typedef struct _JwsScanVisited JwsScanVisited;
+
+/* What a scan has found so far, to tell which directories and files are
+ * repeats.  */
+struct _JwsScanVisited
+{
+  JwsScanDuplicates duplicates;
+  /* The JwsScanIds of the directories a worker has made a listing for,
+   * shared by the workers and protected by the mutex.  Whichever worker gets
+   * to a directory first lists it, so this only keeps a directory from
+   * being listed twice at once and doesn't decide what's a repeat.  */
+  GMutex mutex;
+  GHashTable *claimed;
+  /* The JwsScanIds of the directories, and with "skip" the files, in the
+   * order entries are added, only used by the scanning thread.  The first
+   * copy in that order is the one that keeps its contents.  */
+  GHashTable *seen;
+};
+
+typedef struct _JwsScanDirectory JwsScanDirectory;
+
+/* A directory waiting to be listed, or its listing.  */
+struct _JwsScanDirectory
+{
+  gchar *path;
+  /* 0 for the directory being scanned.  */
+  int depth;
+  /* The directory this one is in, which lives at least as long, or NULL
+   * for the directory being scanned.  */
+  JwsScanDirectory *parent;
+  /* Set by the worker listing it, before any listing for a subdirectory is
+   * made.  */
+  guint64 device;
+  guint64 inode;
+  /* Both are only touched by the worker listing it until done is set, and
+   * by the scanning thread after that.  The JwsScanEntrys are sorted, and
+   * subdirectories has the listing for the entry at the same place, or
+   * NULL.  A directory claimed by another worker has no listing, see
+   * JwsScanVisited.  */
+  GPtrArray *entries;
+  GPtrArray *subdirectories;
+  gboolean done;
+  /* Set by the scanning thread under walk_mutex for a listing that turned
+   * out to be for a repeat, so the workers don't list what's under it.  */
+  gboolean is_discarded;
+  /* Only used by the scanning thread.  Set if a listing somewhere under it
+   * was discarded, since what's under that listing can still be in a deque
+   * and refers to its parents, so they're kept until the workers are
+   * gone.  */
+  gboolean has_discarded;
+};
+
+typedef struct _JwsScanSortItem JwsScanSortItem;
+
+/* An entry with its sort key, worked out once instead of in every
+ * comparison.  */
+struct _JwsScanSortItem
+{
+  gchar *key;
+  JwsScanEntry *entry;
+};
+
+typedef struct _JwsScanFrame JwsScanFrame;
+
+/* A directory the scanning thread is going through, see
+ * jws_scan_add_directory ().  */
+struct _JwsScanFrame
+{
+  JwsScanDirectory *directory;
+  /* The number of the directory's own entry.  */
+  gint parent;
+  guint next_entry;
+};
+
+typedef struct _JwsScanWorker JwsScanWorker;
+
+struct _JwsScanWorker
+{
+  JwsScan *scan;
+  GThread *thread;
+  /* JwsScanDirectorys waiting to be listed.  The worker takes from the tail
+   * and others steal from the head.  */
+  GQueue deque;
+};
+
+struct _JwsScan
+{
+  /* One for the task and one while a delivery is scheduled.  */
+  gint ref_count;
+
+  gchar *path;
+  GCancellable *cancellable;
+  JwsScanBatchFunc batch_func;
+  JwsScanDoneFunc done_func;
+  gpointer user_data;
+  int max_depth;
+  /* Holds a reference, may be NULL.  */
+  JwsIndex *index;
+  JwsScanVisited visited;
+
+  /* Only used by the scanning thread.  */
+  gint n_entries;
+
+  /* The workers listing directories.  Their deques, n_outstanding and the
+   * done flags of the directories are protected by walk_mutex, and
+   * walk_cond is signalled whenever any of them change.  n_outstanding
+   * counts the directories waiting in a deque or being listed, plus one
+   * until the scanning thread is done, since it can add more.  */
+  JwsScanWorker *workers;
+  guint n_workers;
+  GMutex walk_mutex;
+  GCond walk_cond;
+  guint n_outstanding;
+
+  /* Entries found but not delivered yet and the source that delivers them,
+   * protected by the mutex.  */
+  GMutex mutex;
+  GPtrArray *pending;
+  guint deliver_source;
+};
+
+static JwsScan *
+jws_scan_ref (JwsScan *scan);
+
+static void
+jws_scan_unref (JwsScan *scan);
+
+static gint
+compare_sort_items (gconstpointer a, gconstpointer b);
+
+/* Returns the modification time of the directory file in microseconds, or
+ * -1 if it can't be read.  Sets device and inode if they aren't NULL.  */
+static gint64
+jws_scan_query_directory (GFile *file,
+                          GCancellable *cancellable,
+                          guint64 *device,
+                          guint64 *inode);
+
+static JwsScanDuplicates
+jws_scan_get_duplicates ();
+
+static void
+jws_scan_visited_init (JwsScanVisited *visited);
+
+static void
+jws_scan_visited_clear (JwsScanVisited *visited);
+
+/* Whether entry, found in directory, goes in the listing.  Sets is_repeat
+ * if it's a directory inside itself.  Called by the workers.  */
+static gboolean
+jws_scan_visited_check_loop (JwsScanVisited *visited,
+                             JwsScanDirectory *directory,
+                             JwsScanEntry *entry);
+
+/* Whether a worker should make a listing for the directory entry.  */
+static gboolean
+jws_scan_visited_claim (JwsScanVisited *visited, JwsScanEntry *entry);
+
+/* Whether entry is added, given everything added before it.  Sets is_repeat
+ * if it's a directory whose contents are left out.  Called by the scanning
+ * thread in the order entries are added.  */
+static gboolean
+jws_scan_visited_check (JwsScanVisited *visited, JwsScanEntry *entry);
+
+static guint
+jws_scan_id_hash (gconstpointer id);
+
+static gboolean
+jws_scan_id_equal (gconstpointer a, gconstpointer b);
+
+static JwsScanDirectory *
+jws_scan_directory_new (const gchar *path,
+                        int depth,
+                        JwsScanDirectory *parent);
+
+/* Also frees the listings under it.  */
+static void
+jws_scan_directory_free (JwsScanDirectory *directory);
+
+/* Whether directory or a listing it's under was discarded.  Call with
+ * walk_mutex held.  */
+static gboolean
+jws_scan_directory_is_discarded (JwsScanDirectory *directory);
+
+/* Whether the listing for directory includes listings for its
+ * subdirectories.  */
+static gboolean
+jws_scan_lists_subdirectories (JwsScan *scan, JwsScanDirectory *directory);
+
+static void
+jws_scan_thread (GTask *task,
+                 gpointer source_object,
+                 gpointer scan,
+                 GCancellable *cancellable);
+
+static void
+jws_scan_start_workers (JwsScan *scan, JwsScanDirectory *root);
+
+/* Waits for the workers to run out of directories and exit.  */
+static void
+jws_scan_stop_workers (JwsScan *scan);
+
+static gpointer
+jws_scan_worker_run (gpointer worker);
+
+/* Marks directory as listed and puts the listings for its subdirectories in
+ * the worker's deque.  Call with walk_mutex held.  */
+static void
+jws_scan_worker_finish (JwsScanWorker *worker, JwsScanDirectory *directory);
+
+/* Takes a directory from the worker's own deque, or steals one from another
+ * worker if it's empty.  Call with walk_mutex held.  */
+static JwsScanDirectory *
+jws_scan_worker_take (JwsScanWorker *worker);
+
+/* Fills in the listing for directory, from index if it's there, and makes
+ * empty listings for its subdirectories if list_subdirectories is TRUE.
+ * Called by the workers without any lock held.  */
+static void
+jws_scan_list_directory (JwsScanDirectory *directory,
+                         gboolean list_subdirectories,
+                         JwsIndex *index,
+                         JwsScanVisited *visited,
+                         GCancellable *cancellable);
+
+/* Adds entry to the listing for directory, or frees it if it's left out,
+ * see jws_scan_list_directory ().  */
+static void
+jws_scan_directory_add_entry (JwsScanDirectory *directory,
+                              JwsScanEntry *entry,
+                              gboolean list_subdirectories,
+                              JwsScanVisited *visited);
+
+/* Adds the entries in root and everything under it, in order, as their
+ * listings are done.  */
+static void
+jws_scan_add_directory (JwsScan *scan, JwsScanDirectory *root);
+
+/* Lists the subdirectory at path, at position in directory, right away.
+ * For a directory no worker made a listing for, since another copy of it
+ * was claimed first.  Returns the listing.  */
+static JwsScanDirectory *
+jws_scan_list_subdirectory (JwsScan *scan,
+                            JwsScanDirectory *directory,
+                            guint position,
+                            const gchar *path);
+
+/* Marks the listing at position in directory as discarded.  It's freed with
+ * the root, see has_discarded.  */
+static void
+jws_scan_discard_subdirectory (JwsScan *scan,
+                               JwsScanDirectory *directory,
+                               guint position);
+
+/* Waits for a worker to finish listing directory.  */
+static void
+jws_scan_wait_for_directory (JwsScan *scan, JwsScanDirectory *directory);
+
+/* Numbers entry and queues it to be delivered.  Returns its number.  */
+static gint
+jws_scan_add_entry (JwsScan *scan, JwsScanEntry *entry);
+
+static gboolean
+jws_scan_deliver (gpointer scan);
+
+static void
+on_scan_finished (GObject *source_object,
+                  GAsyncResult *result,
+                  gpointer scan);
+
+static JwsScan *
+jws_scan_ref (JwsScan *scan)
+{
+  g_atomic_int_inc (&scan->ref_count);
+  return scan;
+}
+
+static void
+jws_scan_unref (JwsScan *scan)
+{
+  if (!g_atomic_int_dec_and_test (&scan->ref_count))
+    return;
+
+  g_free (scan->path);
+  g_clear_object (&scan->cancellable);
+  g_clear_pointer (&scan->index, jws_index_unref);
+  jws_scan_visited_clear (&scan->visited);
+  g_mutex_clear (&scan->walk_mutex);
+  g_cond_clear (&scan->walk_cond);
+  g_mutex_clear (&scan->mutex);
+  g_ptr_array_unref (scan->pending);
+  g_free (scan);
+}
+
+void
+jws_scan_entry_free (JwsScanEntry *entry)
+{
+  if (!entry)
+    return;
+
+  g_free (entry->path);
+  g_free (entry->name);
+  g_free (entry->sort_key);
+  g_free (entry);
+}
+
+static gint
+compare_sort_items (gconstpointer a_ptr, gconstpointer b_ptr)
+{
+  const JwsScanSortItem *a = a_ptr;
+  const JwsScanSortItem *b = b_ptr;
+
+  gint result;
+  result = strcmp (a->key, b->key);
+
+  /* Names that only differ in ways the keys leave out still need an order
+   * that doesn't change from one listing to the next.  */
+  if (result == 0)
+    result = strcmp (a->entry->name, b->entry->name);
+
+  return result;
+}
+
+static gint64
+jws_scan_query_directory (GFile *file,
+                          GCancellable *cancellable,
+                          guint64 *device,
+                          guint64 *inode)
+{
+  GFileInfo *info;
+  info = g_file_query_info (file,
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC ","
+                            G_FILE_ATTRIBUTE_UNIX_DEVICE ","
+                            G_FILE_ATTRIBUTE_UNIX_INODE,
+                            G_FILE_QUERY_INFO_NONE,
+                            cancellable,
+                            NULL);
+  if (!info)
+    return -1;
+
+  gint64 mtime = -1;
+  if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED))
+    {
+      mtime = g_file_info_get_attribute_uint64
+        (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC
+        + g_file_info_get_attribute_uint32
+        (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+    }
+
+  if (device)
+    *device = g_file_info_get_attribute_uint32
+      (info, G_FILE_ATTRIBUTE_UNIX_DEVICE);
+  if (inode)
+    *inode = g_file_info_get_attribute_uint64
+      (info, G_FILE_ATTRIBUTE_UNIX_INODE);
+
+  g_object_unref (info);
+
+  return mtime;
+}
+
+gchar *
+jws_scan_get_sort_key (const gchar *name)
+{
+  g_return_val_if_fail (name != NULL, NULL);
+
+  /* File names are only bytes, and collating expects UTF-8.  */
+  if (!g_utf8_validate (name, -1, NULL))
+    {
+      gchar *valid_name;
+      valid_name = g_utf8_make_valid (name, -1);
+      gchar *key;
+      key = g_utf8_collate_key_for_filename (valid_name, -1);
+      g_free (valid_name);
+      return key;
+    }
+
+  return g_utf8_collate_key_for_filename (name, -1);
+}
+
+void
+jws_scan_start (const gchar *path,
+                int max_depth,
+                JwsIndex *index,
+                GCancellable *cancellable,
+                JwsScanBatchFunc batch_func,
+                JwsScanDoneFunc done_func,
+                gpointer user_data)
+{
+  g_return_if_fail (path != NULL);
+
+  JwsScan *scan;
+  scan = g_new0 (JwsScan, 1);
+
+  scan->ref_count = 1;
+  scan->path = g_strdup (path);
+  scan->cancellable = (cancellable) ? g_object_ref (cancellable)
+    : g_cancellable_new ();
+  scan->batch_func = batch_func;
+  scan->done_func = done_func;
+  scan->user_data = user_data;
+  scan->max_depth = max_depth;
+  scan->index = (index) ? jws_index_ref (index) : NULL;
+  jws_scan_visited_init (&scan->visited);
+  scan->n_entries = 0;
+
+  int n_workers;
+  n_workers = jws_preferences_get_integer (JWS_PREFERENCES_GROUP_SCANNING,
+                                           JWS_PREFERENCES_KEY_SCAN_THREADS,
+                                           0);
+  scan->n_workers = (n_workers > 0)
+    ? MIN (n_workers, JWS_SCAN_MAX_THREADS)
+    : JWS_SCAN_DEFAULT_THREADS;
+  scan->workers = NULL;
+  g_mutex_init (&scan->walk_mutex);
+  g_cond_init (&scan->walk_cond);
+  scan->n_outstanding = 0;
+
+  g_mutex_init (&scan->mutex);
+  scan->pending = g_ptr_array_new_with_free_func ((GDestroyNotify)
+                                                  jws_scan_entry_free);
+  scan->deliver_source = 0;
+
+  /* The task's reference to the scan is dropped in on_scan_finished ().  */
+  GTask *task;
+  task = g_task_new (NULL, scan->cancellable, on_scan_finished, scan);
+  g_task_set_task_data (task, scan, NULL);
+  g_task_run_in_thread (task, jws_scan_thread);
+  g_object_unref (task);
+}
+
+GPtrArray *
+jws_scan_list (const gchar *path,
+               JwsIndex *index,
+               GCancellable *cancellable)
+{
+  g_return_val_if_fail (path != NULL, NULL);
+
+  /* Only catches repeats among the directory's own contents.  */
+  JwsScanVisited visited;
+  jws_scan_visited_init (&visited);
+
+  JwsScanDirectory *directory;
+  directory = jws_scan_directory_new (path, 0, NULL);
+  jws_scan_list_directory (directory, FALSE, index, &visited, cancellable);
+
+  GPtrArray *entries;
+  entries = g_ptr_array_new_full (directory->entries->len,
+                                  (GDestroyNotify) jws_scan_entry_free);
+
+  for (guint i = 0; i < directory->entries->len; i++)
+    {
+      JwsScanEntry *entry = g_ptr_array_index (directory->entries, i);
+      g_ptr_array_index (directory->entries, i) = NULL;
+
+      if (!jws_scan_visited_check (&visited, entry))
+        {
+          jws_scan_entry_free (entry);
+          continue;
+        }
+
+      entry->parent = -1;
+      g_ptr_array_add (entries, entry);
+    }
+
+  jws_scan_visited_clear (&visited);
+  jws_scan_directory_free (directory);
+
+  return entries;
+}
+
+JwsScanEntry *
+jws_scan_query (GFile *file, GCancellable *cancellable)
+{
+  g_return_val_if_fail (file != NULL, NULL);
+
+  GFileInfo *info;
+  info = g_file_query_info (file,
+                            JWS_SCAN_ATTRIBUTES,
+                            G_FILE_QUERY_INFO_NONE,
+                            cancellable,
+                            NULL);
+  if (!info)
+    return NULL;
+
+  GFileType file_type;
+  file_type = g_file_info_get_file_type (info);
+
+  JwsScanEntry *entry = NULL;
+
+  if (file_type == G_FILE_TYPE_REGULAR || file_type == G_FILE_TYPE_DIRECTORY)
+    {
+      entry = g_new0 (JwsScanEntry, 1);
+      entry->path = g_file_get_path (file);
+      entry->name = g_strdup (g_file_info_get_name (info));
+      entry->is_directory = (file_type == G_FILE_TYPE_DIRECTORY);
+      entry->mtime = g_file_info_get_attribute_uint64
+        (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+      entry->device = g_file_info_get_attribute_uint32
+        (info, G_FILE_ATTRIBUTE_UNIX_DEVICE);
+      entry->inode = g_file_info_get_attribute_uint64
+        (info, G_FILE_ATTRIBUTE_UNIX_INODE);
+      entry->parent = -1;
+    }
+
+  g_object_unref (info);
+
+  return entry;
+}
+
+static JwsScanDuplicates
+jws_scan_get_duplicates ()
+{
+  gchar *name;
+  name = jws_preferences_get_string (JWS_PREFERENCES_GROUP_SCANNING,
+                                     JWS_PREFERENCES_KEY_DUPLICATES,
+                                     "collapse");
+
+  JwsScanDuplicates duplicates = JWS_SCAN_DUPLICATES_COLLAPSE;
+  if (g_strcmp0 (name, "skip") == 0)
+    duplicates = JWS_SCAN_DUPLICATES_SKIP;
+  else if (g_strcmp0 (name, "keep") == 0)
+    duplicates = JWS_SCAN_DUPLICATES_KEEP;
+
+  g_free (name);
+
+  return duplicates;
+}
+
+static void
+jws_scan_visited_init (JwsScanVisited *visited)
+{
+  visited->duplicates = jws_scan_get_duplicates ();
+  g_mutex_init (&visited->mutex);
+  visited->claimed = g_hash_table_new_full (jws_scan_id_hash,
+                                            jws_scan_id_equal,
+                                            g_free,
+                                            NULL);
+  visited->seen = g_hash_table_new_full (jws_scan_id_hash,
+                                         jws_scan_id_equal,
+                                         g_free,
+                                         NULL);
+}
+
+static void
+jws_scan_visited_clear (JwsScanVisited *visited)
+{
+  g_clear_pointer (&visited->claimed, g_hash_table_unref);
+  g_clear_pointer (&visited->seen, g_hash_table_unref);
+  g_mutex_clear (&visited->mutex);
+}
+
+static gboolean
+jws_scan_visited_check_loop (JwsScanVisited *visited,
+                             JwsScanDirectory *directory,
+                             JwsScanEntry *entry)
+{
+  if (!entry->is_directory || (entry->device == 0 && entry->inode == 0))
+    return TRUE;
+
+  /* Going into a directory that is one of its own parents never ends, no
+   * matter what's done with other repeats.  This only depends on where the
+   * entry is, so it's the same whichever worker gets there first.  */
+  for (JwsScanDirectory *ancestor = directory;
+       ancestor;
+       ancestor = ancestor->parent)
+    {
+      if (ancestor->device == entry->device
+          && ancestor->inode == entry->inode)
+        {
+          entry->is_repeat = TRUE;
+          return visited->duplicates != JWS_SCAN_DUPLICATES_SKIP;
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+jws_scan_visited_claim (JwsScanVisited *visited, JwsScanEntry *entry)
+{
+  if (visited->duplicates == JWS_SCAN_DUPLICATES_KEEP
+      || (entry->device == 0 && entry->inode == 0))
+    return TRUE;
+
+  JwsScanId *id;
+  id = g_new (JwsScanId, 1);
+  id->device = entry->device;
+  id->inode = entry->inode;
+
+  g_mutex_lock (&visited->mutex);
+  gboolean is_new;
+  is_new = g_hash_table_add (visited->claimed, id);
+  g_mutex_unlock (&visited->mutex);
+
+  return is_new;
+}
+
+static gboolean
+jws_scan_visited_check (JwsScanVisited *visited, JwsScanEntry *entry)
+{
+  /* Nothing to go by, or already decided.  */
+  if ((entry->device == 0 && entry->inode == 0) || entry->is_repeat)
+    return TRUE;
+
+  if (visited->duplicates == JWS_SCAN_DUPLICATES_KEEP
+      || (!entry->is_directory
+          && visited->duplicates != JWS_SCAN_DUPLICATES_SKIP))
+    return TRUE;
+
+  JwsScanId *id;
+  id = g_new (JwsScanId, 1);
+  id->device = entry->device;
+  id->inode = entry->inode;
+
+  if (g_hash_table_add (visited->seen, id))
+    return TRUE;
+
+  if (visited->duplicates == JWS_SCAN_DUPLICATES_SKIP)
+    return FALSE;
+
+  entry->is_repeat = TRUE;
+  return TRUE;
+}
+
+static guint
+jws_scan_id_hash (gconstpointer id_ptr)
+{
+  const JwsScanId *id = id_ptr;
+  guint64 key = id->inode ^ (id->device << 32) ^ (id->device >> 32);
+  return g_int64_hash (&key);
+}
+
+static gboolean
+jws_scan_id_equal (gconstpointer a_ptr, gconstpointer b_ptr)
+{
+  const JwsScanId *a = a_ptr;
+  const JwsScanId *b = b_ptr;
+  return a->device == b->device && a->inode == b->inode;
+}
+
+static JwsScanDirectory *
+jws_scan_directory_new (const gchar *path,
+                        int depth,
+                        JwsScanDirectory *parent)
+{
+  JwsScanDirectory *directory;
+  directory = g_new0 (JwsScanDirectory, 1);
+
+  directory->path = g_strdup (path);
+  directory->depth = depth;
+  directory->parent = parent;
+  directory->device = 0;
+  directory->inode = 0;
+  directory->entries = g_ptr_array_new_with_free_func ((GDestroyNotify)
+                                                       jws_scan_entry_free);
+  directory->subdirectories = g_ptr_array_new_with_free_func
+    ((GDestroyNotify) jws_scan_directory_free);
+  directory->done = FALSE;
+  directory->is_discarded = FALSE;
+  directory->has_discarded = FALSE;
+
+  return directory;
+}
+
+static void
+jws_scan_directory_free (JwsScanDirectory *directory)
+{
+  if (!directory)
+    return;
+
+  g_free (directory->path);
+  g_ptr_array_unref (directory->entries);
+  g_ptr_array_unref (directory->subdirectories);
+  g_free (directory);
+}
+
+static gboolean
+jws_scan_directory_is_discarded (JwsScanDirectory *directory)
+{
+  for (; directory; directory = directory->parent)
+    {
+      if (directory->is_discarded)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+jws_scan_lists_subdirectories (JwsScan *scan, JwsScanDirectory *directory)
+{
+  return scan->max_depth <= 0 || directory->depth + 1 < scan->max_depth;
+}
+
+static void
+jws_scan_thread (GTask *task,
+                 gpointer source_object,
+                 gpointer scan_ptr,
+                 GCancellable *cancellable)
+{
+  JwsScan *scan = scan_ptr;
+
+  /* The workers list directories in whatever order they get to them, often
+   * far ahead of this thread, which puts the listings together in the right
+   * order as they're finished.  */
+  JwsScanDirectory *root;
+  root = jws_scan_directory_new (scan->path, 0, NULL);
+
+  jws_scan_start_workers (scan, root);
+  jws_scan_add_directory (scan, root);
+  jws_scan_stop_workers (scan);
+
+  /* Only safe once the workers are gone, they might still have had some of
+   * these in their deques if the scan was cancelled.  */
+  jws_scan_directory_free (root);
+
+  g_task_return_boolean (task, !g_cancellable_is_cancelled (cancellable));
+}
+
+static void
+jws_scan_start_workers (JwsScan *scan, JwsScanDirectory *root)
+{
+  scan->workers = g_new0 (JwsScanWorker, scan->n_workers);
+
+  g_mutex_lock (&scan->walk_mutex);
+
+  for (guint i = 0; i < scan->n_workers; i++)
+    {
+      scan->workers[i].scan = scan;
+      g_queue_init (&scan->workers[i].deque);
+    }
+
+  g_queue_push_tail (&scan->workers[0].deque, root);
+  scan->n_outstanding = 2;
+
+  g_mutex_unlock (&scan->walk_mutex);
+
+  for (guint i = 0; i < scan->n_workers; i++)
+    {
+      scan->workers[i].thread = g_thread_new ("jws-scan",
+                                              jws_scan_worker_run,
+                                              &scan->workers[i]);
+    }
+}
+
+static void
+jws_scan_stop_workers (JwsScan *scan)
+{
+  g_mutex_lock (&scan->walk_mutex);
+  scan->n_outstanding--;
+  g_cond_broadcast (&scan->walk_cond);
+  g_mutex_unlock (&scan->walk_mutex);
+
+  /* A cancelled worker still takes the directories left in the deques but
+   * doesn't list them, so this doesn't take long either way.  */
+  for (guint i = 0; i < scan->n_workers; i++)
+    g_thread_join (scan->workers[i].thread);
+
+  g_clear_pointer (&scan->workers, g_free);
+}
+
+static JwsScanDirectory *
+jws_scan_worker_take (JwsScanWorker *worker)
+{
+  JwsScan *scan = worker->scan;
+
+  /* The newest directory in our own deque is the deepest, which keeps each
+   * worker walking down one branch.  The oldest in someone else's is the
+   * closest to the root, so a steal takes as much work as it can.  */
+  JwsScanDirectory *directory;
+  directory = g_queue_pop_tail (&worker->deque);
+  if (directory)
+    return directory;
+
+  guint own = worker - scan->workers;
+  for (guint i = 1; i < scan->n_workers; i++)
+    {
+      JwsScanWorker *victim = &scan->workers[(own + i) % scan->n_workers];
+      directory = g_queue_pop_head (&victim->deque);
+      if (directory)
+        return directory;
+    }
+
+  return NULL;
+}
+
+static gpointer
+jws_scan_worker_run (gpointer worker_ptr)
+{
+  JwsScanWorker *worker = worker_ptr;
+  JwsScan *scan = worker->scan;
+
+  /* One lock for every deque is enough, the time goes into listing the
+   * directories and not into taking them.  */
+  g_mutex_lock (&scan->walk_mutex);
+
+  while (scan->n_outstanding > 0)
+    {
+      JwsScanDirectory *directory;
+      directory = jws_scan_worker_take (worker);
+
+      if (!directory)
+        {
+          g_cond_wait (&scan->walk_cond, &scan->walk_mutex);
+          continue;
+        }
+
+      /* Nobody is going to look at it, the same as when cancelled.  */
+      if (!jws_scan_directory_is_discarded (directory))
+        {
+          g_mutex_unlock (&scan->walk_mutex);
+          jws_scan_list_directory (directory,
+                                   jws_scan_lists_subdirectories (scan,
+                                                                  directory),
+                                   scan->index,
+                                   &scan->visited,
+                                   scan->cancellable);
+          g_mutex_lock (&scan->walk_mutex);
+        }
+
+      jws_scan_worker_finish (worker, directory);
+      scan->n_outstanding--;
+    }
+
+  g_mutex_unlock (&scan->walk_mutex);
+
+  return NULL;
+}
+
+static void
+jws_scan_worker_finish (JwsScanWorker *worker, JwsScanDirectory *directory)
+{
+  JwsScan *scan = worker->scan;
+
+  directory->done = TRUE;
+
+  /* Pushed backwards so the first subdirectory, which the scanning thread
+   * needs first, is taken first.  */
+  GPtrArray *subdirectories = directory->subdirectories;
+  for (guint i = subdirectories->len; i > 0; i--)
+    {
+      JwsScanDirectory *subdirectory;
+      subdirectory = g_ptr_array_index (subdirectories, i - 1);
+      if (!subdirectory)
+        continue;
+
+      g_queue_push_tail (&worker->deque, subdirectory);
+      scan->n_outstanding++;
+    }
+
+  g_cond_broadcast (&scan->walk_cond);
+}
+
+static void
+jws_scan_list_directory (JwsScanDirectory *directory,
+                         gboolean list_subdirectories,
+                         JwsIndex *index,
+                         JwsScanVisited *visited,
+                         GCancellable *cancellable)
+{
+  if (g_cancellable_is_cancelled (cancellable))
+    return;
+
+  GFile *file;
+  file = g_file_new_for_path (directory->path);
+
+  /* The time is read before listing and again after, see
+   * JWS_SCAN_RACY_INTERVAL.  The device and inode tell whether anything in
+   * it leads back to it.  */
+  gint64 mtime;
+  mtime = jws_scan_query_directory (file, cancellable,
+                                    &directory->device, &directory->inode);
+
+  if (mtime < 0 && index)
+    jws_index_remove (index, directory->path);
+
+  GPtrArray *saved = NULL;
+  if (index && mtime >= 0)
+    saved = jws_index_lookup (index, directory->path, mtime);
+
+  if (saved)
+    {
+      /* Take the entries over instead of copying them.  */
+      g_ptr_array_set_free_func (saved, NULL);
+      for (guint i = 0; i < saved->len; i++)
+        {
+          jws_scan_directory_add_entry (directory,
+                                        g_ptr_array_index (saved, i),
+                                        list_subdirectories,
+                                        visited);
+        }
+      g_ptr_array_unref (saved);
+      g_object_unref (file);
+      return;
+    }
+
+  GFileEnumerator *enumerator;
+  enumerator = g_file_enumerate_children (file,
+                                          JWS_SCAN_ATTRIBUTES,
+                                          G_FILE_QUERY_INFO_NONE,
+                                          cancellable,
+                                          NULL);
+
+  if (!enumerator)
+    {
+      g_object_unref (file);
+      return;
+    }
+
+  /* Directories with tens of thousands of files are common in wallpaper
+   * collections, so the entries go in an array that is sorted once.  */
+  GArray *items;
+  items = g_array_new (FALSE, FALSE, sizeof (JwsScanSortItem));
+  /* Only a listing that got to the end goes in the index.  */
+  gboolean is_complete = FALSE;
+
+  GFileInfo *child_info;
+  GFile *child_file;
+  while (g_file_enumerator_iterate (enumerator,
+                                    &child_info,
+                                    &child_file,
+                                    cancellable,
+                                    NULL))
+    {
+      if (!child_info)
+        {
+          is_complete = TRUE;
+          break;
+        }
+
+      GFileType file_type;
+      file_type = g_file_info_get_file_type (child_info);
+
+      if (file_type != G_FILE_TYPE_REGULAR
+          && file_type != G_FILE_TYPE_DIRECTORY)
+        continue;
+
+      JwsScanEntry *entry;
+      entry = g_new0 (JwsScanEntry, 1);
+      entry->path = g_file_get_path (child_file);
+      entry->name = g_strdup (g_file_info_get_name (child_info));
+      entry->is_directory = (file_type == G_FILE_TYPE_DIRECTORY);
+      entry->mtime = g_file_info_get_attribute_uint64
+        (child_info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+      entry->device = g_file_info_get_attribute_uint32
+        (child_info, G_FILE_ATTRIBUTE_UNIX_DEVICE);
+      entry->inode = g_file_info_get_attribute_uint64
+        (child_info, G_FILE_ATTRIBUTE_UNIX_INODE);
+
+      JwsScanSortItem item;
+      item.key = jws_scan_get_sort_key (entry->name);
+      item.entry = entry;
+      g_array_append_val (items, item);
+    }
+
+  g_object_unref (enumerator);
+
+  g_array_sort (items, compare_sort_items);
+
+  GPtrArray *sorted;
+  sorted = g_ptr_array_sized_new (items->len);
+  for (guint i = 0; i < items->len; i++)
+    {
+      JwsScanSortItem *item = &g_array_index (items, JwsScanSortItem, i);
+      /* Kept so the window can put rows added later in the right place
+       * without working out the keys again.  */
+      item->entry->sort_key = item->key;
+      g_ptr_array_add (sorted, item->entry);
+    }
+  g_array_unref (items);
+
+  /* A directory that changed while it was listed, or so recently that it
+   * could still change without its time moving, is listed again next
+   * time.  */
+  if (index && mtime >= 0 && is_complete)
+    {
+      is_complete = (jws_scan_query_directory (file, cancellable,
+                                               NULL, NULL) == mtime
+                     && g_get_real_time () - mtime
+                     > JWS_SCAN_RACY_INTERVAL);
+    }
+  g_object_unref (file);
+
+  /* The index gets everything, repeats and files the scan rules leave out
+   * included, since what counts as a repeat depends on the rest of the scan
+   * and the rules can change between runs.  */
+  if (index && mtime >= 0 && is_complete)
+    jws_index_insert (index, directory->path, mtime, sorted);
+
+  for (guint i = 0; i < sorted->len; i++)
+    {
+      jws_scan_directory_add_entry (directory,
+                                    g_ptr_array_index (sorted, i),
+                                    list_subdirectories, visited);
+    }
+
+  g_ptr_array_unref (sorted);
+}
+
+static void
+jws_scan_directory_add_entry (JwsScanDirectory *directory,
+                              JwsScanEntry *entry,
+                              gboolean list_subdirectories,
+                              JwsScanVisited *visited)
+{
+  /* Checked before anything else, so an excluded directory is never listed
+   * or claimed.  */
+  if (!jws_scan_rules_allow (jws_scan_rules_get_default (),
+                             entry->name,
+                             entry->is_directory)
+      || !jws_scan_visited_check_loop (visited, directory, entry))
+    {
+      jws_scan_entry_free (entry);
+      return;
+    }
+
+  g_ptr_array_add (directory->entries, entry);
+
+  JwsScanDirectory *subdirectory = NULL;
+  if (entry->is_directory && !entry->is_repeat && list_subdirectories
+      && jws_scan_visited_claim (visited, entry))
+    {
+      subdirectory = jws_scan_directory_new (entry->path,
+                                             directory->depth + 1,
+                                             directory);
+    }
+  g_ptr_array_add (directory->subdirectories, subdirectory);
+}
+
+static void
+jws_scan_wait_for_directory (JwsScan *scan, JwsScanDirectory *directory)
+{
+  g_mutex_lock (&scan->walk_mutex);
+  while (!directory->done)
+    g_cond_wait (&scan->walk_cond, &scan->walk_mutex);
+  g_mutex_unlock (&scan->walk_mutex);
+}
+
+static void
+jws_scan_add_directory (JwsScan *scan, JwsScanDirectory *root)
+{
+  /* The directories being gone through, innermost last, kept here instead
+   * of recursing so a deep tree can't run the thread out of stack.  */
+  GArray *stack;
+  stack = g_array_new (FALSE, FALSE, sizeof (JwsScanFrame));
+
+  jws_scan_wait_for_directory (scan, root);
+
+  JwsScanFrame root_frame = {root, -1, 0};
+  g_array_append_val (stack, root_frame);
+
+  while (stack->len > 0)
+    {
+      /* Whatever is left is freed with the root once the workers are
+       * gone.  Nothing can be freed before that, since a directory's
+       * subdirectories may still be in a deque or being listed.  */
+      if (g_cancellable_is_cancelled (scan->cancellable))
+        break;
+
+      JwsScanFrame *frame;
+      frame = &g_array_index (stack, JwsScanFrame, stack->len - 1);
+      JwsScanDirectory *directory = frame->directory;
+
+      if (frame->next_entry == directory->entries->len)
+        {
+          g_array_set_size (stack, stack->len - 1);
+
+          if (stack->len == 0)
+            continue;
+
+          JwsScanFrame *parent_frame;
+          parent_frame = &g_array_index (stack, JwsScanFrame,
+                                         stack->len - 1);
+
+          /* Everything under it was added, so nothing else refers to it
+           * now, unless a discarded listing is still being worked on.  */
+          if (directory->has_discarded)
+            {
+              parent_frame->directory->has_discarded = TRUE;
+            }
+          else
+            {
+              g_ptr_array_index (parent_frame->directory->subdirectories,
+                                 parent_frame->next_entry - 1) = NULL;
+              jws_scan_directory_free (directory);
+            }
+          continue;
+        }
+
+      /* The scan owns the entry after it's added.  */
+      guint position = frame->next_entry;
+      JwsScanEntry *entry = g_ptr_array_index (directory->entries, position);
+      g_ptr_array_index (directory->entries, position) = NULL;
+      frame->next_entry++;
+
+      /* Repeats are decided here rather than by the workers, so the copy
+       * that comes first in the tree is always the one with contents.  */
+      JwsScanDirectory *subdirectory;
+      subdirectory = g_ptr_array_index (directory->subdirectories, position);
+
+      if (!jws_scan_visited_check (&scan->visited, entry))
+        {
+          jws_scan_entry_free (entry);
+          if (subdirectory)
+            jws_scan_discard_subdirectory (scan, directory, position);
+          continue;
+        }
+
+      if (entry->is_repeat)
+        {
+          if (subdirectory)
+            jws_scan_discard_subdirectory (scan, directory, position);
+          subdirectory = NULL;
+        }
+      else if (entry->is_directory && !subdirectory
+               && jws_scan_lists_subdirectories (scan, directory))
+        {
+          subdirectory = jws_scan_list_subdirectory (scan, directory,
+                                                     position, entry->path);
+        }
+
+      entry->parent = frame->parent;
+      gint index = jws_scan_add_entry (scan, entry);
+
+      if (subdirectory)
+        {
+          JwsScanFrame child_frame;
+          child_frame.directory = subdirectory;
+          child_frame.parent = index;
+          child_frame.next_entry = 0;
+
+          jws_scan_wait_for_directory (scan, subdirectory);
+          g_array_append_val (stack, child_frame);
+        }
+    }
+
+  g_array_unref (stack);
+}
+
+static JwsScanDirectory *
+jws_scan_list_subdirectory (JwsScan *scan,
+                            JwsScanDirectory *directory,
+                            guint position,
+                            const gchar *path)
+{
+  JwsScanDirectory *subdirectory;
+  subdirectory = jws_scan_directory_new (path, directory->depth + 1,
+                                         directory);
+
+  jws_scan_list_directory (subdirectory,
+                           jws_scan_lists_subdirectories (scan, subdirectory),
+                           scan->index,
+                           &scan->visited,
+                           scan->cancellable);
+
+  /* The workers are still waiting for more, since n_outstanding counts this
+   * thread, so what's under it is handed to them.  */
+  g_mutex_lock (&scan->walk_mutex);
+  g_ptr_array_index (directory->subdirectories, position) = subdirectory;
+  jws_scan_worker_finish (&scan->workers[0], subdirectory);
+  g_mutex_unlock (&scan->walk_mutex);
+
+  return subdirectory;
+}
+
+static void
+jws_scan_discard_subdirectory (JwsScan *scan,
+                               JwsScanDirectory *directory,
+                               guint position)
+{
+  JwsScanDirectory *subdirectory;
+  subdirectory = g_ptr_array_index (directory->subdirectories, position);
+
+  g_mutex_lock (&scan->walk_mutex);
+  subdirectory->is_discarded = TRUE;
+  g_mutex_unlock (&scan->walk_mutex);
+
+  directory->has_discarded = TRUE;
+}
+
+static gint
+jws_scan_add_entry (JwsScan *scan, JwsScanEntry *entry)
+{
+  gint index = scan->n_entries++;
+
+  g_mutex_lock (&scan->mutex);
+
+  g_ptr_array_add (scan->pending, entry);
+
+  if (!scan->deliver_source)
+    {
+      scan->deliver_source
+        = g_timeout_add_full (G_PRIORITY_DEFAULT_IDLE,
+                              JWS_SCAN_DELIVERY_INTERVAL,
+                              jws_scan_deliver,
+                              jws_scan_ref (scan),
+                              (GDestroyNotify) jws_scan_unref);
+    }
+
+  g_mutex_unlock (&scan->mutex);
+
+  return index;
+}
+
+static gboolean
+jws_scan_deliver (gpointer scan_ptr)
+{
+  JwsScan *scan = scan_ptr;
+
+  g_mutex_lock (&scan->mutex);
+
+  GPtrArray *entries = scan->pending;
+  scan->pending = g_ptr_array_new_with_free_func ((GDestroyNotify)
+                                                  jws_scan_entry_free);
+  scan->deliver_source = 0;
+
+  g_mutex_unlock (&scan->mutex);
+
+  /* Checked in the main thread, so once the caller cancels nothing else is
+   * delivered.  */
+  if (entries->len > 0 && !g_cancellable_is_cancelled (scan->cancellable))
+    scan->batch_func (entries, scan->user_data);
+
+  g_ptr_array_unref (entries);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+on_scan_finished (GObject *source_object,
+                  GAsyncResult *result,
+                  gpointer scan_ptr)
+{
+  JwsScan *scan = scan_ptr;
+
+  /* The thread is done, so whatever is left can go out now instead of
+   * waiting for the timeout.  */
+  g_mutex_lock (&scan->mutex);
+  guint deliver_source = scan->deliver_source;
+  scan->deliver_source = 0;
+  g_mutex_unlock (&scan->mutex);
+
+  if (deliver_source)
+    g_source_remove (deliver_source);
+
+  jws_scan_deliver (scan);
+
+  gboolean completed;
+  completed = g_task_propagate_boolean (G_TASK (result), NULL);
+
+  scan->done_func (completed, scan->user_data);
+
+  jws_scan_unref (scan);
+}
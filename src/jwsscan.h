@@ -0,0 +1,122 @@
+/* jwsscan.h - header for scanning directories in the background
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef JWSSCAN_H
+#define JWSSCAN_H
+
+#include <gio/gio.h>
+
+#include "jwsindex.h"
+
+/* Scans walk everything under a directory on another thread, so a big or
+ * slow tree doesn't freeze the window.  What they find is handed back to the
+ * main loop in batches, in the same order the tree shows it: each directory's
+ * children sorted by jws_scan_get_sort_key (), and each directory right
+ * before everything in it.
+ * Directories are listed by a few worker threads at once, set with Threads
+ * in the [Scanning] group of the preferences, since each listing spends most
+ * of its time waiting for the disk or the network.
+ *
+ * Every directory is identified by its device and inode, so one that is
+ * inside itself through a symbolic link is only shown once without its
+ * contents, and what happens to directories found twice in other ways is set
+ * with Duplicates in the [Scanning] group.  Of the copies, the one delivered
+ * first is always the one with contents, however the listings raced.
+ *
+ * Files and directories the scan rules leave out, see jwsscanrules.h, are
+ * dropped as soon as they're found, so an excluded directory is never listed.
+ * jws_scan_query () doesn't apply them.
+ *
+ * Cancelling the GCancellable stops the walk, and no batch is delivered
+ * after that, even one that was already found.  The done function is always
+ * called exactly once at the end, and the scan frees itself after it.  */
+
+typedef struct _JwsScanEntry JwsScanEntry;
+
+struct _JwsScanEntry
+{
+  gchar *path;
+  gchar *name;
+  /* From jws_scan_get_sort_key () if the entry was sorted on its way here,
+   * otherwise NULL.  */
+  gchar *sort_key;
+  gboolean is_directory;
+  /* Seconds since the epoch.  Out of date if the entry came from the index
+   * and the file was written to in place since.  */
+  gint64 mtime;
+  /* Both are 0 if the file system doesn't have them.  */
+  guint64 device;
+  guint64 inode;
+  /* Set for a directory whose contents are left out because it's inside
+   * itself or was already found elsewhere.  */
+  gboolean is_repeat;
+  /* Entries are numbered from 0 in the order they are delivered.  This is
+   * the number of the directory the entry is in, or -1 if it's directly in
+   * the directory being scanned.  It's always lower than the entry's own
+   * number.  */
+  gint parent;
+};
+
+/* Called from the main loop with an array of JwsScanEntry that is freed
+ * afterwards.  */
+typedef void (*JwsScanBatchFunc) (GPtrArray *entries, gpointer user_data);
+
+/* Called from the main loop when the scan is over.  completed is FALSE if it
+ * was cancelled.  */
+typedef void (*JwsScanDoneFunc) (gboolean completed, gpointer user_data);
+
+/* Starts scanning the directory at path.  max_depth is how many levels to go
+ * down, 1 for only the directory's own contents, or 0 for everything.  If
+ * index isn't NULL, directories that haven't changed since they were last
+ * listed are read from it instead of the disk, and new listings are added to
+ * it.  */
+void
+jws_scan_start (const gchar *path,
+                int max_depth,
+                JwsIndex *index,
+                GCancellable *cancellable,
+                JwsScanBatchFunc batch_func,
+                JwsScanDoneFunc done_func,
+                gpointer user_data);
+
+/* Lists the contents of the directory at path right away, without going into
+ * subdirectories, using index like jws_scan_start ().  Returns a sorted array
+ * of JwsScanEntry, which is empty if the directory can't be read.  Free with
+ * g_ptr_array_unref ().  */
+GPtrArray *
+jws_scan_list (const gchar *path,
+               JwsIndex *index,
+               GCancellable *cancellable);
+
+/* Returns an entry for file with a parent of -1, or NULL if it isn't a
+ * regular file or a directory.  Free with jws_scan_entry_free ().  */
+JwsScanEntry *
+jws_scan_query (GFile *file, GCancellable *cancellable);
+
+void
+jws_scan_entry_free (JwsScanEntry *entry);
+
+/* Returns the key entries are sorted by.  Comparing keys with strcmp (),
+ * and the names themselves when the keys are the same, gives the order a
+ * file manager shows, with "img2" before "img10".  name doesn't have to be
+ * valid UTF-8.  Free with g_free ().  */
+gchar *
+jws_scan_get_sort_key (const gchar *name);
+
+#endif /* JWSSCAN_H */
@@ -0,0 +1,222 @@
+/* jwsscanrules.c - deciding what scans add
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "jwsscanrules.h"
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <string.h>
+
+#include "jwspreferences.h"
+
+/* Longer extensions are still matched, just through the patterns.  */
+#define JWS_SCAN_RULES_MAX_EXTENSION 16
+
+struct _JwsScanRules
+{
+  gboolean show_hidden;
+  /* Lower case extensions without the dot, from include patterns of the
+   * form "*.ext", which covers almost all of them with one lookup.  */
+  GHashTable *extensions;
+  /* GPatternSpecs for the other include patterns.  */
+  GPtrArray *include_patterns;
+  /* GPatternSpecs for the names of directories to leave out.  */
+  GPtrArray *exclude_directory_patterns;
+};
+
+static JwsScanRules *
+jws_scan_rules_new ();
+
+/* Adds pattern to the extensions if it's a plain "*.ext", otherwise
+ * compiles it.  */
+static void
+jws_scan_rules_add_include (JwsScanRules *rules, const gchar *pattern);
+
+/* Adds the extensions of every format GdkPixbuf can load.  */
+static void
+jws_scan_rules_add_pixbuf_extensions (JwsScanRules *rules);
+
+static gboolean
+jws_scan_rules_match_any (GPtrArray *patterns, const gchar *name);
+
+const JwsScanRules *
+jws_scan_rules_get_default ()
+{
+  static gsize initialized = 0;
+  static JwsScanRules *rules = NULL;
+
+  if (g_once_init_enter (&initialized))
+    {
+      rules = jws_scan_rules_new ();
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return rules;
+}
+
+static JwsScanRules *
+jws_scan_rules_new ()
+{
+  JwsScanRules *rules;
+  rules = g_new0 (JwsScanRules, 1);
+
+  rules->show_hidden = jws_preferences_get_boolean
+    (JWS_PREFERENCES_GROUP_SCANNING,
+     JWS_PREFERENCES_KEY_SHOW_HIDDEN,
+     FALSE);
+
+  rules->extensions = g_hash_table_new_full (g_str_hash,
+                                             g_str_equal,
+                                             g_free,
+                                             NULL);
+  rules->include_patterns = g_ptr_array_new_with_free_func
+    ((GDestroyNotify) g_pattern_spec_free);
+  rules->exclude_directory_patterns = g_ptr_array_new_with_free_func
+    ((GDestroyNotify) g_pattern_spec_free);
+
+  gchar **include;
+  include = jws_preferences_get_string_list (JWS_PREFERENCES_GROUP_SCANNING,
+                                             JWS_PREFERENCES_KEY_INCLUDE);
+  if (include)
+    {
+      for (gchar **pattern = include; *pattern; pattern++)
+        jws_scan_rules_add_include (rules, *pattern);
+      g_strfreev (include);
+    }
+  else
+    {
+      jws_scan_rules_add_pixbuf_extensions (rules);
+    }
+
+  gchar **exclude;
+  exclude = jws_preferences_get_string_list
+    (JWS_PREFERENCES_GROUP_SCANNING,
+     JWS_PREFERENCES_KEY_EXCLUDE_DIRECTORIES);
+  if (!exclude)
+    exclude = g_strsplit (".git;node_modules;@eaDir", ";", -1);
+
+  for (gchar **pattern = exclude; *pattern; pattern++)
+    {
+      if (**pattern)
+        g_ptr_array_add (rules->exclude_directory_patterns,
+                         g_pattern_spec_new (*pattern));
+    }
+  g_strfreev (exclude);
+
+  return rules;
+}
+
+static void
+jws_scan_rules_add_include (JwsScanRules *rules, const gchar *pattern)
+{
+  if (!*pattern)
+    return;
+
+  if (g_str_has_prefix (pattern, "*.")
+      && pattern[2] != '\0'
+      && strlen (pattern + 2) < JWS_SCAN_RULES_MAX_EXTENSION
+      && !strpbrk (pattern + 2, "*?."))
+    {
+      g_hash_table_add (rules->extensions, g_ascii_strdown (pattern + 2, -1));
+      return;
+    }
+
+  g_ptr_array_add (rules->include_patterns, g_pattern_spec_new (pattern));
+}
+
+static void
+jws_scan_rules_add_pixbuf_extensions (JwsScanRules *rules)
+{
+  GSList *formats;
+  formats = gdk_pixbuf_get_formats ();
+
+  for (GSList *iter = formats; iter; iter = g_slist_next (iter))
+    {
+      GdkPixbufFormat *format = iter->data;
+      if (gdk_pixbuf_format_is_disabled (format))
+        continue;
+
+      gchar **extensions;
+      extensions = gdk_pixbuf_format_get_extensions (format);
+      for (gchar **extension = extensions; *extension; extension++)
+        {
+          gchar *pattern;
+          pattern = g_strconcat ("*.", *extension, NULL);
+          jws_scan_rules_add_include (rules, pattern);
+          g_free (pattern);
+        }
+      g_strfreev (extensions);
+    }
+
+  g_slist_free (formats);
+}
+
+static gboolean
+jws_scan_rules_match_any (GPtrArray *patterns, const gchar *name)
+{
+  for (guint i = 0; i < patterns->len; i++)
+    {
+      GPatternSpec *pattern = g_ptr_array_index (patterns, i);
+#if GLIB_CHECK_VERSION (2, 70, 0)
+      if (g_pattern_spec_match_string (pattern, name))
+        return TRUE;
+#else
+      if (g_pattern_match_string (pattern, name))
+        return TRUE;
+#endif
+    }
+
+  return FALSE;
+}
+
+gboolean
+jws_scan_rules_allow (const JwsScanRules *rules,
+                      const gchar *name,
+                      gboolean is_directory)
+{
+  g_return_val_if_fail (rules != NULL, FALSE);
+  g_return_val_if_fail (name != NULL, FALSE);
+
+  if (!rules->show_hidden && name[0] == '.')
+    return FALSE;
+
+  if (is_directory)
+    return !jws_scan_rules_match_any (rules->exclude_directory_patterns,
+                                      name);
+
+  /* Lowered on the stack, since this runs for every file listed.  */
+  const gchar *dot;
+  dot = strrchr (name, '.');
+  if (dot && dot[1] != '\0')
+    {
+      gsize length;
+      length = strlen (dot + 1);
+
+      if (length < JWS_SCAN_RULES_MAX_EXTENSION)
+        {
+          gchar extension[JWS_SCAN_RULES_MAX_EXTENSION];
+          for (gsize i = 0; i <= length; i++)
+            extension[i] = g_ascii_tolower (dot[1 + i]);
+
+          if (g_hash_table_contains (rules->extensions, extension))
+            return TRUE;
+        }
+    }
+
+  return jws_scan_rules_match_any (rules->include_patterns, name);
+}
@@ -0,0 +1,43 @@
+/* jwsscanrules.h - header for deciding what scans add
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef JWSSCANRULES_H
+#define JWSSCANRULES_H
+
+#include <glib.h>
+
+/* The rules for which files and directories scans add, set with Include,
+ * ExcludeDirectories and ShowHidden in the [Scanning] group.  They only look
+ * at names, so listing a directory doesn't need anything else about the
+ * files it leaves out.  */
+typedef struct _JwsScanRules JwsScanRules;
+
+/* The rules from the preferences, compiled the first time they're needed
+ * and shared by every thread after that.  */
+const JwsScanRules *
+jws_scan_rules_get_default ();
+
+/* Whether a file or directory called name is added.  A directory that isn't
+ * is never listed.  */
+gboolean
+jws_scan_rules_allow (const JwsScanRules *rules,
+                      const gchar *name,
+                      gboolean is_directory);
+
+#endif /* JWSSCANRULES_H */
@@ -0,0 +1,231 @@
+/* jwsthumbnailcache.c - shared on-disk thumbnail cache
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "jwsthumbnailcache.h"
+
+#include <glib/gstdio.h>
+#include <stdlib.h>
+
+typedef struct _JwsThumbnailFlavor JwsThumbnailFlavor;
+
+struct _JwsThumbnailFlavor
+{
+  const gchar *directory;
+  int size;
+};
+
+/* In the order they're checked in.  The preview height is closest to the
+ * large size, and the normal ones are usually too small but still work for
+ * images that are tall or small.  */
+static const JwsThumbnailFlavor thumbnail_flavors[] =
+  {
+    {"large", JWS_THUMBNAIL_CACHE_LARGE_SIZE},
+    {"x-large", 512},
+    {"normal", 128}
+  };
+
+/* Free with g_free ().  */
+static gchar *
+jws_thumbnail_cache_get_path (const gchar *uri, const gchar *directory);
+
+static gboolean
+jws_thumbnail_is_valid (GdkPixbuf *thumbnail,
+                        const gchar *uri,
+                        gint64 mtime,
+                        goffset size);
+
+static gchar *
+jws_thumbnail_cache_get_path (const gchar *uri, const gchar *directory)
+{
+  gchar *checksum;
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, uri, -1);
+
+  gchar *basename;
+  basename = g_strconcat (checksum, ".png", NULL);
+
+  gchar *path;
+  path = g_build_filename (g_get_user_cache_dir (),
+                           "thumbnails",
+                           directory,
+                           basename,
+                           NULL);
+
+  g_free (basename);
+  g_free (checksum);
+
+  return path;
+}
+
+static gboolean
+jws_thumbnail_is_valid (GdkPixbuf *thumbnail,
+                        const gchar *uri,
+                        gint64 mtime,
+                        goffset size)
+{
+  const gchar *thumb_uri;
+  thumb_uri = gdk_pixbuf_get_option (thumbnail, "tEXt::Thumb::URI");
+
+  if (g_strcmp0 (thumb_uri, uri) != 0)
+    return FALSE;
+
+  const gchar *thumb_mtime;
+  thumb_mtime = gdk_pixbuf_get_option (thumbnail, "tEXt::Thumb::MTime");
+
+  if (!thumb_mtime || g_ascii_strtoll (thumb_mtime, NULL, 10) != mtime)
+    return FALSE;
+
+  /* The size is optional in the standard, so only check it if it's there.  */
+  const gchar *thumb_size;
+  thumb_size = gdk_pixbuf_get_option (thumbnail, "tEXt::Thumb::Size");
+
+  if (thumb_size && g_ascii_strtoll (thumb_size, NULL, 10) != size)
+    return FALSE;
+
+  return TRUE;
+}
+
+GdkPixbuf *
+jws_thumbnail_cache_lookup (const gchar *path,
+                            gint64 mtime,
+                            goffset size,
+                            int min_height)
+{
+  gchar *uri;
+  uri = g_filename_to_uri (path, NULL, NULL);
+
+  if (!uri)
+    return NULL;
+
+  GdkPixbuf *found = NULL;
+
+  for (int i = 0; !found && i < G_N_ELEMENTS (thumbnail_flavors); i++)
+    {
+      gchar *thumb_path;
+      thumb_path = jws_thumbnail_cache_get_path (uri,
+                                                 thumbnail_flavors[i].directory);
+
+      GdkPixbuf *thumbnail;
+      thumbnail = gdk_pixbuf_new_from_file (thumb_path, NULL);
+      g_free (thumb_path);
+
+      if (!thumbnail)
+        continue;
+
+      int width = gdk_pixbuf_get_width (thumbnail);
+      int height = gdk_pixbuf_get_height (thumbnail);
+      int box = thumbnail_flavors[i].size;
+
+      /* A thumbnail that doesn't touch the edges of its box wasn't scaled
+       * down, so it's the whole image and can't get any better.  */
+      gboolean is_big_enough = (height >= min_height
+                                || (width < box && height < box));
+
+      if (is_big_enough && jws_thumbnail_is_valid (thumbnail, uri, mtime, size))
+        found = thumbnail;
+      else
+        g_object_unref (thumbnail);
+    }
+
+  g_free (uri);
+
+  return found;
+}
+
+gboolean
+jws_thumbnail_cache_store (const gchar *path,
+                           gint64 mtime,
+                           goffset size,
+                           int src_width,
+                           int src_height,
+                           GdkPixbuf *thumbnail)
+{
+  g_return_val_if_fail (thumbnail != NULL, FALSE);
+
+  if (gdk_pixbuf_get_width (thumbnail) > JWS_THUMBNAIL_CACHE_LARGE_SIZE
+      || gdk_pixbuf_get_height (thumbnail) > JWS_THUMBNAIL_CACHE_LARGE_SIZE)
+    return FALSE;
+
+  gchar *uri;
+  uri = g_filename_to_uri (path, NULL, NULL);
+
+  if (!uri)
+    return FALSE;
+
+  gchar *thumb_path;
+  thumb_path = jws_thumbnail_cache_get_path (uri, "large");
+
+  gchar *thumb_dir;
+  thumb_dir = g_path_get_dirname (thumb_path);
+  g_mkdir_with_parents (thumb_dir, 0700);
+  g_free (thumb_dir);
+
+  gchar *mtime_string = g_strdup_printf ("%" G_GINT64_FORMAT, mtime);
+  gchar *size_string = g_strdup_printf ("%" G_GINT64_FORMAT, (gint64) size);
+  gchar *width_string = g_strdup_printf ("%d", src_width);
+  gchar *height_string = g_strdup_printf ("%d", src_height);
+
+  gchar *keys[] =
+    {
+      "tEXt::Thumb::URI",
+      "tEXt::Thumb::MTime",
+      "tEXt::Thumb::Size",
+      "tEXt::Software",
+      "tEXt::Thumb::Image::Width",
+      "tEXt::Thumb::Image::Height",
+      NULL
+    };
+  gchar *values[] =
+    {
+      uri,
+      mtime_string,
+      size_string,
+      "jws-config",
+      width_string,
+      height_string,
+      NULL
+    };
+
+  /* Leave out the image dimensions if they aren't known.  */
+  if (src_width <= 0 || src_height <= 0)
+    keys[4] = NULL;
+
+  gchar *buffer = NULL;
+  gsize buffer_size = 0;
+  gboolean status;
+  status = gdk_pixbuf_save_to_bufferv (thumbnail, &buffer, &buffer_size,
+                                       "png", keys, values, NULL);
+
+  /* The standard asks for the thumbnail to be written somewhere else and then
+   * renamed so other programs never see half of one, and for it to only be
+   * readable by the user.  */
+  if (status)
+    status = g_file_set_contents_full (thumb_path, buffer, buffer_size,
+                                       G_FILE_SET_CONTENTS_CONSISTENT,
+                                       0600, NULL);
+
+  g_free (buffer);
+  g_free (mtime_string);
+  g_free (size_string);
+  g_free (width_string);
+  g_free (height_string);
+  g_free (thumb_path);
+  g_free (uri);
+
+  return status;
+}
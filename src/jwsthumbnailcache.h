@@ -0,0 +1,56 @@
+/* jwsthumbnailcache.h - header for the shared on-disk thumbnail cache
+
+Copyright (C) 2016 Jason Waataja
+
+This file is part of JWS.
+
+JWS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+JWS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with JWS.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef JWSTHUMBNAILCACHE_H
+#define JWSTHUMBNAILCACHE_H
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/* Reads and writes thumbnails in ~/.cache/thumbnails following the
+ * freedesktop.org thumbnail managing standard, so thumbnails made by file
+ * managers are reused here and the other way around.  A thumbnail is only
+ * used if the URI, modification time and, when it was recorded, the size of
+ * the file still match.  Everything here is safe to call from any thread.  */
+
+/* The box that thumbnails in the "large" directory fit in.  This is the one
+ * jws-config writes because "normal" thumbnails of wide images are shorter
+ * than the preview height.  */
+#define JWS_THUMBNAIL_CACHE_LARGE_SIZE 256
+
+/* Returns a cached thumbnail for the file at path that is at least min_height
+ * pixels high, or that is as big as the image itself.  Returns NULL if there
+ * isn't one or it is out of date.  Free the result with g_object_unref ().  */
+GdkPixbuf *
+jws_thumbnail_cache_lookup (const gchar *path,
+                            gint64 mtime,
+                            goffset size,
+                            int min_height);
+
+/* Saves thumbnail as the "large" thumbnail for the file at path.  thumbnail
+ * must fit in JWS_THUMBNAIL_CACHE_LARGE_SIZE.  src_width and src_height are
+ * the dimensions of the original image, or zero if unknown.  */
+gboolean
+jws_thumbnail_cache_store (const gchar *path,
+                           gint64 mtime,
+                           goffset size,
+                           int src_width,
+                           int src_height,
+                           GdkPixbuf *thumbnail);
+
+#endif /* JWSTHUMBNAILCACHE_H */